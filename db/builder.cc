@@ -9,6 +9,7 @@
 
 #include "db/dbformat.h"
 #include "db/filename.h"
+#include "db/range_del.h"
 #include "db/table_cache.h"
 #include "db/version_edit.h"
 #include "leveldb/db.h"
@@ -17,9 +18,45 @@
 
 namespace leveldb {
 
+namespace {
+
+class RateLimitedFile : public WritableFile {
+ public:
+  RateLimitedFile(WritableFile* file, RateLimiter* limiter,
+                  RateLimiter::IOPriority pri)
+      : file_(file), limiter_(limiter), pri_(pri) {}
+
+  ~RateLimitedFile() override { delete file_; }
+
+  Status Append(const Slice& data) override {
+    limiter_->Request(data.size(), pri_);
+    return file_->Append(data);
+  }
+
+  Status Close() override { return file_->Close(); }
+  Status Flush() override { return file_->Flush(); }
+  Status Sync() override { return file_->Sync(); }
+
+ private:
+  WritableFile* const file_;
+  RateLimiter* const limiter_;
+  const RateLimiter::IOPriority pri_;
+};
+
+}  // namespace
+
+WritableFile* NewRateLimitedFile(WritableFile* file, RateLimiter* limiter,
+                                 RateLimiter::IOPriority pri) {
+  if (limiter == nullptr) {
+    return file;
+  }
+  return new RateLimitedFile(file, limiter, pri);
+}
+
 Status BuildTable(const std::string& dbname, Env* env, const Options& options,
                   TableCache* table_cache, Iterator* iter, FileMetaData* meta,
-                  VanillaBPlusTree<std::string, uint64_t>* btree) {
+                  VanillaBPlusTree<std::string, uint64_t>* btree,
+                  SequenceNumber smallest_snapshot) {
   Status s;
   meta->file_size = 0;
   iter->SeekToFirst();
@@ -31,21 +68,57 @@ Status BuildTable(const std::string& dbname, Env* env, const Options& options,
     if (!s.ok()) {
       return s;
     }
+    //flush写入的字节计入限速器，但不等待
+    file = NewRateLimitedFile(file, options.rate_limiter, RateLimiter::kHigh);
 
     TableBuilder* builder = new TableBuilder(options, file);
     meta->smallest.DecodeFrom(iter->key());
     Slice key;
+    // options.comparator is the internal key comparator (SanitizeOptions)
+    const Comparator* ucmp =
+        static_cast<const InternalKeyComparator*>(options.comparator)
+            ->user_comparator();
+    RunIndexer indexer(ucmp, btree, meta->number);
+    //和compaction相同的规则：更新的版本对所有快照可见时，旧版本可以丢弃
+    //没有快照时smallest_snapshot可以是kMaxSequenceNumber，每个key的第一个条目单独判断
+    std::string current_user_key;
+    bool has_current_user_key = false;
+    SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
 
     for (; iter->Valid(); iter->Next()) {
       //std::cout<<"before!!!!!!!!insert1:!!!!!!!!!!!!!!!!!!"<<std::endl;
       //std::cout<<btree->toString()<<std::endl;
+      ParsedInternalKey ikey;
+      const bool parsed = ParseInternalKey(iter->key(), &ikey);
+      if (parsed && ikey.type != kTypeRangeDeletion) {
+        bool drop = false;
+        if (!has_current_user_key ||
+            ucmp->Compare(ikey.user_key, Slice(current_user_key)) != 0) {
+          // First occurrence of this user key
+          current_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
+          has_current_user_key = true;
+        } else {
+          drop = (last_sequence_for_key <= smallest_snapshot);
+        }
+        last_sequence_for_key = ikey.sequence;
+        if (drop) {
+          // Hidden by a newer entry for same user key
+          continue;
+        }
+      }
       key = iter->key();
-      //返回的是internalkey，需要减掉8bits的tag（internalkey=userkey+tag）
-      Slice tmp(key.data(), key.size() - 8);
-      std::string usr_key = tmp.ToString();
-
       builder->Add(key, iter->value());
-      btree->insert(usr_key, meta->number);
+      meta->num_entries++;
+      if (parsed && ikey.type != kTypeValue) {
+        meta->num_deletions++;
+      }
+      //被范围删除覆盖的版本仍写入文件（快照可能需要），但不进入B+树
+      if (parsed) {
+        indexer.Add(ikey, iter->value());
+      } else {
+        //返回的是internalkey，需要减掉8bits的tag（internalkey=userkey+tag）
+        btree->insert(ExtractUserKey(key).ToString(), meta->number);
+      }
     }
 
     if (!key.empty()) {
@@ -5,6 +5,8 @@
 #ifndef STORAGE_LEVELDB_DB_BUILDER_H_
 #define STORAGE_LEVELDB_DB_BUILDER_H_
 
+#include "db/dbformat.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/status.h"
 #include "trees/vanilla_b_plus_tree.h"
 #include <string>
@@ -18,15 +20,26 @@ class Env;
 class Iterator;
 class TableCache;
 class VersionEdit;
+class WritableFile;
 
 // Build a Table file from the contents of *iter.  The generated file
 // will be named according to meta->number.  On success, the rest of
 // *meta will be filled with metadata about the generated table.
 // If no data is present in *iter, meta->file_size will be set to
 // zero, and no Table file will be produced.
+// A version of a user key is dropped when a newer version of the same
+// key at or below "smallest_snapshot" exists, since no reader can see it.
+// Range tombstones are always kept.
 Status BuildTable(const std::string& dbname, Env* env, const Options& options,
                   TableCache* table_cache, Iterator* iter, FileMetaData* meta, 
-                  VanillaBPlusTree<std::string, uint64_t>* btree);
+                  VanillaBPlusTree<std::string, uint64_t>* btree,
+                  SequenceNumber smallest_snapshot);
+
+// Return a file that asks "limiter" for every Append at priority "pri"
+// before passing it on to "file".  Takes ownership of "file".  Returns
+// "file" itself if "limiter" is null.
+WritableFile* NewRateLimitedFile(WritableFile* file, RateLimiter* limiter,
+                                 RateLimiter::IOPriority pri);
 
 }  // namespace leveldb
 
@@ -0,0 +1,105 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/compaction_filter.h"
+
+#include "gtest/gtest.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+namespace {
+
+// Drops values starting with "x" and upper-cases the first letter of
+// values starting with "r".
+class TestFilter : public CompactionFilter {
+ public:
+  bool Filter(int level, const Slice& key, const Slice& existing_value,
+              std::string* new_value, bool* value_changed) const override {
+    if (existing_value.starts_with("x")) {
+      return true;
+    }
+    if (existing_value.starts_with("r")) {
+      *new_value = "R" + existing_value.ToString().substr(1);
+      *value_changed = true;
+    }
+    return false;
+  }
+
+  const char* Name() const override { return "TestFilter"; }
+};
+
+}  // namespace
+
+class CompactionFilterTest : public testing::Test {
+ public:
+  CompactionFilterTest() : db_(nullptr) {
+    dbname_ = testing::TempDir() + "compaction_filter_test";
+    options_.create_if_missing = true;
+    options_.compaction_filter = &filter_;
+    DestroyDB(dbname_, options_);
+    EXPECT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  ~CompactionFilterTest() {
+    delete db_;
+    DestroyDB(dbname_, options_);
+  }
+
+  Status Put(const std::string& k, const std::string& v) {
+    return db_->Put(WriteOptions(), k, v);
+  }
+
+  std::string Get(const std::string& k, const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::string result;
+    Status s = db_->Get(options, k, &result);
+    if (s.IsNotFound()) {
+      result = "NOT_FOUND";
+    } else if (!s.ok()) {
+      result = s.ToString();
+    }
+    return result;
+  }
+
+  void Compact() { db_->CompactRange(nullptr, nullptr); }
+
+ protected:
+  TestFilter filter_;
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+};
+
+TEST_F(CompactionFilterTest, DropAndRewrite) {
+  ASSERT_LEVELDB_OK(Put("a", "xexpired"));
+  ASSERT_LEVELDB_OK(Put("b", "rewrite"));
+  ASSERT_LEVELDB_OK(Put("c", "keep"));
+  Compact();
+  ASSERT_EQ("NOT_FOUND", Get("a"));
+  ASSERT_EQ("Rewrite", Get("b"));
+  ASSERT_EQ("keep", Get("c"));
+}
+
+TEST_F(CompactionFilterTest, SnapshotAcrossCompaction) {
+  ASSERT_LEVELDB_OK(Put("a", "old"));
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_LEVELDB_OK(Put("a", "xexpired"));
+
+  // Both versions are merged by the same compaction.  The newest value is
+  // filtered, but the snapshot still needs the older one: it must stay
+  // hidden from reads without a snapshot
+  Compact();
+  ASSERT_EQ("NOT_FOUND", Get("a"));
+  ASSERT_EQ("old", Get("a", snapshot));
+
+  db_->ReleaseSnapshot(snapshot);
+  Compact();
+  ASSERT_EQ("NOT_FOUND", Get("a"));
+}
+
+}  // namespace leveldb
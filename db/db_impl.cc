@@ -10,6 +10,8 @@
 #include <cstdio>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "db/builder.h"
@@ -19,11 +21,14 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/range_del.h"
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/status.h"
 #include "leveldb/table.h"
 #include "leveldb/table_builder.h"
@@ -40,17 +45,48 @@ namespace leveldb {
 
 const int kNumNonTableCacheFiles = 10;
 
+//一次compaction最多记录的被过滤key的总字节数
+const size_t kMaxFilteredKeyBytes = 1 << 20;
+
+//快速路径上的writer在阻塞前让出CPU的次数
+const int kWriteFastPathSpins = 100;
+
 // Information kept for every waiting writer
 //每个写线程都持有的一个结构
 struct DBImpl::Writer {
   explicit Writer(port::Mutex* mu)
-      : batch(nullptr), sync(false), done(false), cv(mu) {}
+      : batch(nullptr),
+        sync(false),
+        done(false),
+        cv(mu),
+        next_in_group(nullptr),
+        last_sequence(0),
+        leader(nullptr),
+        pending_inserts(0),
+        link_older(nullptr) {}
 
   Status status;
   WriteBatch* batch;
   bool sync;
-  bool done;
+  // Written under mutex_, but fast path writers may poll it without it
+  std::atomic<bool> done;
   port::CondVar cv;
+
+  // Next writer of the same write group, set by BuildBatchGroup()
+  Writer* next_in_group;
+  // Leader only: last sequence number of the group
+  SequenceNumber last_sequence;
+
+  // Set by the group leader once the group is logged: this writer then
+  // inserts its own batch into the memtable.
+  std::atomic<Writer*> leader;
+  // Leader only: follower inserts not finished yet, and the first error
+  // one of them hit.
+  int pending_inserts;
+  Status insert_status;
+
+  // Next older writer in pending_writers_
+  Writer* link_older;
 };
 
 //记录一次Compaction的相关信息：
@@ -62,6 +98,8 @@ struct DBImpl::CompactionState {
     uint64_t number;
     uint64_t file_size;
     InternalKey smallest, largest;
+    uint64_t num_entries;
+    uint64_t num_deletions;  // Deletions and range tombstones
   };
 
   Output* current_output() { return &outputs[outputs.size() - 1]; }
@@ -69,6 +107,7 @@ struct DBImpl::CompactionState {
   explicit CompactionState(Compaction* c)
       : compaction(c),
         smallest_snapshot(0),
+        newest_snapshot(0),
         outfile(nullptr),
         builder(nullptr),
         total_bytes(0) {}
@@ -81,6 +120,24 @@ struct DBImpl::CompactionState {
   // we can drop all entries for the same key with sequence numbers < S.
   SequenceNumber smallest_snapshot;
 
+  // Sequence number of the newest snapshot, or 0 if there is none.  Only
+  // values newer than it may be passed to the compaction filter.
+  SequenceNumber newest_snapshot;
+
+  // Keys whose every entry the compaction filter removed.  Their B+ tree
+  // entries are cleared once the output is installed.  This only spares
+  // reads a lookup in the output run, so at most kMaxFilteredKeyBytes of
+  // keys are kept.
+  std::vector<std::string> filtered_keys;
+  size_t filtered_key_bytes = 0;
+
+  void AddFilteredKey(const std::string& user_key) {
+    if (filtered_key_bytes < kMaxFilteredKeyBytes) {
+      filtered_key_bytes += user_key.size();
+      filtered_keys.push_back(user_key);
+    }
+  }
+
   //compaction的输出文件
   std::vector<Output> outputs;
 
@@ -106,6 +163,12 @@ Options SanitizeOptions(const std::string& dbname,
   result.filter_policy = (src.filter_policy != nullptr) ? ipolicy : nullptr;
   ClipToRange(&result.max_open_files, 64 + kNumNonTableCacheFiles, 50000);
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
+  ClipToRange(&result.max_write_buffer_number, 2, 64);
+  //并行恢复的线程数不超过CPU核数
+  const int cores = static_cast<int>(std::thread::hardware_concurrency());
+  ClipToRange(&result.recovery_threads, 1, std::max(1, cores));
+  ClipToRange(&result.min_write_buffer_number_to_merge, 1,
+              result.max_write_buffer_number - 1);
   ClipToRange(&result.max_file_size, 1 << 20, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
   if (result.info_log == nullptr) {
@@ -121,6 +184,14 @@ Options SanitizeOptions(const std::string& dbname,
   if (result.block_cache == nullptr) {
     result.block_cache = NewLRUCache(8 << 20);
   }
+  //没有编译snappy时不压缩WAL，而不是写出之后读不了的日志
+  std::string probe;
+  if (result.wal_compression == kSnappyCompression &&
+      !port::Snappy_Compress("", 0, &probe)) {
+    Log(result.info_log, "wal_compression: snappy is not compiled in; "
+        "writing uncompressed logs");
+    result.wal_compression = kNoCompression;
+  }
   return result;
 }
 
@@ -144,17 +215,21 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       shutting_down_(false),
       background_work_finished_signal_(&mutex_),
       mem_(nullptr),
-      imm_(nullptr),
-      has_imm_(false),
       logfile_(nullptr),
       logfile_number_(0),
       log_(nullptr),
+      min_recyclable_log_number_(0),
       seed_(0),
+      pending_writers_(nullptr),
       tmp_batch_(new WriteBatch),
       background_compaction_scheduled_(false),
+      background_flush_scheduled_(false),
+      flush_requested_(false),
+      logging_version_edit_(false),
       manual_compaction_(nullptr),
       versions_(new VersionSet(dbname_, &options_, table_cache_,
-                               &internal_comparator_)) {
+                               &internal_comparator_)),
+      write_controller_(options_.delayed_write_rate) {
   btree_ = new VanillaBPlusTree<std::string, uint64_t>(options_.bTree_capacity);
 }
 
@@ -162,7 +237,7 @@ DBImpl::~DBImpl() {
   // Wait for background work to finish.
   mutex_.Lock();
   shutting_down_.store(true, std::memory_order_release);
-  while (background_compaction_scheduled_) {
+  while (background_compaction_scheduled_ || background_flush_scheduled_) {
     background_work_finished_signal_.Wait();
   }
   mutex_.Unlock();
@@ -173,7 +248,9 @@ DBImpl::~DBImpl() {
 
   delete versions_;
   if (mem_ != nullptr) mem_->Unref();
-  if (imm_ != nullptr) imm_->Unref();
+  for (const ImmutableMemTable& imm : imm_) {
+    imm.mem->Unref();
+  }
   delete tmp_batch_;
   delete log_;
   delete logfile_;
@@ -269,6 +346,19 @@ void DBImpl::RemoveObsoleteFiles() {
         //Versions_是 VersionSet*类型
           keep = ((number >= versions_->LogNumber()) ||
                   (number == versions_->PrevLogNumber()));
+          if (!keep) {
+            //过时的日志留下来复用，而不是删除
+            if (std::find(log_recycle_files_.begin(), log_recycle_files_.end(),
+                          number) != log_recycle_files_.end()) {
+              keep = true;
+            } else if (min_recyclable_log_number_ != 0 &&
+                       number >= min_recyclable_log_number_ &&
+                       log_recycle_files_.size() <
+                           options_.recycle_log_file_num) {
+              log_recycle_files_.push_back(number);
+              keep = true;
+            }
+          }
           break;
         case kDescriptorFile:
           // Keep my manifest file, and any newer incarnations'
@@ -417,6 +507,256 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
   return Status::OK();
 }
 
+// Replays the write batches of one log file.  The recovering thread reads
+// and checksums the records and hands them to Insert(); worker threads add
+// them to the current memtable concurrently, a group of batches at a time.
+// Each batch carries its own sequence numbers, so the order of insertion
+// does not matter.  Filled memtables are passed to Flush() and written to
+// level-0 by a flush thread, oldest first so that newer runs override older
+// ones in the B+ tree, while the replay goes on.  With a single recovery
+// thread everything runs on the caller.
+//
+// The caller must not hold DBImpl::mutex_ while using a LogReplayer.
+class DBImpl::LogReplayer {
+ public:
+  LogReplayer(DBImpl* db, VersionEdit* edit, int recovery_threads)
+      : db_(db),
+        edit_(edit),
+        parallel_(recovery_threads > 1),
+        max_queued_tasks_(2 * recovery_threads),
+        pending_mem_(nullptr),
+        pending_bytes_(0),
+        unapplied_bytes_(0),
+        work_cv_(&mu_),
+        done_cv_(&mu_),
+        in_flight_(0),
+        live_threads_(0),
+        shutting_down_(false) {
+    if (parallel_) {
+      MutexLock l(&mu_);
+      for (int i = 0; i < recovery_threads; i++) {
+        live_threads_++;
+        db_->env_->StartThread(&LogReplayer::InsertWork, this);
+      }
+      live_threads_++;
+      db_->env_->StartThread(&LogReplayer::FlushWork, this);
+    }
+  }
+
+  LogReplayer(const LogReplayer&) = delete;
+  LogReplayer& operator=(const LogReplayer&) = delete;
+
+  ~LogReplayer() { Finish(); }
+
+  // Add the contents of *batch to *mem.  Returns the first error seen so
+  // far by the replay.
+  Status Insert(const WriteBatch* batch, MemTable* mem) {
+    if (!parallel_) {
+      Status s = WriteBatchInternal::InsertInto(batch, mem);
+      db_->MaybeIgnoreError(&s);
+      return s;
+    }
+    assert(pending_mem_ == nullptr || pending_mem_ == mem);
+    pending_mem_ = mem;
+    pending_.push_back(new WriteBatch(*batch));
+    const size_t bytes = WriteBatchInternal::ByteSize(batch);
+    pending_bytes_ += bytes;
+    unapplied_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    //攒够一组再交给插入线程，减少线程间交接的开销
+    if (pending_bytes_ >= kTaskBytes) {
+      return Dispatch();
+    }
+    return Status::OK();
+  }
+
+  // Bytes of batches passed to Insert() that are not yet in their memtable.
+  // The memtable will grow by at least that much.
+  size_t UnappliedBytes() const {
+    return unapplied_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // Write *mem, whose reference is taken over, to a level-0 table once
+  // every batch passed for it is in.  Returns the first error seen so far.
+  Status Flush(MemTable* mem) {
+    if (!parallel_) {
+      return FlushMemTable(mem);
+    }
+    Dispatch();
+    MutexLock l(&mu_);
+    //mem中的batch全部插入完成后才能flush；
+    //同时限制等待flush的memtable数量
+    while ((in_flight_ > 0 ||
+            flushes_.size() + 1 >= static_cast<size_t>(
+                                       db_->options_.max_write_buffer_number)) &&
+           status_.ok()) {
+      done_cv_.Wait();
+    }
+    if (!status_.ok()) {
+      mem->Unref();
+      return status_;
+    }
+    flushes_.push_back(mem);
+    work_cv_.SignalAll();
+    return status_;
+  }
+
+  // Wait for all inserts and flushes, then stop the threads.  Returns the
+  // first error seen by the replay.
+  Status Finish() {
+    if (!parallel_) {
+      return Status::OK();
+    }
+    Dispatch();
+    MutexLock l(&mu_);
+    shutting_down_ = true;
+    work_cv_.SignalAll();
+    while (live_threads_ > 0) {
+      done_cv_.Wait();
+    }
+    return status_;
+  }
+
+ private:
+  struct InsertTask {
+    std::vector<WriteBatch*> batches;
+    MemTable* mem;
+    size_t bytes;
+  };
+
+  // Target size of the group of batches handed to an insert thread
+  static const size_t kTaskBytes = 64 << 10;
+
+  static void InsertWork(void* arg) {
+    reinterpret_cast<LogReplayer*>(arg)->InsertLoop();
+  }
+  static void FlushWork(void* arg) {
+    reinterpret_cast<LogReplayer*>(arg)->FlushLoop();
+  }
+
+  // Queue the batches gathered by Insert() for the insert threads.
+  Status Dispatch() {
+    if (pending_.empty()) {
+      return Status::OK();
+    }
+    InsertTask* task = new InsertTask;
+    task->batches.swap(pending_);
+    task->mem = pending_mem_;
+    task->bytes = pending_bytes_;
+    pending_mem_ = nullptr;
+    pending_bytes_ = 0;
+
+    MutexLock l(&mu_);
+    //限制排队的任务数量，避免读得太快占用过多内存
+    while (tasks_.size() >= max_queued_tasks_ && status_.ok()) {
+      done_cv_.Wait();
+    }
+    tasks_.push_back(task);
+    in_flight_++;
+    work_cv_.Signal();
+    return status_;
+  }
+
+  void InsertLoop() {
+    MutexLock l(&mu_);
+    while (true) {
+      while (tasks_.empty() && !shutting_down_) {
+        work_cv_.Wait();
+      }
+      if (tasks_.empty()) {
+        break;
+      }
+      InsertTask* task = tasks_.front();
+      tasks_.pop_front();
+      done_cv_.SignalAll();  // Room in tasks_
+      Status s;
+      if (status_.ok()) {
+        mu_.Unlock();
+        for (size_t i = 0; i < task->batches.size() && s.ok(); i++) {
+          s = WriteBatchInternal::InsertInto(task->batches[i], task->mem,
+                                             true /*concurrent*/);
+          db_->MaybeIgnoreError(&s);
+        }
+        mu_.Lock();
+      }
+      for (WriteBatch* batch : task->batches) {
+        delete batch;
+      }
+      unapplied_bytes_.fetch_sub(task->bytes, std::memory_order_relaxed);
+      delete task;
+      if (!s.ok() && status_.ok()) {
+        status_ = s;
+      }
+      in_flight_--;
+      done_cv_.SignalAll();
+    }
+    live_threads_--;
+    done_cv_.SignalAll();
+  }
+
+  void FlushLoop() {
+    MutexLock l(&mu_);
+    while (true) {
+      //Finish()之后不会再有新的flush
+      while (flushes_.empty() && !shutting_down_) {
+        work_cv_.Wait();
+      }
+      if (flushes_.empty()) {
+        break;
+      }
+      MemTable* mem = flushes_.front();
+      Status s;
+      if (status_.ok()) {
+        mu_.Unlock();
+        s = FlushMemTable(mem);
+        mu_.Lock();
+      } else {
+        mem->Unref();
+      }
+      flushes_.pop_front();
+      if (!s.ok() && status_.ok()) {
+        status_ = s;
+      }
+      done_cv_.SignalAll();
+    }
+    live_threads_--;
+    done_cv_.SignalAll();
+  }
+
+  Status FlushMemTable(MemTable* mem) {
+    db_->mutex_.Lock();
+    Status s = db_->WriteLevel0Table({mem}, edit_, nullptr);
+    //edit只能带一个新run，写出后立即安装
+    if (s.ok()) {
+      s = db_->versions_->LogAndApply(edit_, &db_->mutex_);
+    }
+    edit_->Clear();
+    db_->mutex_.Unlock();
+    mem->Unref();
+    return s;
+  }
+
+  DBImpl* const db_;
+  VersionEdit* const edit_;  // Only used with db_->mutex_ held
+  const bool parallel_;
+  const size_t max_queued_tasks_;
+
+  // Batches gathered by Insert() on the recovering thread
+  std::vector<WriteBatch*> pending_;
+  MemTable* pending_mem_;
+  size_t pending_bytes_;
+  std::atomic<size_t> unapplied_bytes_;
+
+  port::Mutex mu_;
+  port::CondVar work_cv_;  // New work or shutting down
+  port::CondVar done_cv_;  // Work finished
+  std::deque<InsertTask*> tasks_ GUARDED_BY(mu_);
+  std::deque<MemTable*> flushes_ GUARDED_BY(mu_);  // Oldest first
+  int in_flight_ GUARDED_BY(mu_);  // Queued or running insert tasks
+  int live_threads_ GUARDED_BY(mu_);
+  bool shutting_down_ GUARDED_BY(mu_);
+  Status status_ GUARDED_BY(mu_);
+};
+
 //恢复WAL->Memtable
 Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
                               bool* save_manifest, VersionEdit* edit,
@@ -426,11 +766,15 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     Logger* info_log;
     const char* fname;
     Status* status;  // null if options_.paranoid_checks==false
+    Status* unsupported;  // Never null
     void Corruption(size_t bytes, const Status& s) override {
+      //读不了的记录格式（如没有snappy时的压缩记录）总是使恢复失败，
+      //否则这些写入会被悄悄丢掉
+      Status* result = s.IsNotSupportedError() ? unsupported : status;
       Log(info_log, "%s%s: dropping %d bytes; %s",
-          (this->status == nullptr ? "(ignoring error) " : ""), fname,
+          (result == nullptr ? "(ignoring error) " : ""), fname,
           static_cast<int>(bytes), s.ToString().c_str());
-      if (this->status != nullptr && this->status->ok()) *this->status = s;
+      if (result != nullptr && result->ok()) *result = s;
     }
   };
 
@@ -451,11 +795,13 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   reporter.info_log = options_.info_log;
   reporter.fname = fname.c_str();
   reporter.status = (options_.paranoid_checks ? &status : nullptr);
+  reporter.unsupported = &status;
   // We intentionally make log::Reader do checksumming even if
   // paranoid_checks==false so that corruptions cause entire commits
   // to be skipped instead of propagating bad information (like overly
   // large sequence numbers).
-  log::Reader reader(file, &reporter, true /*checksum*/, 0 /*initial_offset*/);
+  log::Reader reader(file, &reporter, true /*checksum*/, 0 /*initial_offset*/,
+                     log_number);
   Log(options_.info_log, "Recovering log #%llu",
       (unsigned long long)log_number);
 
@@ -465,8 +811,12 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   WriteBatch batch;
   int compactions = 0;
   MemTable* mem = nullptr;
+  //本线程读日志、校验记录，插入memtable和flush交给replayer的线程
+  LogReplayer replayer(this, edit, options_.recovery_threads);
+  mutex_.Unlock();
   //写WAL的时候是以WriteBatch的单位，
   //因此读一条记录也是一个WriteBatch
+  //压缩的记录（options_.wal_compression）由reader解压后返回
   while (reader.ReadRecord(&record, &scratch) && status.ok()) {
     if (record.size() < 12) {
       reporter.Corruption(record.size(),
@@ -476,29 +826,28 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     WriteBatchInternal::SetContents(&batch, record);
 
     if (mem == nullptr) {
-      mem = new MemTable(internal_comparator_);
+      mem = new MemTable(internal_comparator_, options_);
       mem->Ref();
     }
+    //Sequence(&batch)返回的是开头的seq
+    const SequenceNumber last_seq = WriteBatchInternal::Sequence(&batch) +
+                                    WriteBatchInternal::Count(&batch) - 1;
     //插入Mem
-    status = WriteBatchInternal::InsertInto(&batch, mem);
-    MaybeIgnoreError(&status);
+    status = replayer.Insert(&batch, mem);
     if (!status.ok()) {
       break;
     }
-    //Sequence(&batch)返回的是开头的seq
-    const SequenceNumber last_seq = WriteBatchInternal::Sequence(&batch) +
-                                    WriteBatchInternal::Count(&batch) - 1;
     if (last_seq > *max_sequence) {
       *max_sequence = last_seq;
     }
 
-    if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+    //还没插入完成的batch也计入mem的大小
+    if (mem->ApproximateMemoryUsage() + replayer.UnappliedBytes() >
+        options_.write_buffer_size) {
       compactions++;//统计有几块待flush的mem
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, nullptr);
-      versions_->LogAndApply(edit, &mutex_);
-      edit->Clear();
-      mem->Unref();
+      //replayer接管mem的引用
+      status = replayer.Flush(mem);
       mem = nullptr;
       if (!status.ok()) {
         // Reflect errors immediately so that conditions like full
@@ -507,6 +856,11 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
       }
     }
   }
+  Status replay_status = replayer.Finish();
+  if (status.ok()) {
+    status = replay_status;
+  }
+  mutex_.Lock();
 
   delete file;
 
@@ -514,7 +868,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   //是否重用最后一个log
   //？为什么可以重用最后一个log：可能没写满？
   //？为什么要compaction==0：这个日志没能够写满一个mem，因此mem可以一起被重用
-  if (status.ok() && options_.reuse_logs && last_log && compactions == 0) {
+  //可复用格式的日志末尾之后可能是旧日志的残留数据，不能在其后追加
+  if (status.ok() && options_.reuse_logs && last_log && compactions == 0 &&
+      !reader.IsRecycled()) {
     assert(logfile_ == nullptr);
     assert(log_ == nullptr);
     assert(mem_ == nullptr);
@@ -522,7 +878,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     if (env_->GetFileSize(fname, &lfile_size).ok() &&
         env_->NewAppendableFile(fname, &logfile_).ok()) {
       Log(options_.info_log, "Reusing old log %s \n", fname.c_str());
-      log_ = new log::Writer(logfile_, lfile_size);
+      log_ = new log::Writer(logfile_, lfile_size, log_number,
+                             options_.recycle_log_file_num > 0,
+                             options_.wal_compression);
       logfile_number_ = log_number;
       if (mem != nullptr) {
         //mem_是DBImpl记录的当前的active mem
@@ -530,7 +888,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
         mem = nullptr;
       } else {
         // mem can be nullptr if lognum exists but was empty.
-        mem_ = new MemTable(internal_comparator_);
+        mem_ = new MemTable(internal_comparator_, options_);
         mem_->Ref();
       }
     }
@@ -541,8 +899,12 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     // mem did not get reused; compact it.
     if (status.ok()) {
       *save_manifest = true;
-      //加入flush
-      status = WriteLevel0Table(mem, edit, nullptr);
+      //加入flush。edit只能带一个新run，下一个log恢复之前先装上
+      status = WriteLevel0Table({mem}, edit, nullptr);
+      if (status.ok()) {
+        status = versions_->LogAndApply(edit, &mutex_);
+        edit->Clear();
+      }
     }
     mem->Unref();
   }
@@ -551,8 +913,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
 }
 
 //
-Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+Status DBImpl::WriteLevel0Table(const std::vector<MemTable*>& mems,
+                                VersionEdit* edit, Version* base,
+                                uint64_t* pending_file) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
@@ -561,16 +924,31 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   //防止被删除
   //正在生成中，还没加入Version的文件，也不能删除
   pending_outputs_.insert(meta.number);
-  Iterator* iter = mem->NewIterator();
-  Log(options_.info_log, "Level-0 table #%llu: started",
-      (unsigned long long)meta.number);
+  //范围删除和普通条目一起按internal key顺序写入同一个文件
+  //多个memtable合并为一个run，被覆盖的旧版本在BuildTable中丢弃
+  std::vector<Iterator*> mem_iters;
+  for (MemTable* mem : mems) {
+    mem_iters.push_back(mem->NewIterator());
+    mem_iters.push_back(mem->NewRangeTombstoneIterator());
+  }
+  Iterator* iter = NewMergingIterator(&internal_comparator_, mem_iters.data(),
+                                      mem_iters.size());
+  const SequenceNumber smallest_snapshot =
+      snapshots_.empty() ? kMaxSequenceNumber
+                         : snapshots_.oldest()->sequence_number();
+  Log(options_.info_log, "Level-0 table #%llu: started, %d memtables",
+      (unsigned long long)meta.number, static_cast<int>(mems.size()));
 
   Status s;
   {
     mutex_.Unlock();
     //iter构建在mem上
     //mem->sstable
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta, btree_);
+    //BuildTable边写文件边更新B+树，和compaction线程对B+树的修改互斥
+    index_mutex_.Lock();
+    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta, btree_,
+                   smallest_snapshot);
+    index_mutex_.Unlock();
     mutex_.Lock();
   }
 
@@ -579,7 +957,13 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       s.ToString().c_str());
   delete iter;
   //已经加入version，可以移除出pending_outputs_
-  pending_outputs_.erase(meta.number);
+  //flush线程安装edit之前，compaction线程可能执行RemoveObsoleteFiles，
+  //此时新文件还要留在pending_outputs_中
+  if (pending_file != nullptr) {
+    *pending_file = meta.number;
+  } else {
+    pending_outputs_.erase(meta.number);
+  }
 
   // Note that if file_size is zero, the file has been deleted and
   // should not be added to the manifest.
@@ -597,7 +981,7 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
     SortedRun run= versions_->NewRun(0);
     edit->AddRun(run);
     edit->AddFileToRun(meta.number, meta.file_size, meta.smallest,
-                  meta.largest);
+                  meta.largest, meta.num_entries, meta.num_deletions);
                   //只到把新run加入edit为止（L0到run的map未更改）
   }
 
@@ -609,16 +993,26 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
 }
 
 //非recover过程中发生的 mem flush
-//调用：都是先判断imm_不等于null，然后对imm_生成新sstable
+//调用：只在flush线程中，把imm_中最旧的几个memtable合并生成一个sstable
 void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
-  assert(imm_ != nullptr);
-
-  // Save the contents of the memtable as a new Table
+  assert(!imm_.empty());
+  //flush期间写线程只会在imm_尾部追加，前n个保持不变
+  const size_t n = std::min(
+      imm_.size(),
+      static_cast<size_t>(options_.min_write_buffer_number_to_merge));
+  std::vector<MemTable*> mems;
+  for (size_t i = 0; i < n; i++) {
+    mems.push_back(imm_[i].mem);
+  }
+  const uint64_t next_log_number = imm_[n - 1].next_log_number;
+
+  // Save the contents of the memtables as a new Table
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  uint64_t file_number;
+  Status s = WriteLevel0Table(mems, &edit, base, &file_number);
   base->Unref();
 
   if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
@@ -628,16 +1022,20 @@ void DBImpl::CompactMemTable() {
   // Replace immutable memtable with the generated Table
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
-    edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
+    //更新的imm_还依赖它们被封存之后的日志，只能丢弃这些memtable之前的日志
+    edit.SetLogNumber(next_log_number);  // Earlier logs no longer needed
     //每次compaction/flush都会生成新edit，要及时应用到Version上，并记录在manifest中
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
   }
+  pending_outputs_.erase(file_number);
 
   if (s.ok()) {
     // Commit to the new state
-    imm_->Unref();
-    imm_ = nullptr;
-    has_imm_.store(false, std::memory_order_release);
+    for (MemTable* mem : mems) {
+      assert(imm_.front().mem == mem);
+      imm_.pop_front();
+      mem->Unref();
+    }
     //需要移除过时文件
     RemoveObsoleteFiles();
   } else {
@@ -645,33 +1043,59 @@ void DBImpl::CompactMemTable() {
   }
 }
 
-//CompactionRange？
-/*void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
+//手动compaction：逐层把与范围重叠的run合并到下一层，
+//最后把最深一层中重叠的run合并为一个run
+void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
   int max_level_with_files = 1;
   {
+    InternalKey begin_storage, end_storage;
+    const InternalKey* ibegin = nullptr;
+    const InternalKey* iend = nullptr;
+    if (begin != nullptr) {
+      begin_storage =
+          InternalKey(*begin, kMaxSequenceNumber, kValueTypeForSeek);
+      ibegin = &begin_storage;
+    }
+    if (end != nullptr) {
+      end_storage = InternalKey(*end, 0, static_cast<ValueType>(0));
+      iend = &end_storage;
+    }
     MutexLock l(&mutex_);
     Version* base = versions_->current();
+    std::vector<SortedRun*> runs;
     for (int level = 1; level < config::kNumLevels; level++) {
-      if (base->OverlapInLevel(level, begin, end)) {
+      base->GetOverlappingRuns(level, ibegin, iend, &runs);
+      if (!runs.empty()) {
         max_level_with_files = level;
       }
     }
   }
   TEST_CompactMemTable();  // TODO(sanjay): Skip if memtable does not overlap
   for (int level = 0; level < max_level_with_files; level++) {
-    TEST_CompactRange(level, begin, end);
+    RunManualCompaction(level, level + 1, begin, end);
   }
-}*/
+  RunManualCompaction(max_level_with_files, max_level_with_files, begin, end);
+}
 
-/*void DBImpl::TEST_CompactRange(int level, const Slice* begin,
+void DBImpl::TEST_CompactRange(int level, const Slice* begin,
                                const Slice* end) {
   assert(level >= 0);
-  assert(level + 1 < config::kNumLevels);
+  assert(level < config::kNumLevels);
+  RunManualCompaction(level, std::min(level + 1, config::kNumLevels - 1),
+                      begin, end);
+}
+
+void DBImpl::RunManualCompaction(int level, int output_level,
+                                 const Slice* begin, const Slice* end) {
+  assert(level >= 0);
+  assert(output_level > 0);
+  assert(output_level == level || output_level == level + 1);
 
   InternalKey begin_storage, end_storage;
 
   ManualCompaction manual;
   manual.level = level;
+  manual.output_level = output_level;
   manual.done = false;
   if (begin == nullptr) {
     manual.begin = nullptr;
@@ -700,7 +1124,7 @@ void DBImpl::CompactMemTable() {
     // Cancel my manual compaction since we aborted early for some reason.
     manual_compaction_ = nullptr;
   }
-}*/
+}
 
 Status DBImpl::TEST_CompactMemTable() {
   // nullptr batch means just wait for earlier writes to be done
@@ -708,10 +1132,10 @@ Status DBImpl::TEST_CompactMemTable() {
   if (s.ok()) {
     // Wait until the compaction completes
     MutexLock l(&mutex_);
-    while (imm_ != nullptr && bg_error_.ok()) {
+    while (!imm_.empty() && bg_error_.ok()) {
       background_work_finished_signal_.Wait();
     }
-    if (imm_ != nullptr) {
+    if (!imm_.empty()) {
       s = bg_error_;
     }
   }
@@ -727,6 +1151,32 @@ void DBImpl::RecordBackgroundError(const Status& s) {
   }
 }
 
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  //VersionSet::LogAndApply写MANIFEST时会释放锁，flush线程和compaction线程
+  //（以及BulkDeleteForRange）轮流安装Version
+  while (logging_version_edit_) {
+    background_work_finished_signal_.Wait();
+  }
+  logging_version_edit_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  logging_version_edit_ = false;
+  background_work_finished_signal_.SignalAll();
+  return s;
+}
+
+void DBImpl::UpdateWriteStall() {
+  mutex_.AssertHeld();
+  if (write_controller_.Update(versions_->NumRuns(),
+                               versions_->PendingCompactionBytes(),
+                               versions_->NumLevelFiles(0))) {
+    Log(options_.info_log, "Write stall state: %s (runs %d, pending %lld)\n",
+        WriteController::StateName(write_controller_.state()),
+        versions_->NumRuns(),
+        static_cast<long long>(versions_->PendingCompactionBytes()));
+  }
+}
+
 void DBImpl::MaybeScheduleCompaction() {
   //std::cout<<"schedule"<<std::endl;
   mutex_.AssertHeld();
@@ -739,7 +1189,7 @@ void DBImpl::MaybeScheduleCompaction() {
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
     //std::cout<<"3"<<std::endl;
-  } else if (imm_ == nullptr && manual_compaction_ == nullptr &&
+  } else if (manual_compaction_ == nullptr &&
              !versions_->NeedsCompaction()) {
     // No work to be done
     //std::cout<<"4"<<std::endl;
@@ -767,6 +1217,7 @@ void DBImpl::BackgroundCall() {
   }
 
   background_compaction_scheduled_ = false;
+  UpdateWriteStall();
 
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
@@ -774,6 +1225,54 @@ void DBImpl::BackgroundCall() {
   background_work_finished_signal_.SignalAll();
 }
 
+void DBImpl::MaybeScheduleFlush() {
+  mutex_.AssertHeld();
+  if (background_flush_scheduled_) {
+    // Already running; it drains imm_ before exiting
+  } else if (shutting_down_.load(std::memory_order_acquire)) {
+    // DB is being deleted; no more flushes
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (imm_.empty() ||
+             (!flush_requested_ &&
+              imm_.size() < static_cast<size_t>(
+                                options_.min_write_buffer_number_to_merge))) {
+    // No work to be done
+  } else {
+    //flush使用单独的线程，不必排在耗时的compaction之后
+    background_flush_scheduled_ = true;
+    env_->StartThread(&DBImpl::BGFlushWork, this);
+  }
+}
+
+void DBImpl::BGFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(background_flush_scheduled_);
+  //按封存顺序逐批flush，新L0 run在B+树中覆盖旧的；
+  //不足一批的memtable留给之后的flush合并，除非被强制flush
+  while (!imm_.empty() &&
+         (flush_requested_ ||
+          imm_.size() >= static_cast<size_t>(
+                             options_.min_write_buffer_number_to_merge)) &&
+         !shutting_down_.load(std::memory_order_acquire) && bg_error_.ok()) {
+    CompactMemTable();
+    UpdateWriteStall();
+    MaybeScheduleCompaction();
+    // Wake up MakeRoomForWrite() if necessary.
+    background_work_finished_signal_.SignalAll();
+  }
+  if (imm_.empty()) {
+    flush_requested_ = false;
+  }
+
+  background_flush_scheduled_ = false;
+  background_work_finished_signal_.SignalAll();
+}
+
 //只读mem的flush
 //写手动compaction到日志
 //触发自动compaction（PickCompaction()
@@ -781,31 +1280,34 @@ void DBImpl::BackgroundCall() {
 void DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != nullptr) {
-    CompactMemTable();
+  //imm_的flush由单独的flush线程完成
+
+  //血缘过长的run先截断血缘，手动compaction优先
+  if (manual_compaction_ == nullptr && versions_->NeedsLineageCompaction()) {
+    Status s = CompactLineage();
+    if (!s.ok()) {
+      RecordBackgroundError(s);
+    }
     return;
   }
 
   Compaction* c;
-  //手动？
-  /*bool is_manual = (manual_compaction_ != nullptr);
-  InternalKey manual_end;
+  bool is_manual = (manual_compaction_ != nullptr);
   if (is_manual) {
+    //每次只合并一批run，剩余的run在下一次后台调度中继续
     ManualCompaction* m = manual_compaction_;
-    c = versions_->CompactRange(m->level, m->begin, m->end);
-    m->done = (c == nullptr);//当c为空，说明已经完成
-    if (c != nullptr) {
-      manual_end = c->input(0, c->num_input_files(0) - 1)->largest;
-    }
+    c = versions_->CompactRange(m->level, m->output_level, m->begin, m->end,
+                                m->merged_runs);
+    m->done = (c == nullptr);  //当c为空，说明已经完成
     Log(options_.info_log,
-        "Manual compaction at level-%d from %s .. %s; will stop at %s\n",
-        m->level, (m->begin ? m->begin->DebugString().c_str() : "(begin)"),
+        "Manual compaction at level-%d => level-%d from %s .. %s; %s\n",
+        m->level, m->output_level,
+        (m->begin ? m->begin->DebugString().c_str() : "(begin)"),
         (m->end ? m->end->DebugString().c_str() : "(end)"),
-        (m->done ? "(end)" : manual_end.DebugString().c_str()));
-  }*/// else {
-    //非手动
+        (m->done ? "done" : "merging a chunk of runs"));
+  } else {
     c = versions_->PickCompaction();
-  //}
+  }
 
   Status status;
   if (c == nullptr) {
@@ -820,7 +1322,10 @@ void DBImpl::BackgroundCompaction() {
     CleanupCompaction(compact);
     c->ReleaseInputs();
     RemoveObsoleteFiles();
-    //std::cout<<"compact"<<std::endl;
+    if (is_manual && status.ok()) {
+      //原地合并的输出留在m->level中，之后的批次不再重复合并它
+      manual_compaction_->merged_runs.insert(c->edit()->NewRunID());
+    }
   }
   delete c;
 
@@ -832,20 +1337,38 @@ void DBImpl::BackgroundCompaction() {
     Log(options_.info_log, "Compaction error: %s", status.ToString().c_str());
   }
 
-  //手动compaction
-  /*if (is_manual) {
+  if (is_manual) {
     ManualCompaction* m = manual_compaction_;
     if (!status.ok()) {
       m->done = true;
     }
-    if (!m->done) {
-      // We only compacted part of the requested range.  Update *m
-      // to the range that is left to be compacted.
-      m->tmp_storage = manual_end;
-      m->begin = &m->tmp_storage;
-    }
+    //未完成时保持范围不变：已合并的run不再属于m->level
     manual_compaction_ = nullptr;
-  }*/
+  }
+}
+
+Status DBImpl::CompactLineage() {
+  mutex_.AssertHeld();
+  VersionEdit edit;
+  std::unordered_map<uint64_t, uint64_t> remap;
+  versions_->PickLineageCompaction(&edit, &remap);
+
+  //B+树只在后台线程中修改，释放锁后改写条目：改写期间新旧L0都能在当前Version中找到run，
+  //改写完成后才安装新Version，此后B+树中不再有被截掉的L0
+  mutex_.Unlock();
+  const uint64_t start_micros = env_->NowMicros();
+  index_mutex_.Lock();
+  const size_t changed = btree_->remap_values(remap);
+  index_mutex_.Unlock();
+  const uint64_t micros = env_->NowMicros() - start_micros;
+  mutex_.Lock();
+
+  Status s = LogAndApply(&edit);
+  Log(options_.info_log,
+      "Truncated run lineage: %zu L0 numbers, %zu tree entries, %llu us: %s",
+      remap.size(), changed, static_cast<unsigned long long>(micros),
+      s.ToString().c_str());
+  return s;
 }
 
 void DBImpl::CleanupCompaction(CompactionState* compact) {
@@ -876,6 +1399,8 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
     CompactionState::Output out;
     out.number = file_number;
     out.smallest.Clear();
+    out.num_entries = 0;
+    out.num_deletions = 0;
     out.largest.Clear();
     compact->outputs.push_back(out);
     mutex_.Unlock();
@@ -885,6 +1410,8 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname, &compact->outfile);
   if (s.ok()) {
+    compact->outfile = NewRateLimitedFile(
+        compact->outfile, options_.rate_limiter, RateLimiter::kLow);
     compact->builder = new TableBuilder(options_, compact->outfile);
   }
   return s;
@@ -911,6 +1438,7 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   }
   const uint64_t current_bytes = compact->builder->FileSize();
   compact->current_output()->file_size = current_bytes;
+  compact->current_output()->num_entries = current_entries;
   compact->total_bytes += current_bytes;
   //用于判断是否已启动新文件
   delete compact->builder;
@@ -956,7 +1484,7 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   //记录待删除的Run
   compact->compaction->AddRunDeletions(compact->compaction->edit());
   const int input_level = compact->compaction->level();
-  const int output_level = input_level == config::kNumLevels ? input_level : input_level + 1;
+  const int output_level = compact->compaction->output_level();
   //在edit中记录新生成了一个run
   compact->compaction->edit()->SetLevel(input_level, output_level);
   SortedRun run = versions_->NewRun(output_level);
@@ -964,30 +1492,32 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
     //compaction的输出文件加入edit
-    compact->compaction->edit()->AddFileToRun(out.number, out.file_size, out.smallest, out.largest);
+    compact->compaction->edit()->AddFileToRun(out.number, out.file_size, out.smallest, out.largest,
+                                              out.num_entries, out.num_deletions);
     //compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
                                          //out.smallest, out.largest);
 
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return LogAndApply(compact->compaction->edit());
 }
 
 //构建输入文件上的迭代器
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
 
   Log(options_.info_log, "Compacting %d@%d files",
       compact->compaction->num_input_files(), compact->compaction->level());
 
-  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
+  //BulkDeleteForRange可能丢弃了参与合并的run中的全部文件，所以不再断言本层有文件
   assert(compact->builder == nullptr);
   assert(compact->outfile == nullptr);
   if (snapshots_.empty()) {//不使用快照，只考虑当下的seq
     compact->smallest_snapshot = versions_->LastSequence();
   } else {
     compact->smallest_snapshot = snapshots_.oldest()->sequence_number();
+    compact->newest_snapshot = snapshots_.newest()->sequence_number();
   }
+  const CompactionFilter* const compaction_filter = options_.compaction_filter;
 
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
 
@@ -997,30 +1527,23 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   input->SeekToFirst();
   Status status;
   ParsedInternalKey ikey;
+  //只有对所有快照都可见的范围删除才能用来丢弃被覆盖的版本
+  RangeDelAggregator range_del(user_comparator(), compact->smallest_snapshot);
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  //当前user key是否被compaction filter删除、是否有条目写入了输出
+  bool current_key_filtered = false;
+  bool current_key_written = false;
+  std::string filtered_key;  // Deletion marker replacing a filtered value
+  std::string filter_value;
+  int64_t filtered_entries = 0;
+  int64_t rewritten_entries = 0;
   //在while最后有input->Next();
   while (input->Valid() && !shutting_down_.load(std::memory_order_acquire)) {
-    // Prioritize immutable compaction work
-    if (has_imm_.load(std::memory_order_relaxed)) {
-      const uint64_t imm_start = env_->NowMicros();
-      mutex_.Lock();
-      if (imm_ != nullptr) {
-        CompactMemTable();
-        //就是因为有了这个，会暂时对下当前的多文件合并，转去刷immemtable
-        //而CompactMemTable会调用DeleteObsoleteFiles主要为了删没用日志文件
-        //为了避免误删掉刚刚多文件合并产生的新文件，
-        //需要将产生的新文件用OpenCompactionOutputFile
-        //函数加入到pending_outputs_，等合并完成并应用到新版本，再调用
-        //CleanupCompaction清除刚加入到pending_outputs_的文件编号
-        // Wake up MakeRoomForWrite() if necessary.
-        background_work_finished_signal_.SignalAll();
-      }
-      mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
-    }
-
+    //immutable memtable由flush线程并发写出，compaction不再中途让出
+    //flush线程的CompactMemTable会调用RemoveObsoleteFiles，
+    //本次合并产生的新文件由OpenCompactionOutputFile加入pending_outputs_，不会被误删
     //删除重叠太多的判断，只当sstable超过阈值时才重启新文件
     Slice key = input->key();
     /*if (compact->compaction->ShouldStopBefore(key) &&
@@ -1036,17 +1559,39 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     // Handle key/value, add to state, etc.
     //是否可以丢弃当前kv对
     bool drop = false;
-    if (!ParseInternalKey(key, &ikey)) {
+    Slice value = input->value();
+    bool first_for_key = false;
+    const bool parsed = ParseInternalKey(key, &ikey);
+    if (!parsed) {
       // Do not hide error keys
+      if (current_key_filtered && !current_key_written) {
+        compact->AddFilteredKey(current_user_key);
+      }
+      current_key_filtered = false;
       current_user_key.clear();
       has_current_user_key = false;
       last_sequence_for_key = kMaxSequenceNumber;
+    } else if (ikey.type == kTypeRangeDeletion) {
+      //范围删除不参与同一user key的版本淘汰。它覆盖的本次输入中的版本会被丢弃，
+      //若更旧的run中也没有落在范围内的数据，它本身就可以丢弃
+      range_del.Add(ikey.user_key, input->value(), ikey.sequence);
+      if (ikey.sequence <= compact->smallest_snapshot &&
+          compact->compaction->IsBaseLevelForRange(ikey.user_key,
+                                                   input->value())) {
+        drop = true;
+      }
     } else {
       //首次出现
       if (!has_current_user_key ||
           user_comparator()->Compare(ikey.user_key, Slice(current_user_key)) !=
               0) {
         // First occurrence of this user key
+        if (current_key_filtered && !current_key_written) {
+          compact->AddFilteredKey(current_user_key);
+        }
+        current_key_filtered = false;
+        current_key_written = false;
+        first_for_key = true;
         current_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
         has_current_user_key = true;
         last_sequence_for_key = kMaxSequenceNumber;
@@ -1070,6 +1615,36 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
         drop = true;
+      } else if (range_del.ShouldDelete(ikey.user_key, ikey.sequence)) {
+        // Covered by a range tombstone that every snapshot can see
+        drop = true;
+      } else if (compaction_filter != nullptr && first_for_key &&
+                 ikey.type == kTypeValue &&
+                 ikey.sequence > compact->newest_snapshot) {
+        //只过滤没有快照能读到的最新版本。删除的值改写为删除标记：
+        //更旧的版本仍被它屏蔽，没有快照且本层是该key的最底层时标记直接丢弃
+        bool value_changed = false;
+        filter_value.clear();
+        if (compaction_filter->Filter(compact->compaction->output_level(),
+                                      ikey.user_key, value, &filter_value,
+                                      &value_changed)) {
+          filtered_entries++;
+          current_key_filtered = true;
+          ikey.type = kTypeDeletion;
+          //和普通删除标记一样：快照还要读的旧版本会被保留，标记也要保留
+          if (ikey.sequence <= compact->smallest_snapshot &&
+              compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+            drop = true;
+          } else {
+            filtered_key.clear();
+            AppendInternalKey(&filtered_key, ikey);
+            key = filtered_key;
+            value = Slice();
+          }
+        } else if (value_changed) {
+          rewritten_entries++;
+          value = filter_value;
+        }
       }
 
       last_sequence_for_key = ikey.sequence;
@@ -1101,7 +1676,11 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       //新加入的肯定是最大
       compact->current_output()->largest.DecodeFrom(key);
       //加入构建
-      compact->builder->Add(key, input->value());
+      compact->builder->Add(key, value);
+      if (parsed && ikey.type != kTypeValue) {
+        compact->current_output()->num_deletions++;
+      }
+      current_key_written = true;
 
       // Close output file if it is big enough
       //该输出文件已经过大
@@ -1118,6 +1697,15 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     input->Next();
   }
 
+  if (current_key_filtered && !current_key_written) {
+    compact->AddFilteredKey(current_user_key);
+  }
+  if (compaction_filter != nullptr) {
+    Log(options_.info_log, "Compaction filter %s: %lld dropped, %lld rewritten",
+        compaction_filter->Name(), static_cast<long long>(filtered_entries),
+        static_cast<long long>(rewritten_entries));
+  }
+
   if (status.ok() && shutting_down_.load(std::memory_order_acquire)) {
     status = Status::IOError("Deleting DB during compaction");
   }
@@ -1132,7 +1720,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   input = nullptr;
 
   CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  stats.micros = env_->NowMicros() - start_micros;
 
   for (int i = 0; i < compact->compaction->num_input_files(); i++) {
     stats.bytes_read += compact->compaction->input(i)->file_size;
@@ -1143,11 +1731,27 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   }
 
   mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
+  stats_[compact->compaction->output_level()].Add(stats);
 
   if (status.ok()) {
     status = InstallCompactionResults(compact);
   }
+  if (status.ok() && !compact->filtered_keys.empty()) {
+    //被过滤掉的key在输出中已没有条目；B+树仍指向本次合并的run时清除它，
+    //读请求不必再去查这个run。B+树只在后台线程中修改，和flush互斥
+    std::set<uint64_t> lineage;
+    compact->compaction->AddInputLineage(&lineage);
+    mutex_.Unlock();
+    index_mutex_.Lock();
+    for (const std::string& user_key : compact->filtered_keys) {
+      uint64_t L0_id;
+      if (btree_->search(user_key, L0_id) && lineage.count(L0_id) > 0) {
+        btree_->insert(user_key, 0);
+      }
+    }
+    index_mutex_.Unlock();
+    mutex_.Lock();
+  }
   if (!status.ok()) {
     RecordBackgroundError(status);
   }
@@ -1162,17 +1766,19 @@ struct IterState {
   port::Mutex* const mu;
   Version* const version GUARDED_BY(mu);
   MemTable* const mem GUARDED_BY(mu);
-  MemTable* const imm GUARDED_BY(mu);
+  std::vector<MemTable*> imm GUARDED_BY(mu);
 
-  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, Version* version)
-      : mu(mutex), version(version), mem(mem), imm(imm) {}
+  IterState(port::Mutex* mutex, MemTable* mem, Version* version)
+      : mu(mutex), version(version), mem(mem) {}
 };
 
 static void CleanupIteratorState(void* arg1, void* arg2) {
   IterState* state = reinterpret_cast<IterState*>(arg1);
   state->mu->Lock();
   state->mem->Unref();
-  if (state->imm != nullptr) state->imm->Unref();
+  for (MemTable* imm : state->imm) {
+    imm->Unref();
+  }
   state->version->Unref();
   state->mu->Unlock();
   delete state;
@@ -1182,32 +1788,52 @@ static void CleanupIteratorState(void* arg1, void* arg2) {
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
-                                      uint32_t* seed) {
+                                      uint32_t* seed,
+                                      RangeDelAggregator** range_del) {
   mutex_.Lock();
   *latest_snapshot = versions_->LastSequence();
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list_all;
   std::unordered_map<uint64_t, int>* index_map = new std::unordered_map<uint64_t, int>();
+  IterState* cleanup = new IterState(&mutex_, mem_, versions_->current());
   list_all.push_back(mem_->NewIterator());
   mem_->Ref();
-  if (imm_ != nullptr) {
-    list_all.push_back(imm_->NewIterator());
-    imm_->Ref();
+  for (const ImmutableMemTable& imm : imm_) {
+    list_all.push_back(imm.mem->NewIterator());
+    imm.mem->Ref();
+    cleanup->imm.push_back(imm.mem);
+  }
+  //还在内存中的范围删除；已经落盘的范围删除在flush时屏蔽了B+树
+  if (range_del != nullptr) {
+    *range_del = new RangeDelAggregator(
+        user_comparator(),
+        (options.snapshot != nullptr
+             ? static_cast<const SnapshotImpl*>(options.snapshot)
+                   ->sequence_number()
+             : *latest_snapshot));
+    Iterator* tombstones = mem_->NewRangeTombstoneIterator();
+    (*range_del)->AddAll(tombstones);
+    delete tombstones;
+    for (const ImmutableMemTable& imm : imm_) {
+      tombstones = imm.mem->NewRangeTombstoneIterator();
+      (*range_del)->AddAll(tombstones);
+      delete tombstones;
+    }
   }
   //std::cout<<"mem size:"<<list_all.size()<<std::endl;
   std::vector<Iterator*> list;
   versions_->current()->AddIterators(options, &list, index_map);
   //versions_->current()->AddRunsIterators(options, &list, )
   Iterator* disk_iter = 
-      NewDiskIterator(&internal_comparator_, &list[0], list.size(), btree_, index_map);
+      NewDiskIterator(&internal_comparator_, list.data(), list.size(), btree_, index_map,
+                      options.iterate_lower_bound, options.iterate_upper_bound);
   list_all.push_back(disk_iter);
     //std::cout<<"all size:"<<list_all.size()<<std::endl;
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list_all[0], list_all.size());     
   versions_->current()->Ref();
 
-  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
 
   *seed = ++seed_;
@@ -1218,7 +1844,7 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
 Iterator* DBImpl::TEST_NewInternalIterator() {
   SequenceNumber ignored;
   uint32_t ignored_seed;
-  return NewInternalIterator(ReadOptions(), &ignored, &ignored_seed);
+  return NewInternalIterator(ReadOptions(), &ignored, &ignored_seed, nullptr);
 }
 
 int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
@@ -1226,6 +1852,11 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+size_t DBImpl::TEST_MaxRunLineage() {
+  MutexLock l(&mutex_);
+  return versions_->MaxRunLineage();
+}
+
 //Get操作
 Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    std::string* value) {
@@ -1241,10 +1872,15 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
   }
 
   MemTable* mem = mem_;
-  MemTable* imm = imm_;
+  //从新到旧依次查找
+  std::vector<MemTable*> imm;
+  imm.reserve(imm_.size());
+  for (auto it = imm_.rbegin(); it != imm_.rend(); ++it) {
+    imm.push_back(it->mem);
+    it->mem->Ref();
+  }
   Version* current = versions_->current();
   mem->Ref();
-  if (imm != nullptr) imm->Ref();
   current->Ref();
 
   bool have_stat_update = false;
@@ -1253,30 +1889,41 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
+    // First look in the memtable, then in the immutable memtables (if any).
     //snapshot当作seq号，永远都能在所要查的条目前
     LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
+    bool found = mem->Get(lkey, value, &s);
+    for (size_t i = 0; !found && i < imm.size(); i++) {
+      found = imm[i]->Get(lkey, value, &s);
+    }
+    if (found) {
       // Done
     } else {
       //到磁盘上寻找
       uint64_t L0_id = 0;
       btree_->search(key.ToString(), L0_id);
       //std::cout<<"key"<<key.ToString()<<"L0_id:"<<L0_id<<std::endl;
+      //前台读延迟反馈给限速器（自动调节模式下据此调整compaction速率）
+      const uint64_t start_micros =
+          (options_.rate_limiter != nullptr) ? env_->NowMicros() : 0;
       s = current->Get(options, lkey, value, &stats, L0_id);
       have_stat_update = true;
+      if (options_.rate_limiter != nullptr) {
+        options_.rate_limiter->RecordForegroundLatency(env_->NowMicros() -
+                                                       start_micros);
+      }
     }
     mutex_.Lock();
   }
 
-  //？seek也会触发compaction
-  /*if (have_stat_update && current->UpdateStats(stats)) {
+  //白读的run耗尽预算后也会触发compaction
+  if (have_stat_update && current->UpdateStats(stats)) {
     MaybeScheduleCompaction();
-  }*/
+  }
   mem->Unref();
-  if (imm != nullptr) imm->Unref();
+  for (MemTable* m : imm) {
+    m->Unref();
+  }
   current->Unref();
   return s;
 }
@@ -1284,16 +1931,18 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
-  Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed);
+  RangeDelAggregator* range_del;
+  Iterator* iter =
+      NewInternalIterator(options, &latest_snapshot, &seed, &range_del);
   return NewDBIterator(this, user_comparator(), iter,
                        (options.snapshot != nullptr
                             ? static_cast<const SnapshotImpl*>(options.snapshot)
                                   ->sequence_number()
                             : latest_snapshot),
-                       seed);
+                       seed, range_del, options.iterate_lower_bound,
+                       options.iterate_upper_bound);
 }
 
-//？
 void DBImpl::RecordReadSample(Slice key) {
   MutexLock l(&mutex_);
   if (versions_->current()->RecordReadSample(key)) {
@@ -1320,29 +1969,442 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+Status DBImpl::BulkDeleteForRange(const WriteOptions& options,
+                                  const Slice& begin_key,
+                                  const Slice& end_key) {
+  WriteBatch batch;
+  batch.DeleteRange(begin_key, end_key);
+  Status s = Write(options, &batch);
+  if (s.ok()) {
+    //用范围删除自身的序列号：之后并发写入的条目不能随文件一起丢弃
+    MutexLock l(&mutex_);
+    s = DropFilesInRange(begin_key, end_key,
+                         WriteBatchInternal::Sequence(&batch));
+  }
+  return s;
+}
+
+void DBImpl::FilesInRange(
+    Version* v, const Slice& begin_key, const Slice& end_key,
+    std::vector<std::pair<uint64_t, FileMetaData*>>* files) {
+  const Comparator* ucmp = user_comparator();
+  InternalKey ibegin(begin_key, kMaxSequenceNumber, kValueTypeForSeek);
+  InternalKey iend(end_key, kMaxSequenceNumber, kValueTypeForSeek);
+  std::vector<SortedRun*> runs;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    v->GetOverlappingRuns(level, &ibegin, &iend, &runs);
+    for (SortedRun* run : runs) {
+      for (FileMetaData* f : *(run->GetContainFile())) {
+        if (ucmp->Compare(f->smallest.user_key(), begin_key) >= 0 &&
+            ucmp->Compare(f->largest.user_key(), end_key) < 0) {
+          files->push_back(std::make_pair(run->GetID(), f));
+        }
+      }
+    }
+  }
+}
+
+Status DBImpl::DropFilesInRange(const Slice& begin_key, const Slice& end_key,
+                                SequenceNumber seq) {
+  mutex_.AssertHeld();
+  //更早的快照仍能看到这些文件中的数据
+  if (!snapshots_.empty() && snapshots_.oldest()->sequence_number() < seq) {
+    return Status::OK();
+  }
+  if (!bg_error_.ok()) {
+    return bg_error_;
+  }
+
+  Version* base = versions_->current();
+  base->Ref();
+  std::vector<std::pair<uint64_t, FileMetaData*>> candidates;
+  FilesInRange(base, begin_key, end_key, &candidates);
+
+  //文件中伸出end_key之外的范围删除、以及比这次范围删除更新的条目
+  //都不能随文件丢弃，这样的文件保留
+  const Comparator* ucmp = user_comparator();
+  std::set<std::pair<uint64_t, uint64_t>> droppable_files;
+  if (!candidates.empty()) {
+    mutex_.Unlock();
+    ReadOptions options;
+    options.fill_cache = false;
+    for (const auto& candidate : candidates) {
+      FileMetaData* f = candidate.second;
+      Iterator* iter =
+          table_cache_->NewIterator(options, f->number, f->file_size);
+      bool droppable = true;
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        ParsedInternalKey ikey;
+        if (!ParseInternalKey(iter->key(), &ikey) || ikey.sequence > seq ||
+            (ikey.type == kTypeRangeDeletion &&
+             ucmp->Compare(iter->value(), end_key) > 0)) {
+          droppable = false;
+          break;
+        }
+      }
+      if (droppable && iter->status().ok()) {
+        droppable_files.insert(std::make_pair(candidate.first, f->number));
+      }
+      delete iter;
+    }
+    mutex_.Lock();
+  }
+  base->Unref();
+
+  Status s;
+  if (!droppable_files.empty()) {
+    //LogAndApply不能和后台线程并发执行：等后台工作结束并占住调度位
+    while (background_compaction_scheduled_) {
+      background_work_finished_signal_.Wait();
+    }
+    if (shutting_down_.load(std::memory_order_acquire)) {
+      return s;
+    }
+    //扫描期间文件可能已经被compaction合并掉，只删除当前Version中还在的
+    VersionEdit edit;
+    bool any = false;
+    candidates.clear();
+    FilesInRange(versions_->current(), begin_key, end_key, &candidates);
+    for (const auto& candidate : candidates) {
+      if (droppable_files.count(
+              std::make_pair(candidate.first, candidate.second->number))) {
+        edit.RemoveFileFromRun(candidate.first, candidate.second->number);
+        any = true;
+      }
+    }
+    if (!any) {
+      return s;
+    }
+    background_compaction_scheduled_ = true;
+    s = LogAndApply(&edit);
+    if (s.ok()) {
+      Log(options_.info_log, "BulkDeleteForRange dropped files: %s",
+          edit.DebugString().c_str());
+      RemoveObsoleteFiles();
+    }
+    background_compaction_scheduled_ = false;
+    UpdateWriteStall();
+    MaybeScheduleCompaction();
+    background_work_finished_signal_.SignalAll();
+  }
+  return s;
+}
+
+namespace {
+
+// An SSTable written by the public TableBuilder, keyed by user keys.
+struct ExternalFile {
+  std::string fname;
+  RandomAccessFile* file = nullptr;
+  Table* table = nullptr;
+  std::string smallest;  // First user key
+  std::string largest;   // Last user key
+};
+
+}  // namespace
+
+Status DBImpl::ConvertExternalFile(Table* src, const std::string& src_fname,
+                                   SequenceNumber seq, FileMetaData* meta) {
+  const Comparator* ucmp = user_comparator();
+  ReadOptions read_options;
+  read_options.verify_checksums = true;
+  read_options.fill_cache = false;
+  Iterator* iter = src->NewIterator(read_options);
+
+  WritableFile* file;
+  Status s = env_->NewWritableFile(TableFileName(dbname_, meta->number), &file);
+  if (!s.ok()) {
+    delete iter;
+    return s;
+  }
+  TableBuilder* builder = new TableBuilder(options_, file);
+  std::string last_key;
+  bool has_last_key = false;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    const Slice user_key = iter->key();
+    if (has_last_key && ucmp->Compare(Slice(last_key), user_key) >= 0) {
+      s = Status::InvalidArgument(src_fname,
+                                  "keys are not in strictly increasing order");
+      break;
+    }
+    last_key.assign(user_key.data(), user_key.size());
+    //所有条目共用同一个序列号
+    InternalKey ikey(user_key, seq, kTypeValue);
+    if (!has_last_key) {
+      meta->smallest = ikey;
+      has_last_key = true;
+    }
+    builder->Add(ikey.Encode(), iter->value());
+  }
+  if (s.ok()) {
+    s = iter->status();
+  }
+  delete iter;
+
+  if (s.ok()) {
+    meta->largest = InternalKey(last_key, seq, kTypeValue);
+    s = builder->Finish();
+    meta->file_size = builder->FileSize();
+    meta->num_entries = builder->NumEntries();
+  } else {
+    builder->Abandon();
+  }
+  delete builder;
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  delete file;
+
+  if (s.ok()) {
+    // Verify that the table is usable
+    Iterator* it = table_cache_->NewIterator(ReadOptions(), meta->number,
+                                             meta->file_size);
+    s = it->status();
+    delete it;
+  }
+  return s;
+}
+
+Status DBImpl::IngestExternalFiles(
+    const std::vector<std::string>& external_files) {
+  if (external_files.empty()) {
+    return Status::OK();
+  }
+  const Comparator* ucmp = user_comparator();
+  //外部文件以user key为键，用用户的comparator读取
+  Options table_options = options_;
+  table_options.comparator = ucmp;
+  table_options.filter_policy = nullptr;
+
+  Status s;
+  std::vector<ExternalFile> files(external_files.size());
+  for (size_t i = 0; s.ok() && i < files.size(); i++) {
+    ExternalFile* f = &files[i];
+    f->fname = external_files[i];
+    uint64_t file_size;
+    s = env_->GetFileSize(f->fname, &file_size);
+    if (s.ok()) {
+      s = env_->NewRandomAccessFile(f->fname, &f->file);
+    }
+    if (s.ok()) {
+      s = Table::Open(table_options, f->file, file_size, &f->table);
+    }
+    if (s.ok()) {
+      ReadOptions read_options;
+      read_options.fill_cache = false;
+      Iterator* iter = f->table->NewIterator(read_options);
+      iter->SeekToFirst();
+      if (iter->Valid()) {
+        f->smallest = iter->key().ToString();
+        iter->SeekToLast();
+        f->largest = iter->key().ToString();
+        s = iter->status();
+      } else {
+        s = iter->status();
+        if (s.ok()) {
+          s = Status::InvalidArgument(f->fname, "file is empty");
+        }
+      }
+      delete iter;
+    }
+  }
+  //文件之间不能重叠，按key顺序组成一个run
+  if (s.ok()) {
+    std::sort(files.begin(), files.end(),
+              [ucmp](const ExternalFile& a, const ExternalFile& b) {
+                return ucmp->Compare(a.smallest, b.smallest) < 0;
+              });
+    for (size_t i = 1; s.ok() && i < files.size(); i++) {
+      if (ucmp->Compare(files[i - 1].largest, files[i].smallest) >= 0) {
+        s = Status::InvalidArgument(
+            "overlapping key ranges", files[i - 1].fname + " " + files[i].fname);
+      }
+    }
+  }
+
+  std::vector<FileMetaData> metas(files.size());
+  if (s.ok()) {
+    MutexLock l(&mutex_);
+    //占住写队列直到导入完成：memtable中不能有比导入数据更新的条目，
+    //否则它们flush时会在B+树中覆盖导入的key
+    Writer w(&mutex_);
+    writers_.push_back(&w);
+    while (&w != writers_.front()) {
+      w.cv.Wait();
+    }
+    //导入的数据比所有memtable都新，先把它们全部flush
+    s = MakeRoomForWrite(true);
+    while (s.ok() && !imm_.empty() && bg_error_.ok()) {
+      background_work_finished_signal_.Wait();
+    }
+    if (s.ok()) {
+      s = bg_error_;
+    }
+
+    const SequenceNumber seq = versions_->LastSequence() + 1;
+    if (s.ok()) {
+      for (FileMetaData& meta : metas) {
+        meta.number = versions_->NewFileNumber();
+        pending_outputs_.insert(meta.number);
+      }
+      mutex_.Unlock();
+      const uint64_t start_micros = env_->NowMicros();
+      for (size_t i = 0; s.ok() && i < files.size(); i++) {
+        s = ConvertExternalFile(files[i].table, files[i].fname, seq,
+                                &metas[i]);
+      }
+      Log(options_.info_log, "Ingesting %d files: %llu us, %s",
+          static_cast<int>(files.size()),
+          static_cast<unsigned long long>(env_->NowMicros() - start_micros),
+          s.ToString().c_str());
+      mutex_.Lock();
+    }
+
+    if (s.ok()) {
+      //LogAndApply和B+树的更新不能和后台compaction并发：占住调度位
+      while (background_compaction_scheduled_) {
+        background_work_finished_signal_.Wait();
+      }
+      if (shutting_down_.load(std::memory_order_acquire)) {
+        s = Status::IOError("Deleting DB during file ingestion");
+      }
+    }
+    if (s.ok()) {
+      background_compaction_scheduled_ = true;
+      versions_->SetLastSequence(seq);
+      //导入的数据最新，放在L0
+      VersionEdit edit;
+      edit.SetLevel(-1, 0);
+      edit.AddRun(versions_->NewRun(0));
+      for (const FileMetaData& meta : metas) {
+        edit.AddFileToRun(meta.number, meta.file_size, meta.smallest,
+                          meta.largest, meta.num_entries, 0);
+      }
+      s = LogAndApply(&edit);
+      if (s.ok()) {
+        //安装Version之后再更新B+树：此前读请求仍指向旧数据，不会读不到
+        Version* current = versions_->current();
+        current->Ref();
+        SortedRun* run = current->GetMapRun(metas[0].number);
+        mutex_.Unlock();
+        index_mutex_.Lock();
+        s = current->IndexRun(run, btree_);
+        index_mutex_.Unlock();
+        mutex_.Lock();
+        current->Unref();
+        if (!s.ok()) {
+          //run已经持久化，只是B+树不完整，重新打开时会重建
+          RecordBackgroundError(s);
+        }
+      }
+      background_compaction_scheduled_ = false;
+      UpdateWriteStall();
+      MaybeScheduleCompaction();
+      background_work_finished_signal_.SignalAll();
+    }
+
+    for (const FileMetaData& meta : metas) {
+      pending_outputs_.erase(meta.number);
+    }
+    if (!s.ok()) {
+      //清理已经转换、但没有加入Version的文件
+      RemoveObsoleteFiles();
+    }
+
+    writers_.pop_front();
+    if (!writers_.empty()) {
+      writers_.front()->cv.Signal();
+    }
+  }
+
+  for (ExternalFile& f : files) {
+    delete f.table;
+    delete f.file;
+  }
+  return s;
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   Writer w(&mutex_);
   w.batch = updates;
   w.sync = options.sync;
   w.done = false;
 
+  //非sync写不加锁入队：栈原本为空的writer负责加锁把它搬进writers_，
+  //其余writer先自旋等待，多数情况下会被当前leader并入写组直接完成
+  const bool fast_path = options_.enable_write_fast_path &&
+                         updates != nullptr && !options.sync;
+  if (fast_path && !PushPendingWriter(&w)) {
+    for (int i = 0; i < kWriteFastPathSpins && !w.done && w.leader == nullptr;
+         i++) {
+      std::this_thread::yield();
+    }
+    if (w.done) {
+      return w.status;
+    }
+  }
+
   MutexLock l(&mutex_);
-  writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  DrainPendingWriters();
+  if (!fast_path) {
+    writers_.push_back(&w);
+  }
+  //流水线模式下，已经写完日志的组会先离开writers_，其成员不再排在队列中
+  while (!w.done && w.leader == nullptr &&
+         (writers_.empty() || &w != writers_.front())) {
     w.cv.Wait();
   }
+  if (w.leader != nullptr) {
+    //leader已经写好日志并分配了序列号，自己把batch插入memtable
+    Writer* leader = w.leader;
+    MemTable* mem = mem_;
+    mutex_.Unlock();
+    Status s = WriteBatchInternal::InsertInto(w.batch, mem, true);
+    mutex_.Lock();
+    if (!s.ok() && leader->insert_status.ok()) {
+      leader->insert_status = s;
+    }
+    if (--leader->pending_inserts == 0) {
+      leader->cv.Signal();
+    }
+    while (!w.done) {
+      w.cv.Wait();
+    }
+  }
   if (w.done) {
     return w.status;
   }
 
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(updates == nullptr);
-  uint64_t last_sequence = versions_->LastSequence();
+  //还在memtable阶段的组已经分配了序列号，但还没有发布
+  uint64_t last_sequence = memtable_writers_.empty()
+                               ? versions_->LastSequence()
+                               : memtable_writers_.back()->last_sequence;
   Writer* last_writer = &w;
   if (status.ok() && updates != nullptr) {  // nullptr batch is for compactions
+    //MakeRoomForWrite可能等待过，把这期间入队的writer也并进来
+    DrainPendingWriters();
     WriteBatch* write_batch = BuildBatchGroup(&last_writer);
-    WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);
+    const SequenceNumber first_sequence = last_sequence + 1;
+    WriteBatchInternal::SetSequence(write_batch, first_sequence);
     last_sequence += WriteBatchInternal::Count(write_batch);
+    if (write_batch == tmp_batch_) {
+      //调用方的batch也带上各自的序列号（BulkDeleteForRange需要）
+      SequenceNumber seq = first_sequence;
+      for (Writer* g = &w; g != nullptr; g = g->next_in_group) {
+        WriteBatchInternal::SetSequence(g->batch, seq);
+        seq += WriteBatchInternal::Count(g->batch);
+        if (g == last_writer) break;
+      }
+    }
+    //组里有多个batch时由各writer并行插入memtable
+    const bool parallel = options_.allow_concurrent_memtable_write &&
+                          write_batch == tmp_batch_;
+    const bool pipelined = options_.enable_pipelined_write;
 
     // Add to log and apply to memtable.  We can release the lock
     // during this phase since &w is currently responsible for logging
@@ -1358,7 +2420,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
           sync_error = true;
         }
       }
-      if (status.ok()) {
+      if (status.ok() && !parallel && !pipelined) {
         status = WriteBatchInternal::InsertInto(write_batch, mem_);
       }
       mutex_.Lock();
@@ -1371,6 +2433,50 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
     }
     if (write_batch == tmp_batch_) tmp_batch_->Clear();
 
+    if (pipelined) {
+      // Let the next group log its record while this one is applied to
+      // the memtable.  Groups apply and publish their sequence numbers in
+      // log order.
+      w.last_sequence = last_sequence;
+      while (true) {
+        Writer* ready = writers_.front();
+        writers_.pop_front();
+        if (ready == last_writer) break;
+      }
+      if (!writers_.empty()) {
+        writers_.front()->cv.Signal();
+      }
+      memtable_writers_.push_back(&w);
+      while (memtable_writers_.front() != &w) {
+        w.cv.Wait();
+      }
+      if (status.ok()) {
+        status = InsertWriteGroup(&w, first_sequence, parallel);
+      }
+      versions_->SetLastSequence(last_sequence);
+      memtable_writers_.pop_front();
+      if (!memtable_writers_.empty()) {
+        memtable_writers_.front()->cv.Signal();
+      } else {
+        // MakeRoomForWrite() may be waiting to seal mem_
+        background_work_finished_signal_.SignalAll();
+      }
+      for (Writer* ready = w.next_in_group; ready != nullptr;) {
+        // Read the link first: ready may return as soon as it is done
+        Writer* next = ready->next_in_group;
+        ready->status = status;
+        ready->cv.Signal();
+        // Last touch: a fast path writer may return without mutex_
+        ready->done = true;
+        ready = next;
+      }
+      return status;
+    }
+
+    if (status.ok() && parallel) {
+      status = InsertWriteGroup(&w, first_sequence, true);
+    }
+
     versions_->SetLastSequence(last_sequence);
   }
 
@@ -1379,8 +2485,8 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
     writers_.pop_front();
     if (ready != &w) {
       ready->status = status;
-      ready->done = true;
       ready->cv.Signal();
+      ready->done = true;
     }
     if (ready == last_writer) break;
   }
@@ -1393,6 +2499,74 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   return status;
 }
 
+bool DBImpl::PushPendingWriter(Writer* w) {
+  Writer* head = pending_writers_.load(std::memory_order_relaxed);
+  do {
+    w->link_older = head;
+  } while (!pending_writers_.compare_exchange_weak(
+      head, w, std::memory_order_release, std::memory_order_relaxed));
+  return head == nullptr;
+}
+
+// REQUIRES: mutex_ is held
+void DBImpl::DrainPendingWriters() {
+  mutex_.AssertHeld();
+  Writer* head = pending_writers_.exchange(nullptr, std::memory_order_acquire);
+  if (head == nullptr) {
+    return;
+  }
+  //栈中是从新到旧，按入栈顺序接到writers_末尾
+  size_t n = 0;
+  for (Writer* w = head; w != nullptr; w = w->link_older) {
+    n++;
+  }
+  writers_.resize(writers_.size() + n);
+  std::deque<Writer*>::iterator iter = writers_.end();
+  for (Writer* w = head; w != nullptr; w = w->link_older) {
+    *--iter = w;
+  }
+}
+
+// REQUIRES: mutex_ is held
+Status DBImpl::InsertWriteGroup(Writer* leader, SequenceNumber sequence,
+                                bool parallel) {
+  mutex_.AssertHeld();
+  //按组内顺序给每个batch分配序列号，和合并后的日志记录一致
+  leader->pending_inserts = 0;
+  for (Writer* w = leader; w != nullptr; w = w->next_in_group) {
+    if (w->batch != nullptr) {
+      WriteBatchInternal::SetSequence(w->batch, sequence);
+      sequence += WriteBatchInternal::Count(w->batch);
+      if (parallel && w != leader) {
+        w->leader = leader;
+        leader->pending_inserts++;
+        w->cv.Signal();
+      }
+    }
+  }
+
+  MemTable* mem = mem_;
+  mutex_.Unlock();
+  Status s;
+  if (parallel) {
+    s = WriteBatchInternal::InsertInto(leader->batch, mem, true);
+  } else {
+    for (Writer* w = leader; w != nullptr && s.ok(); w = w->next_in_group) {
+      if (w->batch != nullptr) {
+        s = WriteBatchInternal::InsertInto(w->batch, mem);
+      }
+    }
+  }
+  mutex_.Lock();
+  while (leader->pending_inserts > 0) {
+    leader->cv.Wait();
+  }
+  if (s.ok()) {
+    s = leader->insert_status;
+  }
+  return s;
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-null batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1422,22 +2596,26 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
       break;
     }
 
-    if (w->batch != nullptr) {
-      size += WriteBatchInternal::ByteSize(w->batch);
-      if (size > max_size) {
-        // Do not make batch too big
-        break;
-      }
+    if (w->batch == nullptr) {
+      //空batch（强制flush、文件导入）需要自己排到队首，不并入别的组
+      break;
+    }
 
-      // Append to *result
-      if (result == first->batch) {
-        // Switch to temporary batch instead of disturbing caller's batch
-        result = tmp_batch_;
-        assert(WriteBatchInternal::Count(result) == 0);
-        WriteBatchInternal::Append(result, first->batch);
-      }
-      WriteBatchInternal::Append(result, w->batch);
+    size += WriteBatchInternal::ByteSize(w->batch);
+    if (size > max_size) {
+      // Do not make batch too big
+      break;
     }
+
+    // Append to *result
+    if (result == first->batch) {
+      // Switch to temporary batch instead of disturbing caller's batch
+      result = tmp_batch_;
+      assert(WriteBatchInternal::Count(result) == 0);
+      WriteBatchInternal::Append(result, first->batch);
+    }
+    WriteBatchInternal::Append(result, w->batch);
+    (*last_writer)->next_in_group = w;
     *last_writer = w;
   }
   return result;
@@ -1455,37 +2633,52 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // Yield previous error
       s = bg_error_;
       break;
-    } else if (allow_delay && versions_->NumLevelFiles(0) >=
-                                  config::kL0_SlowdownWritesTrigger) {
-      // We are getting close to hitting a hard limit on the number of
-      // L0 files.  Rather than delaying a single write by several
-      // seconds when we hit the hard limit, start delaying each
-      // individual write by 1ms to reduce latency variance.  Also,
+    } else if (allow_delay &&
+               write_controller_.state() == WriteController::kDelayed) {
+      // Compaction is falling behind.  Rather than delaying a single
+      // write by several seconds when we hit the hard limit, pace every
+      // write at the delayed write rate to reduce latency variance.  Also,
       // this delay hands over some CPU to the compaction thread in
       // case it is sharing the same core as the writer.
-      mutex_.Unlock();
-      env_->SleepForMicroseconds(1000);
+      //按写入字节数和限速计算延迟
       allow_delay = false;  // Do not delay a single write more than once
-      mutex_.Lock();
+      const uint64_t delay = write_controller_.GetDelay(
+          env_->NowMicros(),
+          WriteBatchInternal::ByteSize(writers_.front()->batch));
+      if (delay > 0) {
+        mutex_.Unlock();
+        env_->SleepForMicroseconds(static_cast<int>(delay));
+        mutex_.Lock();
+        write_controller_.RecordStall(WriteController::kDelayed, delay);
+      }
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
       break;
-    } else if (imm_ != nullptr) {
+    } else if (imm_.size() + 1 >=
+               static_cast<size_t>(options_.max_write_buffer_number)) {
       // We have filled up the current memtable, but the previous
-      // one is still being compacted, so we wait.
+      // ones are still being compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
       background_work_finished_signal_.Wait();
-    } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
-      // There are too many level-0 files.
-      Log(options_.info_log, "Too many L0 files; waiting...\n");
+    } else if (write_controller_.state() == WriteController::kStopped &&
+               background_compaction_scheduled_) {
+      // There are too many runs or too much pending compaction work.
+      Log(options_.info_log, "Too many runs; waiting...\n");
+      const uint64_t start_micros = env_->NowMicros();
+      background_work_finished_signal_.Wait();
+      write_controller_.RecordStall(WriteController::kStopped,
+                                    env_->NowMicros() - start_micros);
+    } else if (!memtable_writers_.empty()) {
+      // Logged write groups are still being applied to mem_; wait for
+      // them before sealing it.
       background_work_finished_signal_.Wait();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
       uint64_t new_log_number = versions_->NewFileNumber();
       WritableFile* lfile = nullptr;
-      s = env_->NewWritableFile(LogFileName(dbname_, new_log_number), &lfile);
+      s = NewLogFile(new_log_number, &lfile);
       if (!s.ok()) {
         // Avoid chewing through file number space in a tight loop.
         versions_->ReuseFileNumber(new_log_number);
@@ -1509,13 +2702,53 @@ Status DBImpl::MakeRoomForWrite(bool force) {
 
       logfile_ = lfile;
       logfile_number_ = new_log_number;
-      log_ = new log::Writer(lfile);
-      imm_ = mem_;
-      has_imm_.store(true, std::memory_order_release);
-      mem_ = new MemTable(internal_comparator_);
+      log_ = new log::Writer(lfile, 0, new_log_number,
+                             options_.recycle_log_file_num > 0,
+                             options_.wal_compression);
+      imm_.push_back(ImmutableMemTable{mem_, new_log_number});
+      mem_ = new MemTable(internal_comparator_, options_);
       mem_->Ref();
+      if (force) {
+        //强制flush（TEST_CompactMemTable、CompactRange）不等凑齐一批
+        flush_requested_ = true;
+      }
       force = false;  // Do not force another compaction if have room
-      MaybeScheduleCompaction();
+      MaybeScheduleFlush();
+    }
+  }
+  return s;
+}
+
+Status DBImpl::NewLogFile(uint64_t log_number, WritableFile** result) {
+  mutex_.AssertHeld();
+  const std::string fname = LogFileName(dbname_, log_number);
+  Status s;
+  bool reused = false;
+  if (!log_recycle_files_.empty()) {
+    const uint64_t old_log_number = log_recycle_files_.front();
+    log_recycle_files_.pop_front();
+    s = env_->ReuseWritableFile(fname, LogFileName(dbname_, old_log_number),
+                                result);
+    if (s.ok()) {
+      Log(options_.info_log, "Recycling log #%llu as #%llu\n",
+          static_cast<unsigned long long>(old_log_number),
+          static_cast<unsigned long long>(log_number));
+      reused = true;
+    } else {
+      Log(options_.info_log, "Failed to recycle log #%llu: %s\n",
+          static_cast<unsigned long long>(old_log_number),
+          s.ToString().c_str());
+    }
+  }
+  if (!reused) {
+    s = env_->NewWritableFile(fname, result);
+  }
+  if (s.ok()) {
+    //一个日志大约写满一个memtable，按此预分配空间
+    (*result)->SetPreallocationBlockSize(options_.write_buffer_size +
+                                         options_.write_buffer_size / 10);
+    if (options_.recycle_log_file_num > 0 && min_recyclable_log_number_ == 0) {
+      min_recyclable_log_number_ = log_number;
     }
   }
   return s;
@@ -1543,6 +2776,15 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
       *value = buf;
       return true;
     }
+  } else if (in.starts_with("num-runs-at-level")) {
+    in.remove_prefix(strlen("num-runs-at-level"));
+    uint64_t level;
+    bool ok = ConsumeDecimalNumber(&in, &level) && in.empty();
+    if (!ok || level >= config::kNumLevels) {
+      return false;
+    }
+    *value = std::to_string(versions_->NumLevelRuns(static_cast<int>(level)));
+    return true;
   } else if (in == "stats") {
     char buf[200];
     std::snprintf(buf, sizeof(buf),
@@ -1562,16 +2804,39 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
       }
     }
     return true;
+  } else if (in == "rate-limiter") {
+    RateLimiter* limiter = options_.rate_limiter;
+    if (limiter == nullptr) {
+      return false;
+    }
+    char buf[200];
+    std::snprintf(buf, sizeof(buf),
+                  "bytes-per-second: %lld\n"
+                  "flush-bytes: %lld\n"
+                  "compaction-bytes: %lld\n",
+                  static_cast<long long>(limiter->GetBytesPerSecond()),
+                  static_cast<long long>(
+                      limiter->GetTotalBytesThrough(RateLimiter::kHigh)),
+                  static_cast<long long>(
+                      limiter->GetTotalBytesThrough(RateLimiter::kLow)));
+    value->append(buf);
+    return true;
+  } else if (in == "write-stall") {
+    *value = write_controller_.DebugString();
+    return true;
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "num-immutable-mem-table") {
+    *value = std::to_string(imm_.size());
+    return true;
   } else if (in == "approximate-memory-usage") {
     size_t total_usage = options_.block_cache->TotalCharge();
     if (mem_) {
       total_usage += mem_->ApproximateMemoryUsage();
     }
-    if (imm_) {
-      total_usage += imm_->ApproximateMemoryUsage();
+    for (const ImmutableMemTable& imm : imm_) {
+      total_usage += imm.mem->ApproximateMemoryUsage();
     }
     char buf[50];
     std::snprintf(buf, sizeof(buf), "%llu",
@@ -1635,14 +2900,15 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
     // Create new log and a corresponding memtable.
     uint64_t new_log_number = impl->versions_->NewFileNumber();
     WritableFile* lfile;
-    s = options.env->NewWritableFile(LogFileName(dbname, new_log_number),
-                                     &lfile);
+    s = impl->NewLogFile(new_log_number, &lfile);
     if (s.ok()) {
       edit.SetLogNumber(new_log_number);
       impl->logfile_ = lfile;
       impl->logfile_number_ = new_log_number;
-      impl->log_ = new log::Writer(lfile);
-      impl->mem_ = new MemTable(impl->internal_comparator_);
+      impl->log_ = new log::Writer(lfile, 0, new_log_number,
+                                   options.recycle_log_file_num > 0,
+                                   impl->options_.wal_compression);
+      impl->mem_ = new MemTable(impl->internal_comparator_, impl->options_);
       impl->mem_->Ref();
     }
   }
@@ -1653,6 +2919,7 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
   }
   if (s.ok()) {
     impl->RemoveObsoleteFiles();
+    impl->UpdateWriteStall();
     impl->MaybeScheduleCompaction();
   }
   impl->mutex_.Unlock();
@@ -9,10 +9,12 @@
 #include <deque>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
+#include "db/write_controller.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "port/port.h"
@@ -21,7 +23,10 @@
 
 namespace leveldb {
 
+struct FileMetaData;
 class MemTable;
+class RangeDelAggregator;
+class Table;
 class TableCache;
 class Version;
 class VersionEdit;
@@ -40,7 +45,11 @@ class DBImpl : public DB {
   Status Put(const WriteOptions&, const Slice& key,
              const Slice& value) override;
   Status Delete(const WriteOptions&, const Slice& key) override;
+  Status BulkDeleteForRange(const WriteOptions&, const Slice& begin_key,
+                            const Slice& end_key) override;
   Status Write(const WriteOptions& options, WriteBatch* updates) override;
+  Status IngestExternalFiles(
+      const std::vector<std::string>& external_files) override;
   Status Get(const ReadOptions& options, const Slice& key,
              std::string* value) override;
   Iterator* NewIterator(const ReadOptions&) override;
@@ -48,12 +57,13 @@ class DBImpl : public DB {
   void ReleaseSnapshot(const Snapshot* snapshot) override;
   bool GetProperty(const Slice& property, std::string* value) override;
   void GetApproximateSizes(const Range* range, int n, uint64_t* sizes) override;
-  //void CompactRange(const Slice* begin, const Slice* end) override;
+  void CompactRange(const Slice* begin, const Slice* end) override;
 
   void PrintTree() override;
   // Extra methods (for testing) that are not in the public DB interface
 
-  // Compact any files in the named level that overlap [*begin,*end]
+  // Compact any runs in the named level that overlap [*begin,*end]
+  // into a single run at the next level (in place for the last level).
   void TEST_CompactRange(int level, const Slice* begin, const Slice* end);
 
   // Force current memtable contents to be compacted.
@@ -68,6 +78,9 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // Return the length of the longest run lineage.
+  size_t TEST_MaxRunLineage();
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.
@@ -77,14 +90,25 @@ class DBImpl : public DB {
   friend class DB;
   struct CompactionState;
   struct Writer;
+  class LogReplayer;
+
+  // A memtable waiting for the flush thread, with the number of the log
+  // file started when it was sealed: once the memtable is on disk, the
+  // logs older than that are no longer needed.
+  struct ImmutableMemTable {
+    MemTable* mem;
+    uint64_t next_log_number;
+  };
 
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
+    int output_level;
     bool done;
     const InternalKey* begin;  // null means beginning of key range
     const InternalKey* end;    // null means end of key range
     InternalKey tmp_storage;   // Used to keep track of compaction progress
+    std::set<uint64_t> merged_runs;  // Runs produced by the chunks so far
   };
 
   // Per level compaction stats.  stats_[level] stores the stats for
@@ -103,9 +127,11 @@ class DBImpl : public DB {
     int64_t bytes_written;
   };
 
+  // If range_del is non-null, *range_del is set to the range tombstones of
+  // the memtables visible to the read; the caller owns it.
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot,
-                                uint32_t* seed);
+                                uint32_t* seed, RangeDelAggregator** range_del);
 
   Status NewDB();
 
@@ -120,16 +146,28 @@ class DBImpl : public DB {
   // Delete any unneeded files and stale in-memory entries.
   void RemoveObsoleteFiles() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  // Compact the in-memory write buffer to disk.  Switches to a new
-  // log-file/memtable and writes a new descriptor iff successful.
-  // Errors are recorded in bg_error_.
+  // Merge the oldest immutable memtables (at most
+  // options_.min_write_buffer_number_to_merge of them) into one table and
+  // drop them from imm_, writing a new descriptor iff successful.  Errors
+  // are recorded in bg_error_.
   void CompactMemTable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  // Write the merged contents of "mems" as one level-0 run.  If
+  // pending_file is non-null, the new table stays in pending_outputs_ and
+  // its number is stored in *pending_file: the caller erases it once
+  // *edit is installed.
+  Status WriteLevel0Table(const std::vector<MemTable*>& mems,
+                          VersionEdit* edit, Version* base,
+                          uint64_t* pending_file = nullptr)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Create the file for log "log_number", reusing an obsolete log from
+  // log_recycle_files_ when one is available.
+  Status NewLogFile(uint64_t log_number, WritableFile** result)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
@@ -137,14 +175,68 @@ class DBImpl : public DB {
   WriteBatch* BuildBatchGroup(Writer** last_writer)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Push *w onto pending_writers_ without taking mutex_.  Returns true if
+  // the stack was empty, in which case the caller must drain it.
+  bool PushPendingWriter(Writer* w);
+  // Move the pending writers to the tail of writers_, oldest first.
+  void DrainPendingWriters() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Insert the batches of the logged write group led by "leader" into
+  // mem_, numbering them from "sequence" on.  If parallel is true each
+  // writer inserts its own batch, otherwise the leader inserts them all.
+  // Returns once all of them are in.
+  Status InsertWriteGroup(Writer* leader, SequenceNumber sequence,
+                          bool parallel) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   void RecordBackgroundError(const Status& s);
 
+  // Apply *edit to the current version and log it to the MANIFEST.  The
+  // flush and compaction threads both install versions, one at a time.
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Feed the shape of the current version to write_controller_.  Called
+  // whenever a new version is installed.
+  void UpdateWriteStall() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Store in *files the (run id, file) pairs of v whose files lie
+  // entirely inside [begin_key, end_key).
+  void FilesInRange(Version* v, const Slice& begin_key, const Slice& end_key,
+                    std::vector<std::pair<uint64_t, FileMetaData*>>* files)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Drop the table files lying entirely inside [begin_key, end_key) from
+  // their runs.  "seq" is the sequence number of the range tombstone that
+  // hides them; files holding newer entries are kept.
+  Status DropFilesInRange(const Slice& begin_key, const Slice& end_key,
+                          SequenceNumber seq) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Rewrite the external table "src" (named src_fname) as the table file
+  // meta->number, with every user key tagged with sequence number "seq".
+  // Fails unless the keys of "src" are strictly increasing.
+  Status ConvertExternalFile(Table* src, const std::string& src_fname,
+                             SequenceNumber seq, FileMetaData* meta);
+
+  // Merge the runs in "level" overlapping [*begin,*end] into one run at
+  // "output_level", one bounded chunk per background compaction.
+  void RunManualCompaction(int level, int output_level, const Slice* begin,
+                           const Slice* end);
+
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
   void BackgroundCall();
+
+  // Start the flush thread if enough immutable memtables are waiting to be
+  // merged, or a flush was forced.  It runs until no such work is left.
+  void MaybeScheduleFlush() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGFlushWork(void* db);
+  void BackgroundFlushCall();
   void BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Truncate the lineage of every run whose lineage is longer than
+  // config::kMaxRunLineage, pointing the B+ tree at the L0 number kept.
+  Status CompactLineage() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
@@ -177,15 +269,29 @@ class DBImpl : public DB {
   std::atomic<bool> shutting_down_;
   port::CondVar background_work_finished_signal_ GUARDED_BY(mutex_);
   MemTable* mem_;//当前的active mem
-  MemTable* imm_ GUARDED_BY(mutex_);  // Memtable being compacted
-  std::atomic<bool> has_imm_;         // So bg thread can detect non-null imm_
+  // Memtables waiting to be flushed, oldest first.  Holds at most
+  // options_.max_write_buffer_number - 1 of them.
+  std::deque<ImmutableMemTable> imm_ GUARDED_BY(mutex_);
   WritableFile* logfile_;
   uint64_t logfile_number_ GUARDED_BY(mutex_);
   log::Writer* log_;
+  // Obsolete log files kept for reuse, oldest first.  At most
+  // options_.recycle_log_file_num of them.
+  std::deque<uint64_t> log_recycle_files_ GUARDED_BY(mutex_);
+  // First log written in the recyclable format by this instance (0: none).
+  // Only such logs may be recycled, since replay of a reused file can only
+  // detect leftovers of recyclable records.
+  uint64_t min_recyclable_log_number_ GUARDED_BY(mutex_);
   uint32_t seed_ GUARDED_BY(mutex_);  // For sampling.
 
   // Queue of writers.
   std::deque<Writer*> writers_ GUARDED_BY(mutex_);
+  // Lock-free stack of non-sync writers, newest first, that have not been
+  // moved to writers_ yet.
+  std::atomic<Writer*> pending_writers_;
+  // Leaders of the write groups that are logged but not yet applied to
+  // mem_, in log order.  Only used with options_.enable_pipelined_write.
+  std::deque<Writer*> memtable_writers_ GUARDED_BY(mutex_);
   WriteBatch* tmp_batch_ GUARDED_BY(mutex_);
 
   SnapshotList snapshots_ GUARDED_BY(mutex_);
@@ -197,6 +303,16 @@ class DBImpl : public DB {
   // Has a background compaction been scheduled or is running?
   bool background_compaction_scheduled_ GUARDED_BY(mutex_);
 
+  // Is the flush thread running?
+  bool background_flush_scheduled_ GUARDED_BY(mutex_);
+
+  // Flush every immutable memtable even if fewer than
+  // options_.min_write_buffer_number_to_merge are waiting.
+  bool flush_requested_ GUARDED_BY(mutex_);
+
+  // Is a version edit being logged by LogAndApply()?
+  bool logging_version_edit_ GUARDED_BY(mutex_);
+
   ManualCompaction* manual_compaction_ GUARDED_BY(mutex_);
 
   VersionSet* const versions_ GUARDED_BY(mutex_);
@@ -206,6 +322,12 @@ class DBImpl : public DB {
 
   CompactionStats stats_[config::kNumLevels] GUARDED_BY(mutex_);
 
+  // Write backpressure driven by the compaction backlog
+  WriteController write_controller_ GUARDED_BY(mutex_);
+
+  // Serializes the writers of btree_: table builds of the flush thread and
+  // the index updates of compactions.  Never held together with mutex_.
+  port::Mutex index_mutex_;
   VanillaBPlusTree<std::string, uint64_t>* btree_;
 };
 
@@ -7,6 +7,7 @@
 #include "db/db_impl.h"
 #include "db/dbformat.h"
 #include "db/filename.h"
+#include "db/range_del.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "port/port.h"
@@ -46,11 +47,15 @@ class DBIter : public Iterator {
   enum Direction { kForward, kReverse };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+         uint32_t seed, RangeDelAggregator* range_del, const Slice* lower_bound,
+         const Slice* upper_bound)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        range_del_(range_del),
+        lower_bound_(lower_bound),
+        upper_bound_(upper_bound),
         direction_(kForward),
         valid_(false),
         rnd_(seed),
@@ -59,7 +64,10 @@ class DBIter : public Iterator {
   DBIter(const DBIter&) = delete;
   DBIter& operator=(const DBIter&) = delete;
 
-  ~DBIter() override { delete iter_; }
+  ~DBIter() override {
+    delete iter_;
+    delete range_del_;
+  }
   bool Valid() const override { return valid_; }
   Slice key() const override {
     assert(valid_);
@@ -88,6 +96,26 @@ class DBIter : public Iterator {
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
 
+  // The type this entry has for the reader: a value covered by a newer
+  // range tombstone reads as a deletion.
+  ValueType EffectiveType(const ParsedInternalKey& ikey) const {
+    if (ikey.type == kTypeValue && range_del_ != nullptr &&
+        range_del_->ShouldDelete(ikey.user_key, ikey.sequence)) {
+      return kTypeDeletion;
+    }
+    return ikey.type;
+  }
+
+  bool BeforeLowerBound(const Slice& user_key) const {
+    return lower_bound_ != nullptr &&
+           user_comparator_->Compare(user_key, *lower_bound_) < 0;
+  }
+
+  bool AtOrAfterUpperBound(const Slice& user_key) const {
+    return upper_bound_ != nullptr &&
+           user_comparator_->Compare(user_key, *upper_bound_) >= 0;
+  }
+
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
   }
@@ -110,6 +138,9 @@ class DBIter : public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  RangeDelAggregator* const range_del_;  // Tombstones not yet flushed
+  const Slice* const lower_bound_;       // Inclusive, may be null
+  const Slice* const upper_bound_;       // Exclusive, may be null
   Status status_;
   std::string saved_key_;    // == current key when direction_==kReverse
   std::string saved_value_;  // == current raw value when direction_==kReverse
@@ -181,8 +212,13 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   assert(direction_ == kForward);
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
-      switch (ikey.type) {
+    const bool parsed = ParseKey(&ikey);
+    if (parsed && AtOrAfterUpperBound(ikey.user_key)) {
+      // Past the end of the iteration range
+      break;
+    }
+    if (parsed && ikey.sequence <= sequence_) {
+      switch (EffectiveType(ikey)) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
           // they are hidden by this deletion.
@@ -199,6 +235,9 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
             return;
           }
           break;
+        case kTypeRangeDeletion:
+          // Applied through range_del_ and the B+ tree
+          break;
       }
     }
     iter_->Next();
@@ -241,13 +280,20 @@ void DBIter::FindPrevUserEntry() {
   if (iter_->Valid()) {
     do {
       ParsedInternalKey ikey;
-      if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+      const bool parsed = ParseKey(&ikey);
+      if (parsed && BeforeLowerBound(ikey.user_key)) {
+        // Before the start of the iteration range.  iter_ stays just before
+        // the entries of saved_key_, as Next() expects.
+        break;
+      }
+      if (parsed && ikey.sequence <= sequence_ &&
+          ikey.type != kTypeRangeDeletion) {
         if ((value_type != kTypeDeletion) &&
             user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
           // We encountered a non-deleted value in entries for previous keys,
           break;
         }
-        value_type = ikey.type;
+        value_type = EffectiveType(ikey);
         if (value_type == kTypeDeletion) {
           saved_key_.clear();
           ClearSavedValue();
@@ -280,8 +326,9 @@ void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
   ClearSavedValue();
   saved_key_.clear();
+  const Slice start = BeforeLowerBound(target) ? *lower_bound_ : target;
   AppendInternalKey(&saved_key_,
-                    ParsedInternalKey(target, sequence_, kValueTypeForSeek));
+                    ParsedInternalKey(start, sequence_, kValueTypeForSeek));
   iter_->Seek(saved_key_);
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
@@ -291,6 +338,10 @@ void DBIter::Seek(const Slice& target) {
 }
 
 void DBIter::SeekToFirst() {
+  if (lower_bound_ != nullptr) {
+    Seek(*lower_bound_);
+    return;
+  }
   direction_ = kForward;
   ClearSavedValue();
   iter_->SeekToFirst();
@@ -304,7 +355,19 @@ void DBIter::SeekToFirst() {
 void DBIter::SeekToLast() {
   direction_ = kReverse;
   ClearSavedValue();
-  iter_->SeekToLast();
+  if (upper_bound_ != nullptr) {
+    // Position at the last entry before *upper_bound_
+    iter_->Seek(
+        InternalKey(*upper_bound_, kMaxSequenceNumber, kValueTypeForSeek)
+            .Encode());
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+  } else {
+    iter_->SeekToLast();
+  }
   FindPrevUserEntry();
 }
 
@@ -312,8 +375,10 @@ void DBIter::SeekToLast() {
 
 Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+                        uint32_t seed, RangeDelAggregator* range_del,
+                        const Slice* lower_bound, const Slice* upper_bound) {
+  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed,
+                    range_del, lower_bound, upper_bound);
 }
 
 }  // namespace leveldb
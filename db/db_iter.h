@@ -13,13 +13,19 @@
 namespace leveldb {
 
 class DBImpl;
+class RangeDelAggregator;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  Entries covered by a tombstone in
+// "*range_del" (may be null) are treated as deleted; the iterator takes
+// ownership of range_del.  If lower_bound/upper_bound are non-null, only
+// user keys in [*lower_bound, *upper_bound) are returned.
 Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed);
+                        uint32_t seed, RangeDelAggregator* range_del,
+                        const Slice* lower_bound = nullptr,
+                        const Slice* upper_bound = nullptr);
 
 }  // namespace leveldb
 
@@ -2114,6 +2114,16 @@ class ModelDB : public DB {
   Status Delete(const WriteOptions& o, const Slice& key) override {
     return DB::Delete(o, key);
   }
+  Status BulkDeleteForRange(const WriteOptions& o, const Slice& begin_key,
+                            const Slice& end_key) override {
+    WriteBatch batch;
+    batch.DeleteRange(begin_key, end_key);
+    return Write(o, &batch);
+  }
+  Status IngestExternalFiles(
+      const std::vector<std::string>& external_files) override {
+    return Status::NotSupported("IngestExternalFiles");
+  }
   Status Get(const ReadOptions& options, const Slice& key,
              std::string* value) override {
     assert(false);  // Not implemented
@@ -2147,6 +2157,10 @@ class ModelDB : public DB {
         (*map_)[key.ToString()] = value.ToString();
       }
       void Delete(const Slice& key) override { map_->erase(key.ToString()); }
+      void DeleteRange(const Slice& begin_key, const Slice& end_key) override {
+        map_->erase(map_->lower_bound(begin_key.ToString()),
+                    map_->lower_bound(end_key.ToString()));
+      }
     };
     Handler handler;
     handler.map_ = &map_;
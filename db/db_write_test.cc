@@ -0,0 +1,161 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "db/dbformat.h"
+#include "db/snapshot.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "leveldb/write_batch.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+namespace {
+
+constexpr int kNumThreads = 8;
+constexpr int kWritesPerThread = 500;
+// 每个线程每隔kBatchEvery次写一个含kBatchSize条记录的WriteBatch
+constexpr int kBatchEvery = 5;
+constexpr int kBatchSize = 3;
+
+std::string Key(int thread, int i, int j) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "t%d.%06d.%d", thread, i, j);
+  return buf;
+}
+
+}  // namespace
+
+class DBWriteTest : public testing::Test {
+ public:
+  DBWriteTest() : db_(nullptr) {
+    dbname_ = testing::TempDir() + "db_write_test";
+    options_.create_if_missing = true;
+    // 小的写缓冲区使写入过程中多次切换memtable
+    options_.write_buffer_size = 64 << 10;
+    DestroyDB(dbname_, options_);
+    EXPECT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  ~DBWriteTest() {
+    delete db_;
+    DestroyDB(dbname_, options_);
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  void Reopen() {
+    delete db_;
+    db_ = nullptr;
+    ASSERT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  void ConcurrentMixedSyncWrites();
+
+ protected:
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+};
+
+// sync与非sync写交错并发执行(非sync写走无锁入队的快速路径),
+// 同时有线程不断强制刷写memtable。结束后每条写入都必须可见,
+// 且序列号恰好为1..N,没有空洞也没有重复
+void DBWriteTest::ConcurrentMixedSyncWrites() {
+  std::atomic<bool> writers_done(false);
+  std::atomic<int> failures(0);
+
+  std::thread flusher([&]() {
+    while (!writers_done.load(std::memory_order_acquire)) {
+      if (!dbfull()->TEST_CompactMemTable().ok()) {
+        failures.fetch_add(1);
+      }
+      std::this_thread::yield();
+    }
+  });
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kWritesPerThread; i++) {
+        WriteOptions wo;
+        wo.sync = (i + t) % 3 == 0;
+        Status s;
+        if (i % kBatchEvery == 0) {
+          WriteBatch batch;
+          for (int j = 0; j < kBatchSize; j++) {
+            batch.Put(Key(t, i, j), Key(t, i, j));
+          }
+          s = db_->Write(wo, &batch);
+        } else {
+          s = db_->Put(wo, Key(t, i, 0), Key(t, i, 0));
+        }
+        if (!s.ok()) {
+          failures.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  writers_done.store(true, std::memory_order_release);
+  flusher.join();
+  ASSERT_EQ(0, failures.load());
+
+  // 每条写入都可见
+  uint64_t expected_entries = 0;
+  for (int t = 0; t < kNumThreads; t++) {
+    for (int i = 0; i < kWritesPerThread; i++) {
+      const int entries = (i % kBatchEvery == 0) ? kBatchSize : 1;
+      for (int j = 0; j < entries; j++) {
+        std::string value;
+        ASSERT_LEVELDB_OK(db_->Get(ReadOptions(), Key(t, i, j), &value));
+        ASSERT_EQ(Key(t, i, j), value);
+      }
+      expected_entries += entries;
+    }
+  }
+
+  // 最新序列号等于写入条数
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_EQ(expected_entries,
+            static_cast<const SnapshotImpl*>(snapshot)->sequence_number());
+  db_->ReleaseSnapshot(snapshot);
+
+  // 所有key互不相同,不会被合并掉:内部迭代器中的序列号恰好是1..N
+  std::set<SequenceNumber> sequences;
+  Iterator* iter = dbfull()->TEST_NewInternalIterator();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    ASSERT_TRUE(ParseInternalKey(iter->key(), &ikey));
+    ASSERT_EQ(kTypeValue, ikey.type);
+    ASSERT_TRUE(sequences.insert(ikey.sequence).second)
+        << "duplicate sequence " << ikey.sequence;
+  }
+  ASSERT_LEVELDB_OK(iter->status());
+  delete iter;
+  ASSERT_EQ(expected_entries, sequences.size());
+  ASSERT_EQ(1u, *sequences.begin());
+  ASSERT_EQ(expected_entries, *sequences.rbegin());
+}
+
+TEST_F(DBWriteTest, ConcurrentMixedSyncWrites) { ConcurrentMixedSyncWrites(); }
+
+// 写日志与写memtable流水线执行时，写入仍按序列号顺序可见
+TEST_F(DBWriteTest, PipelinedConcurrentMixedSyncWrites) {
+  options_.enable_pipelined_write = true;
+  Reopen();
+  ConcurrentMixedSyncWrites();
+}
+
+}  // namespace leveldb
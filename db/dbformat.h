@@ -37,6 +37,35 @@ static const int kL0_SlowdownWritesTrigger = 50;
 //当L0层的文件数量达到这个参数时，暂停写入
 static const int kL0_StopWritesTrigger = 1000;
 
+static const int kTieredTrigger = 4;
+
+// A level is compacted once it holds this many runs, even if it is still
+// under its size limit.
+static const int kLevelRunCompactionTrigger = 16;
+
+// Soft and hard limits on the number of runs over all levels.  Every run
+// is merged on every read, so a growing pile of runs is throttled before
+// it hurts reads.  A healthy tree holds about ten runs per level.
+// kRunStopWritesTrigger > kNumLevels * (kLevelRunCompactionTrigger - 1),
+// so a stop always leaves some level that needs a compaction.
+//所有层的run总数达到这两个参数时，分别放慢/暂停写入
+static const int kRunSlowdownWritesTrigger = 64;
+static const int kRunStopWritesTrigger = 128;
+
+// A run whose L0 lineage grows past this many files is truncated: the
+// B+ tree entries of the dropped L0 numbers are pointed at the one kept.
+//run的血缘（映射到它的L0编号）超过这个长度时，截断血缘
+static const int kMaxRunLineage = 64;
+
+// A MANIFEST snapshot is split into records of about this many file and
+// lineage entries, so no single record holds the whole version.
+static const int kSnapshotEntriesPerRecord = 4096;
+
+// Soft and hard limits on the bytes compaction still has to rewrite (see
+// VersionSet::PendingCompactionBytes).
+static const int64_t kPendingCompactionBytesSlowdownTrigger = 64LL << 30;
+static const int64_t kPendingCompactionBytesStopTrigger = 256LL << 30;
+
 // Maximum level to which a new compacted memtable is pushed if it
 // does not create overlap.  We try to push to level 2 to avoid the
 // relatively expensive level 0=>1 compactions and to avoid some
@@ -49,8 +78,6 @@ static const int kMaxMemCompactLevel = 2;
 // Approximate gap in bytes between samples of data read during iteration.
 static const int kReadBytesPeriod = 1048576;
 
-static const int kTieredTrigger = 4;
-
 }  // namespace config
 
 class InternalKey;
@@ -58,7 +85,12 @@ class InternalKey;
 // Value types encoded as the last component of internal keys.
 // DO NOT CHANGE THESE ENUM VALUES: they are embedded in the on-disk
 // data structures.
-enum ValueType { kTypeDeletion = 0x0, kTypeValue = 0x1 };
+//kTypeRangeDeletion：范围删除，key为起始user key，value为（不包含的）结束user key
+enum ValueType {
+  kTypeDeletion = 0x0,
+  kTypeValue = 0x1,
+  kTypeRangeDeletion = 0x2
+};
 // kValueTypeForSeek defines the ValueType that should be passed when
 // constructing a ParsedInternalKey object for seeking to a particular
 // sequence number (since we sort sequence numbers in decreasing order
@@ -66,7 +98,7 @@ enum ValueType { kTypeDeletion = 0x0, kTypeValue = 0x1 };
 // number in internal keys, we need to use the highest-numbered
 // ValueType, not the lowest).
 //用于Seek的时候，构造一个在特定userkey的所有版本前的internalkey
-static const ValueType kValueTypeForSeek = kTypeValue;
+static const ValueType kValueTypeForSeek = kTypeRangeDeletion;
 
 typedef uint64_t SequenceNumber;
 
@@ -197,7 +229,7 @@ inline bool ParseInternalKey(const Slice& internal_key,
   result->sequence = num >> 8;
   result->type = static_cast<ValueType>(c);
   result->user_key = Slice(internal_key.data(), n - 8);
-  return (c <= static_cast<uint8_t>(kTypeValue));
+  return (c <= static_cast<uint8_t>(kTypeRangeDeletion));
 }
 
 // A helper class useful for DBImpl::Get()
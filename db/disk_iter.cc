@@ -5,30 +5,34 @@
 #include "table/iterator_wrapper.h"
 #include "trees/vanilla_b_plus_tree.h"
 #include "db/dbformat.h"
-#include "db/dbformat.h"
 #include <unordered_map>
 
 namespace leveldb {
 namespace{
+//B+树记录每个user key最新版本所在的run（以L0编号表示），
+//DiskIterator按B+树中的key顺序，只从该run的迭代器中取出这个key的所有条目。
+//B+树中值为0（被范围删除屏蔽）或找不到对应run的key会被跳过。
 class DiskIterator : public Iterator {
  public:
-  DiskIterator(const Comparator* comparator, Iterator** children, int n, VanillaBPlusTree<std::string, uint64_t>* btree, 
-                const std::unordered_map<uint64_t, int>* index_map)
+  DiskIterator(const Comparator* comparator, Iterator** children, int n, VanillaBPlusTree<std::string, uint64_t>* btree,
+                const std::unordered_map<uint64_t, int>* index_map,
+                const Slice* lower_bound, const Slice* upper_bound)
     :comparator_(comparator),
     children_(new IteratorWrapper[n]),
     n_(n),
-    current_(nullptr),
-    direction_(kForward),
     btree_(btree),
-    index_map_(index_map){
+    index_map_(index_map),
+    lower_bound_(lower_bound),
+    upper_bound_(upper_bound),
+    current_(nullptr){
     for (int i = 0; i < n; i++) {
       children_[i].Set(children[i]);
     }
     btree_iter_ = btree->NewTreeIterator();
   }
 
-  ~DiskIterator() override { 
-    delete[] children_; 
+  ~DiskIterator() override {
+    delete[] children_;
     delete btree_iter_;
     delete index_map_;
   }
@@ -36,158 +40,72 @@ class DiskIterator : public Iterator {
   bool Valid() const override { return (current_ != nullptr); }
 
   void SeekToFirst() override{
-    for (int i = 0; i < n_; i++) {
-      children_[i].SeekToFirst();
-    }      
-    uint64_t run_no;
-    int index;
-    btree_iter_->SeekToFirst();
-    run_no = btree_iter_->Value();
-    //index_map_记录run的id为run_no的run此时在children_中的索引
-    auto iter = index_map_->find(run_no);
-    while(iter == index_map_->end()){
-      btree_iter_->Next();
-      run_no = btree_iter_->Value();
-      iter = index_map_->find(run_no);
+    if (lower_bound_ != nullptr) {
+      btree_iter_->Seek(lower_bound_->ToString());
+    } else {
+      btree_iter_->SeekToFirst();
     }
-    index = iter->second;
-    current_ = &children_[index];
-    //direction_ = kForward;        
+    FindNextEntry();
   }
 
   void SeekToLast() override{
-    for (int i = 0; i < n_; i++) {
-      children_[i].SeekToLast();
-    }      
-    uint64_t run_no;
-    int index;
-    btree_iter_->SeekToLast();
-    run_no = btree_iter_->Value();
-    auto iter = index_map_->find(run_no);
-    while(iter == index_map_->end()){
-      btree_iter_->Prev();
-      run_no = btree_iter_->Value();
-      iter = index_map_->find(run_no);
+    if (upper_bound_ != nullptr) {
+      //上界之前的最后一个key
+      btree_iter_->Seek(upper_bound_->ToString());
+      if (btree_iter_->Valid()) {
+        btree_iter_->Prev();
+      } else {
+        btree_iter_->SeekToLast();
+      }
+    } else {
+      btree_iter_->SeekToLast();
     }
-    index = iter->second;
-    current_ = &children_[index];
-  }        
+    FindPrevEntry();
+  }
 
   void Seek(const Slice& target) override{
-    for (int i = 0; i < n_; i++) {
-      children_[i].Seek(target);
-    }
-    uint64_t run_no;
-    int index;
-    btree_iter_->Seek(target.ToString());
-    run_no = btree_iter_->Value();
-    const auto iter = index_map_->find(run_no);
-    if(iter != index_map_->end()){
-      index = iter->second;
-      current_ = &children_[index];
+    Slice user_key = ExtractUserKey(target);
+    if (upper_bound_ != nullptr && user_key.compare(*upper_bound_) >= 0) {
+      current_ = nullptr;
+      return;
+    }
+    btree_iter_->Seek(user_key.ToString());
+    if (btree_iter_->Valid() && Slice(btree_iter_->Key()) == user_key) {
+      //target本身的user key：定位到该key中seq<=target的第一个条目
+      IteratorWrapper* child = ChildForCurrentKey();
+      if (child != nullptr) {
+        child->Seek(target);
+        if (child->Valid() && ExtractUserKey(child->key()) == user_key) {
+          current_ = child;
+          return;
+        }
+      }
+      btree_iter_->Next();
     }
-    //direction_ = kForward;          
+    FindNextEntry();
   }
 
   void Next() override{
-  //children_的初始化问题？
-    if(!btree_iter_->GetForward()){
-      btree_iter_->SetForward(true);
+    assert(Valid());
+    current_->Next();
+    if (current_->Valid() &&
+        ExtractUserKey(current_->key()) == Slice(btree_iter_->Key())) {
+      return;
     }
-    uint64_t run_no;
-    int index;
     btree_iter_->Next();
-    run_no = btree_iter_->Value();
-    auto iter = index_map_->find(run_no);
-    while(iter == index_map_->end()){
-    //std::cout<<"yes"<<std::endl;
-      btree_iter_->Next();
-      run_no = btree_iter_->Value();
-      iter = index_map_->find(run_no);
-    }
-    index = iter->second;
-    ParsedInternalKey ikey;
-    ParseInternalKey(children_[index].key(), &ikey);
-    /*for(const auto index : *index_map_){
-    std::cout<<index.first<<" "<<index.second<<std::endl;
-    }*/
-    /*btree_iter_->SeekToFirst();
-    int read = 100;
-    while(read>=0){
-      std::cout<<"btree:"<<btree_iter_->Key()<<" "<<btree_iter_->Value()<<std::endl;
-      btree_iter_->Next();
-      read--;
-    }
-    std::cout<<btree_iter_->Key()<<std::endl;*/
-    while(btree_iter_->Key() != ikey.user_key.ToString()){
-      //std::cout<<"1"<<std::endl;
-      //std::cout<<btree_iter_->Key()<<" "<<ikey.user_key.ToString()<<std::endl;
-      children_[index].Next();
-      ParseInternalKey(children_[index].key(), &ikey);
-    }
-    current_ = &children_[index];
-    if(!btree_iter_->Valid()){
-      current_ = nullptr;
-    }
-  }        
+    FindNextEntry();
+  }
 
   void Prev() override{
-  //children_的初始化问题？
-    if(btree_iter_->GetForward()){
-      btree_iter_->SetForward(false);
+    assert(Valid());
+    current_->Prev();
+    if (current_->Valid() &&
+        ExtractUserKey(current_->key()) == Slice(btree_iter_->Key())) {
+      return;
     }
-    uint64_t run_no;
-    int index;
     btree_iter_->Prev();
-    run_no = btree_iter_->Value();
-    auto iter = index_map_->find(run_no);
-    while(iter == index_map_->end()){
-    //std::cout<<"yes"<<std::endl;
-      btree_iter_->Prev();
-      run_no = btree_iter_->Value();
-      iter = index_map_->find(run_no);
-    }
-    index = iter->second;
-    ParsedInternalKey ikey;
-    ParseInternalKey(children_[index].key(), &ikey);
-    /*for(const auto index : *index_map_){
-    std::cout<<index.first<<" "<<index.second<<std::endl;
-    }*/
-    /*btree_iter_->SeekToFirst();
-    int read = 100;
-    while(read>=0){
-      std::cout<<"btree:"<<btree_iter_->Key()<<" "<<btree_iter_->Value()<<std::endl;
-      btree_iter_->Next();
-      read--;
-    }
-    std::cout<<btree_iter_->Key()<<std::endl;*/
-    while(btree_iter_->Key() != ikey.user_key.ToString()){
-      //std::cout<<"1"<<std::endl;
-      //std::cout<<btree_iter_->Key()<<" "<<ikey.user_key.ToString()<<std::endl;
-      children_[index].Prev();
-      ParseInternalKey(children_[index].key(), &ikey);
-    }
-    bool roll_back = true;
-    int i = 0;
-    while(btree_iter_->Key() == ikey.user_key.ToString()){
-      children_[index].Prev();
-      if(!children_[index].Valid()){
-        //std::cout<<"wait.."<<i<<std::endl;
-        i++;
-        children_[index].SeekToFirst();
-        roll_back = false;
-        break;
-      }
-      ParseInternalKey(children_[index].key(), &ikey);      
-    }
-    if(roll_back){
-      children_[index].Next();
-    }
-    current_ = &children_[index];
-    if(!btree_iter_->Valid()){
-      current_ = nullptr;
-    }
-  }        
+    FindPrevEntry();
+  }
 
   Slice key() const override{
     assert(Valid());
@@ -208,31 +126,92 @@ class DiskIterator : public Iterator {
         }
     }
     return status;
-  }    
+  }
 
  private:
-  enum Direction { kForward, kReverse }; 
+  //B+树当前key所在run的迭代器；run不在本Version中时返回nullptr
+  IteratorWrapper* ChildForCurrentKey() {
+    auto iter = index_map_->find(btree_iter_->Value());
+    if (iter == index_map_->end()) {
+      return nullptr;
+    }
+    return &children_[iter->second];
+  }
+
+  //从B+树当前位置向后，找到第一个能在对应run中找到的key，定位到它最新的条目
+  void FindNextEntry() {
+    for (; btree_iter_->Valid(); btree_iter_->Next()) {
+      //B+树按字节序排列，越过上界后不会再有范围内的key
+      if (upper_bound_ != nullptr &&
+          Slice(btree_iter_->Key()).compare(*upper_bound_) >= 0) {
+        break;
+      }
+      IteratorWrapper* child = ChildForCurrentKey();
+      if (child == nullptr) {
+        continue;
+      }
+      const std::string user_key = btree_iter_->Key();
+      child->Seek(InternalKey(user_key, kMaxSequenceNumber, kValueTypeForSeek)
+                      .Encode());
+      if (child->Valid() && ExtractUserKey(child->key()) == Slice(user_key)) {
+        current_ = child;
+        return;
+      }
+    }
+    current_ = nullptr;
+  }
+
+  //从B+树当前位置向前，找到第一个能在对应run中找到的key，定位到它最旧的条目
+  void FindPrevEntry() {
+    for (; btree_iter_->Valid(); btree_iter_->Prev()) {
+      if (lower_bound_ != nullptr &&
+          Slice(btree_iter_->Key()).compare(*lower_bound_) < 0) {
+        break;
+      }
+      IteratorWrapper* child = ChildForCurrentKey();
+      if (child == nullptr) {
+        continue;
+      }
+      const std::string user_key = btree_iter_->Key();
+      //(user_key, 0, kTypeDeletion)是user_key可能的最后一个条目
+      child->Seek(InternalKey(user_key, 0, kTypeDeletion).Encode());
+      if (!child->Valid()) {
+        child->SeekToLast();
+      } else if (ExtractUserKey(child->key()) != Slice(user_key)) {
+        child->Prev();
+      }
+      if (child->Valid() && ExtractUserKey(child->key()) == Slice(user_key)) {
+        current_ = child;
+        return;
+      }
+    }
+    current_ = nullptr;
+  }
+
   const Comparator* comparator_;
   IteratorWrapper* children_;
   int n_;
   BTree<std::string, uint64_t>::Iterator* btree_iter_;
   VanillaBPlusTree<std::string, uint64_t>* btree_;
   const std::unordered_map<uint64_t, int>* index_map_; //x号run对应的迭代器在child[y]中
+  const Slice* const lower_bound_;  //可为空
+  const Slice* const upper_bound_;  //可为空
   IteratorWrapper* current_;
-  Direction direction_;    
 };
 
 }
 
 Iterator* NewDiskIterator(const Comparator* comparator, Iterator** children,
-                             int n, VanillaBPlusTree<std::string, uint64_t>* btree, const std::unordered_map<uint64_t, int>* index_map){
+                             int n, VanillaBPlusTree<std::string, uint64_t>* btree, const std::unordered_map<uint64_t, int>* index_map,
+                             const Slice* lower_bound, const Slice* upper_bound){
   assert(n >= 0);
   if (n == 0) {
+    delete index_map;
     return NewEmptyIterator();
-  } else if (n == 1) {
-    return children[0];
   } else {
-    return new DiskIterator(comparator, children, n, btree, index_map);
+    //只有一个run时也需要经过B+树，以跳过被范围删除屏蔽的key
+    return new DiskIterator(comparator, children, n, btree, index_map,
+                            lower_bound, upper_bound);
   }
 }
-}
\ No newline at end of file
+}
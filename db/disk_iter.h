@@ -9,9 +9,13 @@ namespace leveldb {
 
 class Comparator;
 class Iterator;
+class Slice;
 
+//lower_bound/upper_bound非空时只返回[*lower_bound, *upper_bound)内的user key
 Iterator* NewDiskIterator(const Comparator* comparator, Iterator** children,
                              int n, VanillaBPlusTree<std::string, uint64_t>* btree, 
-                             const std::unordered_map<uint64_t, int>* index_map_);
+                             const std::unordered_map<uint64_t, int>* index_map_,
+                             const Slice* lower_bound = nullptr,
+                             const Slice* upper_bound = nullptr);
 }
 #endif
\ No newline at end of file
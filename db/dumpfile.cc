@@ -88,6 +88,14 @@ class WriteBatchItemPrinter : public WriteBatch::Handler {
     r += "'\n";
     dst_->Append(r);
   }
+  void DeleteRange(const Slice& begin_key, const Slice& end_key) override {
+    std::string r = "  delrange '";
+    AppendEscapedStringTo(&r, begin_key);
+    r += "' '";
+    AppendEscapedStringTo(&r, end_key);
+    r += "'\n";
+    dst_->Append(r);
+  }
 
   WritableFile* dst_;
 };
@@ -0,0 +1,234 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "db/dbformat.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+namespace {
+
+// Holds back the creation of table files while block_tables is set, so
+// that sealed memtables pile up in the flush queue.
+class BlockTableEnv : public EnvWrapper {
+ public:
+  explicit BlockTableEnv(Env* base) : EnvWrapper(base), block_tables(false) {}
+
+  Status NewWritableFile(const std::string& fname,
+                         WritableFile** result) override {
+    if (fname.size() > 4 && fname.compare(fname.size() - 4, 4, ".ldb") == 0) {
+      while (block_tables.load(std::memory_order_acquire)) {
+        target()->SleepForMicroseconds(1000);
+      }
+    }
+    return target()->NewWritableFile(fname, result);
+  }
+
+  std::atomic<bool> block_tables;
+};
+
+}  // namespace
+
+class FlushTest : public testing::Test {
+ public:
+  FlushTest() : env_(Env::Default()), db_(nullptr), writes_(0) {
+    dbname_ = testing::TempDir() + "flush_test";
+    options_.env = &env_;
+    options_.create_if_missing = true;
+    options_.write_buffer_size = 64 << 10;
+    DestroyDB(dbname_, options_);
+  }
+
+  ~FlushTest() {
+    env_.block_tables.store(false, std::memory_order_release);
+    delete db_;
+    DestroyDB(dbname_, options_);
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  void Reopen() {
+    delete db_;
+    db_ = nullptr;
+    ASSERT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  int NumRunsAtLevel(int level) {
+    std::string property;
+    EXPECT_TRUE(db_->GetProperty(
+        "leveldb.num-runs-at-level" + std::to_string(level), &property));
+    return std::stoi(property);
+  }
+
+  int NumImmutableMemTables() {
+    std::string property;
+    EXPECT_TRUE(db_->GetProperty("leveldb.num-immutable-mem-table", &property));
+    return std::stoi(property);
+  }
+
+  // Wait until the flush thread has emptied the queue.
+  void WaitForFlush() {
+    for (int i = 0; i < 1000 && NumImmutableMemTables() > 0; i++) {
+      env_.SleepForMicroseconds(10000);
+    }
+    ASSERT_EQ(0, NumImmutableMemTables());
+  }
+
+  // Overwrite keys round robin until "imms" memtables wait to be flushed.
+  void FillImmutableMemTables(int imms,
+                              std::map<std::string, std::string>* model) {
+    for (int i = 0; NumImmutableMemTables() < imms; i++, writes_++) {
+      ASSERT_LT(i, 100000);
+      const std::string key = Key(writes_ % 300);
+      std::string value = key + "." + std::to_string(writes_);
+      value.resize(1000, 'x');
+      ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), key, value));
+      (*model)[key] = value;
+    }
+  }
+
+  // Every key of "model" resolves through Get and both iterator directions.
+  void CheckContents(const std::map<std::string, std::string>& model,
+                     const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    for (const auto& kv : model) {
+      std::string value;
+      ASSERT_LEVELDB_OK(db_->Get(options, kv.first, &value));
+      ASSERT_EQ(kv.second, value);
+    }
+    Iterator* iter = db_->NewIterator(options);
+    auto expected = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+      ASSERT_TRUE(expected != model.end());
+      ASSERT_EQ(expected->first, iter->key().ToString());
+      ASSERT_EQ(expected->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(expected == model.end());
+    auto rexpected = model.rbegin();
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rexpected) {
+      ASSERT_TRUE(rexpected != model.rend());
+      ASSERT_EQ(rexpected->first, iter->key().ToString());
+    }
+    ASSERT_TRUE(rexpected == model.rend());
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+  }
+
+  static std::string Key(int i) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+ protected:
+  BlockTableEnv env_;
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+  int writes_;  // Puts issued by FillImmutableMemTables()
+};
+
+// 多个immutable memtable排队等待flush时，读要按从新到旧的顺序看到它们；
+// flush逐个完成，重启时从日志恢复还没有flush的部分
+TEST_F(FlushTest, SeveralImmutableMemTables) {
+  options_.max_write_buffer_number = 4;
+  Reopen();
+  std::map<std::string, std::string> model;
+
+  // Every memtable overwrites the keys of the previous ones
+  env_.block_tables.store(true, std::memory_order_release);
+  FillImmutableMemTables(options_.max_write_buffer_number - 1, &model);
+  CheckContents(model);
+
+  // Reads keep going while the queue drains
+  std::atomic<bool> done(false);
+  std::atomic<int> failures(0);
+  const std::map<std::string, std::string> frozen = model;
+  std::thread reader([&]() {
+    while (!done.load(std::memory_order_acquire)) {
+      for (const auto& kv : frozen) {
+        std::string value;
+        if (!db_->Get(ReadOptions(), kv.first, &value).ok() ||
+            value != kv.second) {
+          failures.fetch_add(1);
+        }
+      }
+    }
+  });
+  env_.block_tables.store(false, std::memory_order_release);
+  WaitForFlush();
+  done.store(true, std::memory_order_release);
+  reader.join();
+  ASSERT_EQ(0, failures.load());
+  CheckContents(model);
+
+  Reopen();
+  CheckContents(model);
+
+  // Close while the queue is full: the memtables not flushed yet are
+  // recovered from their logs
+  env_.block_tables.store(true, std::memory_order_release);
+  FillImmutableMemTables(options_.max_write_buffer_number - 1, &model);
+  env_.block_tables.store(false, std::memory_order_release);
+  Reopen();
+  CheckContents(model);
+  WaitForFlush();
+  Reopen();
+  CheckContents(model);
+}
+
+// 两个memtable合并flush为一个L0 run：被覆盖的旧版本只在有快照需要时保留
+TEST_F(FlushTest, MergedFlush) {
+  options_.max_write_buffer_number = 4;
+  options_.min_write_buffer_number_to_merge = 2;
+  Reopen();
+  std::map<std::string, std::string> model;
+
+  // The second memtable overwrites keys of the first one, some of them
+  // after the snapshot was taken
+  env_.block_tables.store(true, std::memory_order_release);
+  FillImmutableMemTables(1, &model);
+  const Snapshot* snapshot = db_->GetSnapshot();
+  const std::map<std::string, std::string> snapshot_model = model;
+  FillImmutableMemTables(2, &model);
+  CheckContents(model);
+  CheckContents(snapshot_model, snapshot);
+
+  // Both are written to a single table
+  env_.block_tables.store(false, std::memory_order_release);
+  WaitForFlush();
+  ASSERT_EQ(1, NumRunsAtLevel(0));
+  CheckContents(model);
+  CheckContents(snapshot_model, snapshot);
+  db_->ReleaseSnapshot(snapshot);
+
+  // A single sealed memtable waits for a second one
+  FillImmutableMemTables(1, &model);
+  env_.SleepForMicroseconds(100000);
+  ASSERT_EQ(1, NumImmutableMemTables());
+  ASSERT_EQ(1, NumRunsAtLevel(0));
+  CheckContents(model);
+  FillImmutableMemTables(2, &model);
+  WaitForFlush();
+  ASSERT_EQ(2, NumRunsAtLevel(0));
+  CheckContents(model);
+
+  Reopen();
+  CheckContents(model);
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  Reopen();
+  CheckContents(model);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,298 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "db/filename.h"
+#include "leveldb/comparator.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "leveldb/table_builder.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+namespace {
+
+typedef std::vector<std::pair<std::string, std::string>> KVs;
+
+// Orders keys backwards, to write a table whose keys are not increasing
+// under the database's comparator.
+class ReverseComparator : public Comparator {
+ public:
+  const char* Name() const override { return "leveldb.ReverseComparator"; }
+
+  int Compare(const Slice& a, const Slice& b) const override {
+    return BytewiseComparator()->Compare(b, a);
+  }
+
+  void FindShortestSeparator(std::string* start,
+                             const Slice& limit) const override {}
+
+  void FindShortSuccessor(std::string* key) const override {}
+};
+
+}  // namespace
+
+class IngestTest : public testing::Test {
+ public:
+  IngestTest() : env_(Env::Default()), db_(nullptr) {
+    dbname_ = testing::TempDir() + "ingest_test";
+    options_.create_if_missing = true;
+    DestroyDB(dbname_, options_);
+    Reopen();
+  }
+
+  ~IngestTest() {
+    delete db_;
+    DestroyDB(dbname_, options_);
+    for (const std::string& fname : external_files_) {
+      env_->RemoveFile(fname);
+    }
+  }
+
+  void Reopen() {
+    delete db_;
+    db_ = nullptr;
+    ASSERT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  // Write "kvs", in the order given, to a new table file outside the
+  // database and return its name.
+  std::string WriteExternalFile(const KVs& kvs,
+                                const Comparator* cmp = BytewiseComparator()) {
+    const std::string fname = testing::TempDir() + "ingest_test_external" +
+                              std::to_string(external_files_.size()) + ".sst";
+    external_files_.push_back(fname);
+    Options options;
+    options.comparator = cmp;
+    WritableFile* file;
+    EXPECT_LEVELDB_OK(env_->NewWritableFile(fname, &file));
+    TableBuilder builder(options, file);
+    for (const auto& kv : kvs) {
+      builder.Add(kv.first, kv.second);
+    }
+    EXPECT_LEVELDB_OK(builder.Finish());
+    EXPECT_LEVELDB_OK(file->Close());
+    delete file;
+    return fname;
+  }
+
+  // Keys [begin, end) with values "prefix" + key, added to "model".
+  static KVs Range(int begin, int end, const std::string& prefix,
+                   std::map<std::string, std::string>* model) {
+    KVs kvs;
+    for (int i = begin; i < end; i++) {
+      kvs.emplace_back(Key(i), prefix + Key(i));
+      if (model != nullptr) {
+        (*model)[Key(i)] = prefix + Key(i);
+      }
+    }
+    return kvs;
+  }
+
+  int NumRunsAtLevel(int level) {
+    std::string property;
+    EXPECT_TRUE(db_->GetProperty(
+        "leveldb.num-runs-at-level" + std::to_string(level), &property));
+    return std::stoi(property);
+  }
+
+  int NumTableFiles() {
+    std::vector<std::string> children;
+    EXPECT_LEVELDB_OK(env_->GetChildren(dbname_, &children));
+    int tables = 0;
+    uint64_t number;
+    FileType type;
+    for (const std::string& child : children) {
+      if (ParseFileName(child, &number, &type) && type == kTableFile) {
+        tables++;
+      }
+    }
+    return tables;
+  }
+
+  void Put(std::map<std::string, std::string>* model, const std::string& k,
+           const std::string& v) {
+    ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), k, v));
+    (*model)[k] = v;
+  }
+
+  // Every key of "model" resolves through Get and both iterator directions.
+  void CheckContents(const std::map<std::string, std::string>& model) {
+    for (const auto& kv : model) {
+      std::string value;
+      ASSERT_LEVELDB_OK(db_->Get(ReadOptions(), kv.first, &value));
+      ASSERT_EQ(kv.second, value);
+    }
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    auto expected = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+      ASSERT_TRUE(expected != model.end());
+      ASSERT_EQ(expected->first, iter->key().ToString());
+      ASSERT_EQ(expected->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(expected == model.end());
+    auto rexpected = model.rbegin();
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rexpected) {
+      ASSERT_TRUE(rexpected != model.rend());
+      ASSERT_EQ(rexpected->first, iter->key().ToString());
+      ASSERT_EQ(rexpected->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(rexpected == model.rend());
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+  }
+
+  static std::string Key(int i) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+ protected:
+  Env* env_;
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+  std::vector<std::string> external_files_;
+};
+
+// 重叠的文件、key不严格递增的文件和空文件都被拒绝，数据库保持原样
+TEST_F(IngestTest, RejectsInvalidInput) {
+  std::map<std::string, std::string> model;
+  Put(&model, Key(5), "old");
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  Put(&model, Key(15), "old");
+  // An ingestion rejected while converting has already flushed the
+  // memtable, so start from an empty one
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  const int runs = NumRunsAtLevel(0);
+  const int tables = NumTableFiles();
+
+  // Two files sharing a key, and two files whose ranges interleave
+  const std::string a = WriteExternalFile(Range(0, 10, "a", nullptr));
+  const std::string b = WriteExternalFile(Range(9, 20, "b", nullptr));
+  Status s = db_->IngestExternalFiles({a, b});
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  KVs even, odd;
+  for (int i = 0; i < 10; i++) {
+    (i % 2 == 0 ? even : odd).emplace_back(Key(i), "v");
+  }
+  s = db_->IngestExternalFiles(
+      {WriteExternalFile(odd), WriteExternalFile(even)});
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+
+  // A file whose keys decrease
+  KVs reversed = Range(0, 10, "r", nullptr);
+  std::reverse(reversed.begin(), reversed.end());
+  ReverseComparator reverse;
+  s = db_->IngestExternalFiles({WriteExternalFile(reversed, &reverse)});
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+
+  // An empty file, and one that does not exist
+  s = db_->IngestExternalFiles({WriteExternalFile(KVs())});
+  ASSERT_TRUE(!s.ok());
+  s = db_->IngestExternalFiles({testing::TempDir() + "ingest_test_missing"});
+  ASSERT_TRUE(!s.ok());
+
+  // Nothing was added, and the partly converted table was removed
+  ASSERT_EQ(runs, NumRunsAtLevel(0));
+  ASSERT_EQ(tables, NumTableFiles());
+  CheckContents(model);
+
+  // The database still takes writes and valid ingestions
+  Put(&model, Key(16), "mem");
+  ASSERT_LEVELDB_OK(db_->IngestExternalFiles({a}));
+  Range(0, 10, "a", &model);
+  CheckContents(model);
+}
+
+// 导入的数据比memtable和磁盘上的所有条目都新，之后的写又比它新
+TEST_F(IngestTest, NewerThanMemTable) {
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 100; i += 2) {
+    Put(&model, Key(i), "disk");
+  }
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  for (int i = 0; i < 100; i += 3) {
+    Put(&model, Key(i), "mem");
+  }
+  const Snapshot* snapshot = db_->GetSnapshot();
+  Put(&model, Key(1000), "mem");
+
+  // Overwrites keys on disk, keys in the memtable, and keys of both
+  ASSERT_LEVELDB_OK(db_->IngestExternalFiles(
+      {WriteExternalFile(Range(0, 50, "ingested", &model))}));
+  CheckContents(model);
+
+  // The snapshot taken before the ingestion does not see the new keys
+  ReadOptions options;
+  options.snapshot = snapshot;
+  std::string value;
+  ASSERT_TRUE(db_->Get(options, Key(1), &value).IsNotFound());
+  db_->ReleaseSnapshot(snapshot);
+
+  // Writes after the ingestion win over it, in memory and once flushed
+  Put(&model, Key(4), "after");
+  Put(&model, Key(7), "after");
+  CheckContents(model);
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  CheckContents(model);
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  CheckContents(model);
+}
+
+// 多个文件按key顺序组成一个L0 run，传入的顺序无关紧要；
+// 重启后run和B+树都从MANIFEST恢复
+TEST_F(IngestTest, MultiFileRunSurvivesReopen) {
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 300; i++) {
+    Put(&model, Key(i), "old");
+  }
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(1, NumRunsAtLevel(0));
+  Put(&model, Key(150), "mem");
+
+  // Given out of order, with a gap between the second and the third file
+  const std::string first = WriteExternalFile(Range(0, 100, "f", &model));
+  const std::string second = WriteExternalFile(Range(100, 200, "s", &model));
+  const std::string third = WriteExternalFile(Range(250, 400, "t", &model));
+  const int tables = NumTableFiles();
+  ASSERT_LEVELDB_OK(db_->IngestExternalFiles({third, first, second}));
+  // One run holding the three files, and the flushed memtable
+  ASSERT_EQ(3, NumRunsAtLevel(0));
+  ASSERT_EQ(tables + 4, NumTableFiles());
+  CheckContents(model);
+
+  // The originals are left in place
+  ASSERT_TRUE(env_->FileExists(first));
+  ASSERT_TRUE(env_->FileExists(third));
+
+  Reopen();
+  ASSERT_EQ(3, NumRunsAtLevel(0));
+  CheckContents(model);
+
+  // The sequence number of the ingested run is not reused
+  Put(&model, Key(50), "after reopen");
+  Put(&model, Key(260), "after reopen");
+  CheckContents(model);
+  Reopen();
+  CheckContents(model);
+
+  db_->CompactRange(nullptr, nullptr);
+  CheckContents(model);
+  Reopen();
+  CheckContents(model);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,292 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <set>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "db/dbformat.h"
+#include "leveldb/cache.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+namespace {
+
+// Records which table files are read from.
+class ReadCountingEnv : public EnvWrapper {
+ public:
+  explicit ReadCountingEnv(Env* base) : EnvWrapper(base) {}
+
+  Status NewRandomAccessFile(const std::string& fname,
+                             RandomAccessFile** result) override {
+    Status s = target()->NewRandomAccessFile(fname, result);
+    if (s.ok()) {
+      *result = new CountingFile(this, fname, *result);
+    }
+    return s;
+  }
+
+  void ClearReads() {
+    MutexLock l(&mu_);
+    files_read_.clear();
+  }
+
+  // Number of distinct files read since the last ClearReads().
+  size_t FilesRead() {
+    MutexLock l(&mu_);
+    return files_read_.size();
+  }
+
+ private:
+  class CountingFile : public RandomAccessFile {
+   public:
+    CountingFile(ReadCountingEnv* env, const std::string& fname,
+                 RandomAccessFile* target)
+        : env_(env), fname_(fname), target_(target) {}
+    ~CountingFile() override { delete target_; }
+
+    Status Read(uint64_t offset, size_t n, Slice* result,
+                char* scratch) const override {
+      env_->RecordRead(fname_);
+      return target_->Read(offset, n, result, scratch);
+    }
+
+   private:
+    ReadCountingEnv* const env_;
+    const std::string fname_;
+    RandomAccessFile* const target_;
+  };
+
+  void RecordRead(const std::string& fname) {
+    MutexLock l(&mu_);
+    files_read_.insert(fname);
+  }
+
+  port::Mutex mu_;
+  std::set<std::string> files_read_ GUARDED_BY(mu_);
+};
+
+}  // namespace
+
+class IteratorBoundsTest : public testing::Test {
+ public:
+  IteratorBoundsTest()
+      : env_(Env::Default()), cache_(NewLRUCache(0)), db_(nullptr) {
+    dbname_ = testing::TempDir() + "iterator_bounds_test";
+    options_.env = &env_;
+    options_.create_if_missing = true;
+    options_.compression = kNoCompression;
+    // Every block read goes to the file
+    options_.block_cache = cache_;
+    DestroyDB(dbname_, options_);
+    EXPECT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  ~IteratorBoundsTest() {
+    delete db_;
+    DestroyDB(dbname_, options_);
+    delete cache_;
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  Status Put(const std::string& k, const std::string& v) {
+    return db_->Put(WriteOptions(), k, v);
+  }
+
+  int NumRunsAtLevel(int level) {
+    std::string property;
+    EXPECT_TRUE(db_->GetProperty(
+        "leveldb.num-runs-at-level" + std::to_string(level), &property));
+    return std::stoi(property);
+  }
+
+  Iterator* NewBoundedIterator(const Slice* lower, const Slice* upper) {
+    ReadOptions options;
+    options.iterate_lower_bound = lower;
+    options.iterate_upper_bound = upper;
+    return db_->NewIterator(options);
+  }
+
+  static std::string Key(int i) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+ protected:
+  ReadCountingEnv env_;
+  Cache* cache_;
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+};
+
+TEST_F(IteratorBoundsTest, Positioning) {
+  // Keys on disk and in the memtable, on both sides of both bounds
+  for (char c : std::string("acegikm")) {
+    ASSERT_LEVELDB_OK(Put(std::string(1, c), "disk"));
+  }
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  for (char c : std::string("bdfhjln")) {
+    ASSERT_LEVELDB_OK(Put(std::string(1, c), "mem"));
+  }
+
+  const Slice lower("c");
+  const Slice upper("j");
+  Iterator* iter = NewBoundedIterator(&lower, &upper);
+  std::string keys;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    keys += iter->key().ToString();
+  }
+  ASSERT_EQ("cdefghi", keys);
+  keys.clear();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    keys += iter->key().ToString();
+  }
+  ASSERT_EQ("ihgfedc", keys);
+
+  // Seek clamps to the lower bound, and finds nothing at the upper bound
+  iter->Seek("a");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("c", iter->key().ToString());
+  iter->Seek("e");
+  ASSERT_EQ("e", iter->key().ToString());
+  iter->Seek("j");
+  ASSERT_TRUE(!iter->Valid());
+  iter->Seek("z");
+  ASSERT_TRUE(!iter->Valid());
+
+  // Stepping over either bound ends the iteration
+  iter->Seek("c");
+  iter->Prev();
+  ASSERT_TRUE(!iter->Valid());
+  iter->SeekToLast();
+  ASSERT_EQ("i", iter->key().ToString());
+  iter->Next();
+  ASSERT_TRUE(!iter->Valid());
+
+  // Changing direction at a bound
+  iter->SeekToFirst();
+  iter->Next();
+  iter->Prev();
+  ASSERT_EQ("c", iter->key().ToString());
+  iter->SeekToLast();
+  iter->Prev();
+  iter->Next();
+  ASSERT_EQ("i", iter->key().ToString());
+  ASSERT_LEVELDB_OK(iter->status());
+  delete iter;
+
+  // One bound only, and an empty range
+  iter = NewBoundedIterator(nullptr, &lower);
+  iter->SeekToLast();
+  ASSERT_EQ("b", iter->key().ToString());
+  iter->SeekToFirst();
+  ASSERT_EQ("a", iter->key().ToString());
+  delete iter;
+  iter = NewBoundedIterator(&upper, nullptr);
+  iter->SeekToFirst();
+  ASSERT_EQ("j", iter->key().ToString());
+  iter->SeekToLast();
+  ASSERT_EQ("n", iter->key().ToString());
+  delete iter;
+  iter = NewBoundedIterator(&upper, &lower);
+  iter->SeekToFirst();
+  ASSERT_TRUE(!iter->Valid());
+  iter->SeekToLast();
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+}
+
+// 完全落在范围之外的run不会被打开，也不会被读取
+TEST_F(IteratorBoundsTest, RunsOutsideBoundsAreSkipped) {
+  const std::string prefixes = "amz";
+  ASSERT_LT(static_cast<int>(prefixes.size()), config::kTieredTrigger);
+  for (char p : prefixes) {
+    for (int i = 0; i < 100; i++) {
+      ASSERT_LEVELDB_OK(Put(p + Key(i), std::string(100, p)));
+    }
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ(static_cast<int>(prefixes.size()), NumRunsAtLevel(0));
+
+  const Slice lower("m");
+  const Slice upper("n");
+  Iterator* iter = NewBoundedIterator(&lower, &upper);
+  env_.ClearReads();
+  int n = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), n++) {
+    ASSERT_EQ('m', iter->key()[0]);
+  }
+  ASSERT_EQ(100, n);
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), n--) {
+    ASSERT_EQ('m', iter->key()[0]);
+  }
+  ASSERT_EQ(0, n);
+  iter->Seek("a");
+  ASSERT_EQ("m" + Key(0), iter->key().ToString());
+  ASSERT_LEVELDB_OK(iter->status());
+  ASSERT_EQ(1, env_.FilesRead());
+  delete iter;
+
+  // A range between two runs reads none of them
+  const Slice gap_lower("b");
+  const Slice gap_upper("l");
+  iter = NewBoundedIterator(&gap_lower, &gap_upper);
+  env_.ClearReads();
+  iter->SeekToFirst();
+  ASSERT_TRUE(!iter->Valid());
+  iter->SeekToLast();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_EQ(0, env_.FilesRead());
+  delete iter;
+}
+
+// 一层中有多个相互重叠的run时，估算大小要把每个run都算上
+TEST_F(IteratorBoundsTest, ApproximateSizesOverRuns) {
+  const int kNumKeys = 1200;
+  const int kFlushes = 20;
+  const int kValueSize = 1000;
+  Random rnd(301);
+  for (int f = 0; f < kFlushes; f++) {
+    // Each run spans the whole key range
+    for (int i = f; i < kNumKeys; i += kFlushes) {
+      std::string value;
+      test::RandomString(&rnd, kValueSize, &value);
+      ASSERT_LEVELDB_OK(Put(Key(i), value));
+    }
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+    // Two runs at level-1, the last flushes left at level-0
+    if (f == 7 || f == 15) {
+      dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+    }
+  }
+  ASSERT_EQ(4, NumRunsAtLevel(0));
+  ASSERT_EQ(2, NumRunsAtLevel(1));
+
+  const uint64_t total = static_cast<uint64_t>(kNumKeys) * kValueSize;
+  Range ranges[4] = {Range(Key(0), Key(kNumKeys)),
+                     Range(Key(0), Key(kNumKeys / 2)),
+                     Range(Key(kNumKeys / 4), Key(kNumKeys * 3 / 4)),
+                     Range(Key(kNumKeys * 2), Key(kNumKeys * 3))};
+  uint64_t sizes[4];
+  db_->GetApproximateSizes(ranges, 4, sizes);
+  ASSERT_GE(sizes[0], total);
+  ASSERT_LE(sizes[0], total * 11 / 10);
+  for (int i = 1; i <= 2; i++) {
+    ASSERT_GE(sizes[i], total / 2 * 9 / 10) << i;
+    ASSERT_LE(sizes[i], total / 2 * 11 / 10) << i;
+  }
+  ASSERT_EQ(0, sizes[3]);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,126 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/l0_run_map.h"
+
+#include <cassert>
+
+namespace leveldb {
+
+// Inner nodes keep Node* children in their slots, leaves SortedRun*.
+struct L0RunMap::Node {
+  Node* child(int i) const { return static_cast<Node*>(slot[i]); }
+  SortedRun* run(int i) const { return static_cast<SortedRun*>(slot[i]); }
+
+  int refs;
+  void* slot[kWidth];
+};
+
+L0RunMap::Node* L0RunMap::NewNode() {
+  Node* node = new Node;
+  node->refs = 1;
+  for (int i = 0; i < kWidth; i++) {
+    node->slot[i] = nullptr;
+  }
+  return node;
+}
+
+L0RunMap::Node* L0RunMap::CopyNode(const Node* node, int height) {
+  Node* copy = new Node;
+  copy->refs = 1;
+  for (int i = 0; i < kWidth; i++) {
+    copy->slot[i] = node->slot[i];
+    if (height > 1 && node->slot[i] != nullptr) {
+      node->child(i)->refs++;
+    }
+  }
+  return copy;
+}
+
+L0RunMap::Node* L0RunMap::Exclusive(Node* node, int height) {
+  if (node == nullptr) {
+    return NewNode();
+  }
+  if (node->refs > 1) {
+    node->refs--;
+    return CopyNode(node, height);
+  }
+  return node;
+}
+
+void L0RunMap::Unref(Node* node, int height) {
+  if (node == nullptr) {
+    return;
+  }
+  assert(node->refs > 0);
+  if (--node->refs == 0) {
+    if (height > 1) {
+      for (int i = 0; i < kWidth; i++) {
+        Unref(node->child(i), height - 1);
+      }
+    }
+    delete node;
+  }
+}
+
+L0RunMap::L0RunMap() : root_(nullptr), height_(1) {}
+
+L0RunMap::L0RunMap(const L0RunMap& other)
+    : root_(other.root_), height_(other.height_) {
+  if (root_ != nullptr) {
+    root_->refs++;
+  }
+}
+
+L0RunMap& L0RunMap::operator=(const L0RunMap& other) {
+  if (other.root_ != nullptr) {
+    other.root_->refs++;
+  }
+  Unref(root_, height_);
+  root_ = other.root_;
+  height_ = other.height_;
+  return *this;
+}
+
+L0RunMap::~L0RunMap() { Unref(root_, height_); }
+
+SortedRun* L0RunMap::Get(uint64_t L0) const {
+  if (height_ * kBits < 64 && (L0 >> (height_ * kBits)) != 0) {
+    return nullptr;
+  }
+  const Node* node = root_;
+  for (int h = height_; node != nullptr; h--) {
+    const int slot = (L0 >> ((h - 1) * kBits)) & (kWidth - 1);
+    if (h == 1) {
+      return node->run(slot);
+    }
+    node = node->child(slot);
+  }
+  return nullptr;
+}
+
+void L0RunMap::Set(uint64_t L0, SortedRun* run) {
+  // Grow until the key fits; the old root becomes the leftmost child.
+  while (height_ * kBits < 64 && (L0 >> (height_ * kBits)) != 0) {
+    if (root_ != nullptr) {
+      Node* root = NewNode();
+      root->slot[0] = root_;
+      root_ = root;
+    }
+    height_++;
+  }
+
+  // Copy every node on the path that is shared with another map.
+  root_ = Exclusive(root_, height_);
+  Node* node = root_;
+  for (int h = height_; h > 1; h--) {
+    const int slot = (L0 >> ((h - 1) * kBits)) & (kWidth - 1);
+    Node* child = Exclusive(node->child(slot), h - 1);
+    node->slot[slot] = child;
+    node = child;
+  }
+  node->slot[L0 & (kWidth - 1)] = run;
+}
+
+}  // namespace leveldb
@@ -0,0 +1,58 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_L0_RUN_MAP_H_
+#define STORAGE_LEVELDB_DB_L0_RUN_MAP_H_
+
+#include <cstdint>
+
+namespace leveldb {
+
+class SortedRun;
+
+// L0RunMap maps an L0 file number to the run that holds its data now.
+// It is a persistent radix trie (32 children per node) keyed by file
+// number: copying a map shares all of its nodes, and Set() copies only
+// the nodes on the path to the key that are shared with another map.
+// Every Version keeps its own map, so installing a version costs
+// O(changed entries * depth) instead of a copy of the whole map.
+//
+// Nodes are reference counted without synchronization: maps must be
+// copied, modified and destroyed under the same external lock (the DB
+// mutex for Versions).  Get() may run concurrently with changes to
+// other maps.
+class L0RunMap {
+ public:
+  L0RunMap();
+  L0RunMap(const L0RunMap& other);
+  L0RunMap& operator=(const L0RunMap& other);
+  ~L0RunMap();
+
+  // Return the run of "L0", or nullptr if there is none.
+  SortedRun* Get(uint64_t L0) const;
+
+  // Point "L0" at "run".
+  void Set(uint64_t L0, SortedRun* run);
+
+ private:
+  static const int kBits = 5;
+  static const int kWidth = 1 << kBits;
+
+  struct Node;
+
+  static Node* NewNode();
+  static Node* CopyNode(const Node* node, int height);
+  // Return "node" if this map holds the only reference to it, else a copy
+  // (the copy takes over the reference).  Null becomes an empty node.
+  static Node* Exclusive(Node* node, int height);
+  static void Unref(Node* node, int height);
+
+  // Keys < 2^(kBits * height_) fit in the tree.  A leaf has height 1.
+  Node* root_;
+  int height_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_L0_RUN_MAP_H_
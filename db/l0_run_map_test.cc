@@ -0,0 +1,71 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/l0_run_map.h"
+
+#include "gtest/gtest.h"
+
+namespace leveldb {
+
+// Only the addresses are stored, any distinct pointers will do.
+static SortedRun* FakeRun(uintptr_t i) {
+  return reinterpret_cast<SortedRun*>(i * 8);
+}
+
+TEST(L0RunMapTest, Empty) {
+  L0RunMap map;
+  ASSERT_EQ(nullptr, map.Get(0));
+  ASSERT_EQ(nullptr, map.Get(7));
+  ASSERT_EQ(nullptr, map.Get(~uint64_t{0}));
+}
+
+TEST(L0RunMapTest, SetGet) {
+  L0RunMap map;
+  static const uint64_t kKeys[] = {1, 31, 32, 1000, 1 << 20, 1ull << 40,
+                                   ~uint64_t{0}};
+  for (size_t i = 0; i < sizeof(kKeys) / sizeof(kKeys[0]); i++) {
+    map.Set(kKeys[i], FakeRun(i + 1));
+  }
+  for (size_t i = 0; i < sizeof(kKeys) / sizeof(kKeys[0]); i++) {
+    ASSERT_EQ(FakeRun(i + 1), map.Get(kKeys[i]));
+  }
+  ASSERT_EQ(nullptr, map.Get(2));
+  ASSERT_EQ(nullptr, map.Get(33));
+  map.Set(1000, FakeRun(99));
+  ASSERT_EQ(FakeRun(99), map.Get(1000));
+}
+
+TEST(L0RunMapTest, CopiesAreIndependent) {
+  L0RunMap base;
+  for (uint64_t i = 1; i <= 2000; i++) {
+    base.Set(i, FakeRun(i));
+  }
+
+  L0RunMap next = base;
+  next.Set(5, FakeRun(5000));
+  next.Set(3000, FakeRun(3000));
+  next.Set(1ull << 33, FakeRun(7));
+
+  for (uint64_t i = 1; i <= 2000; i++) {
+    ASSERT_EQ(FakeRun(i), base.Get(i));
+    ASSERT_EQ(i == 5 ? FakeRun(5000) : FakeRun(i), next.Get(i));
+  }
+  ASSERT_EQ(nullptr, base.Get(3000));
+  ASSERT_EQ(FakeRun(3000), next.Get(3000));
+  ASSERT_EQ(nullptr, base.Get(1ull << 33));
+  ASSERT_EQ(FakeRun(7), next.Get(1ull << 33));
+
+  // Dropping the older map leaves the newer one intact, and vice versa.
+  {
+    L0RunMap tmp = next;
+    base = L0RunMap();
+    tmp.Set(6, FakeRun(6000));
+    ASSERT_EQ(FakeRun(6), next.Get(6));
+  }
+  for (uint64_t i = 1; i <= 2000; i++) {
+    ASSERT_EQ(i == 5 ? FakeRun(5000) : FakeRun(i), next.Get(i));
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,134 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <map>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "db/dbformat.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class LineageTest : public testing::Test {
+ public:
+  LineageTest() : db_(nullptr) {
+    dbname_ = testing::TempDir() + "lineage_test";
+    options_.create_if_missing = true;
+    DestroyDB(dbname_, options_);
+    Reopen();
+  }
+
+  ~LineageTest() {
+    delete db_;
+    DestroyDB(dbname_, options_);
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  void Reopen() {
+    delete db_;
+    db_ = nullptr;
+    ASSERT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  int NumRuns() {
+    int runs = 0;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      std::string property;
+      EXPECT_TRUE(db_->GetProperty(
+          "leveldb.num-runs-at-level" + std::to_string(level), &property));
+      runs += std::stoi(property);
+    }
+    return runs;
+  }
+
+  // Wait until the background thread has truncated every long lineage.
+  void WaitForLineageCompaction() {
+    for (int i = 0; i < 1000; i++) {
+      if (dbfull()->TEST_MaxRunLineage() <= config::kMaxRunLineage) {
+        return;
+      }
+      Env::Default()->SleepForMicroseconds(10000);
+    }
+  }
+
+  // Every key of "model" resolves through Get and the iterator.
+  void CheckContents(const std::map<std::string, std::string>& model) {
+    for (const auto& kv : model) {
+      std::string value;
+      ASSERT_LEVELDB_OK(db_->Get(ReadOptions(), kv.first, &value));
+      ASSERT_EQ(kv.second, value);
+    }
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    auto expected = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+      ASSERT_TRUE(expected != model.end());
+      ASSERT_EQ(expected->first, iter->key().ToString());
+      ASSERT_EQ(expected->second, iter->value().ToString());
+    }
+    ASSERT_LEVELDB_OK(iter->status());
+    ASSERT_TRUE(expected == model.end());
+    delete iter;
+  }
+
+  void Put(std::map<std::string, std::string>* model, const std::string& k,
+           const std::string& v) {
+    ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), k, v));
+    (*model)[k] = v;
+  }
+
+  static std::string Key(int i) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+ protected:
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+};
+
+// 每次flush产生一个L0编号，把它们全部合并进一个run后，该run的血缘超过
+// kMaxRunLineage，B+树中的条目指向其中的每一个L0
+TEST_F(LineageTest, Truncate) {
+  const int kFlushes = config::kMaxRunLineage + 16;
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < kFlushes; i++) {
+    // Keys of their own, and a few keys overwritten by every flush
+    for (int j = 0; j < 10; j++) {
+      Put(&model, Key(1000 + i * 10 + j), "own" + std::to_string(i));
+    }
+    Put(&model, Key(i % 7), "shared" + std::to_string(i));
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+
+  db_->CompactRange(nullptr, nullptr);
+  ASSERT_EQ(1, NumRuns());
+  WaitForLineageCompaction();
+  // Without truncation the single run would hold all kFlushes L0 numbers
+  ASSERT_LE(dbfull()->TEST_MaxRunLineage(), config::kMaxRunLineage);
+  CheckContents(model);
+
+  // Writes after the truncation are found, overwritten keys included
+  Put(&model, Key(3), "after");
+  Put(&model, Key(999999), "after");
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  CheckContents(model);
+
+  // The B+ tree is rebuilt from the truncated lineage on reopen
+  Reopen();
+  ASSERT_LE(dbfull()->TEST_MaxRunLineage(), config::kMaxRunLineage);
+  CheckContents(model);
+  db_->CompactRange(nullptr, nullptr);
+  CheckContents(model);
+  Reopen();
+  CheckContents(model);
+}
+
+}  // namespace leveldb
@@ -20,15 +20,42 @@ enum RecordType {
   // For fragments
   kFirstType = 2,
   kMiddleType = 3,
-  kLastType = 4
+  kLastType = 4,
+
+  // For recycled log files
+  //可复用的日志文件：头部额外带有日志编号，读到旧日志残留的记录时停止回放
+  kRecyclableFullType = 5,
+  kRecyclableFirstType = 6,
+  kRecyclableMiddleType = 7,
+  kRecyclableLastType = 8,
+
+  // First fragment of a record whose payload is Snappy-compressed; the
+  // remaining fragments use kMiddleType/kLastType (or their recyclable
+  // counterparts) as usual.
+  //压缩记录：只有第一个分片使用单独的类型
+  kCompressedFullType = 9,
+  kCompressedFirstType = 10,
+  kRecyclableCompressedFullType = 11,
+  kRecyclableCompressedFirstType = 12
 };
-static const int kMaxRecordType = kLastType;
+static const int kMaxRecordType = kRecyclableCompressedFirstType;
+
+// Returns true if records of this type carry the recyclable header.
+inline bool IsRecyclableType(unsigned int type) {
+  return (type >= kRecyclableFullType && type <= kRecyclableLastType) ||
+         type == kRecyclableCompressedFullType ||
+         type == kRecyclableCompressedFirstType;
+}
 
 static const int kBlockSize = 32768;
 
 // Header is checksum (4 bytes), length (2 bytes), type (1 byte).
 static const int kHeaderSize = 4 + 2 + 1;
 
+// Recyclable header is checksum (4 bytes), length (2 bytes), type (1 byte),
+// log number (4 bytes).
+static const int kRecyclableHeaderSize = 4 + 2 + 1 + 4;
+
 }  // namespace log
 }  // namespace leveldb
 
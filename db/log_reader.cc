@@ -7,6 +7,7 @@
 #include <cstdio>
 
 #include "leveldb/env.h"
+#include "port/port.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
 
@@ -16,7 +17,7 @@ namespace log {
 Reader::Reporter::~Reporter() = default;
 
 Reader::Reader(SequentialFile* file, Reporter* reporter, bool checksum,
-               uint64_t initial_offset)
+               uint64_t initial_offset, uint64_t log_number)
     : file_(file),
       reporter_(reporter),
       checksum_(checksum),
@@ -26,7 +27,9 @@ Reader::Reader(SequentialFile* file, Reporter* reporter, bool checksum,
       last_record_offset_(0),
       end_of_buffer_offset_(0),
       initial_offset_(initial_offset),
-      resyncing_(initial_offset > 0) {}
+      resyncing_(initial_offset > 0),
+      log_number_(log_number),
+      recycled_(false) {}
 
 Reader::~Reader() { delete[] backing_store_; }
 
@@ -63,19 +66,44 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
   scratch->clear();
   record->clear();
   bool in_fragmented_record = false;
+  bool compressed_record = false;  // The fragmented record is compressed
   // Record offset of the logical record that we're reading
   // 0 is a dummy value to make compilers happy
   uint64_t prospective_record_offset = 0;
 
   Slice fragment;
   while (true) {
-    const unsigned int record_type = ReadPhysicalRecord(&fragment);
+    unsigned int record_type = ReadPhysicalRecord(&fragment);
+    const int header_size =
+        IsRecyclableType(record_type) ? kRecyclableHeaderSize : kHeaderSize;
+    //可复用、压缩格式的记录按对应的普通类型处理
+    bool compressed = false;
+    switch (record_type) {
+      case kRecyclableFullType:
+      case kRecyclableFirstType:
+      case kRecyclableMiddleType:
+      case kRecyclableLastType:
+        record_type -= kRecyclableFullType - kFullType;
+        break;
+      case kCompressedFullType:
+      case kRecyclableCompressedFullType:
+        record_type = kFullType;
+        compressed = true;
+        break;
+      case kCompressedFirstType:
+      case kRecyclableCompressedFirstType:
+        record_type = kFirstType;
+        compressed = true;
+        break;
+      default:
+        break;
+    }
 
     // ReadPhysicalRecord may have only had an empty trailer remaining in its
     // internal buffer. Calculate the offset of the next physical record now
     // that it has returned, properly accounting for its header size.
     uint64_t physical_record_offset =
-        end_of_buffer_offset_ - buffer_.size() - kHeaderSize - fragment.size();
+        end_of_buffer_offset_ - buffer_.size() - header_size - fragment.size();
 
     if (resyncing_) {
       if (record_type == kMiddleType) {
@@ -102,6 +130,10 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         prospective_record_offset = physical_record_offset;
         scratch->clear();
         *record = fragment;
+        if (compressed && !UncompressRecord(record)) {
+          in_fragmented_record = false;
+          break;
+        }
         last_record_offset_ = prospective_record_offset;
         return true;
 
@@ -118,6 +150,7 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         prospective_record_offset = physical_record_offset;
         scratch->assign(fragment.data(), fragment.size());
         in_fragmented_record = true;
+        compressed_record = compressed;
         break;
 
       case kMiddleType:
@@ -136,6 +169,11 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         } else {
           scratch->append(fragment.data(), fragment.size());
           *record = Slice(*scratch);
+          if (compressed_record && !UncompressRecord(record)) {
+            in_fragmented_record = false;
+            scratch->clear();
+            break;
+          }
           last_record_offset_ = prospective_record_offset;
           return true;
         }
@@ -150,6 +188,14 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         }
         return false;
 
+      case kOldRecord:
+        // Data left over from the previous user of a recycled log file;
+        // the current log ends here.
+        if (in_fragmented_record) {
+          scratch->clear();
+        }
+        return false;
+
       case kBadRecord:
         if (in_fragmented_record) {
           ReportCorruption(scratch->size(), "error in middle of record");
@@ -175,6 +221,31 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
 
 uint64_t Reader::LastRecordOffset() { return last_record_offset_; }
 
+bool Reader::UncompressRecord(Slice* record) {
+  size_t ulength = 0;
+  if (!port::Snappy_GetUncompressedLength(record->data(), record->size(),
+                                          &ulength)) {
+    std::string probe;
+    if (!port::Snappy_Compress("", 0, &probe)) {
+      //没有编译snappy时读不了压缩记录，这不是损坏，不能被当作损坏跳过
+      ReportDrop(record->size(),
+                 Status::NotSupported("compressed log record",
+                                      "snappy is not compiled in"));
+    } else {
+      ReportCorruption(record->size(), "corrupted compressed record length");
+    }
+    return false;
+  }
+  uncompressed_.resize(ulength);
+  if (!port::Snappy_Uncompress(record->data(), record->size(),
+                               &uncompressed_[0])) {
+    ReportCorruption(record->size(), "corrupted compressed record");
+    return false;
+  }
+  *record = Slice(uncompressed_);
+  return true;
+}
+
 void Reader::ReportCorruption(uint64_t bytes, const char* reason) {
   ReportDrop(bytes, Status::Corruption(reason));
 }
@@ -219,9 +290,22 @@ unsigned int Reader::ReadPhysicalRecord(Slice* result) {
     const uint32_t b = static_cast<uint32_t>(header[5]) & 0xff;
     const unsigned int type = header[6];
     const uint32_t length = a | (b << 8);
-    if (kHeaderSize + length > buffer_.size()) {
+    const bool recyclable = IsRecyclableType(type);
+    const size_t header_size =
+        recyclable ? kRecyclableHeaderSize : kHeaderSize;
+    if (!recyclable && recycled_ && type != kZeroType) {
+      //复用的日志文件中，新格式记录之后出现的旧格式记录只能是残留数据
+      buffer_.clear();
+      return kOldRecord;
+    }
+    if (header_size + length > buffer_.size()) {
       size_t drop_size = buffer_.size();
       buffer_.clear();
+      if (recycled_) {
+        // A torn write over a recycled log file leaves the old contents
+        // behind, so this is the end of the log rather than a corruption.
+        return kOldRecord;
+      }
       if (!eof_) {
         ReportCorruption(drop_size, "bad record length");
         return kBadRecord;
@@ -232,6 +316,16 @@ unsigned int Reader::ReadPhysicalRecord(Slice* result) {
       return kEof;
     }
 
+    if (recyclable) {
+      recycled_ = true;
+      const uint32_t log_number = DecodeFixed32(header + kHeaderSize);
+      if (log_number_ != 0 &&
+          log_number != static_cast<uint32_t>(log_number_)) {
+        buffer_.clear();
+        return kOldRecord;
+      }
+    }
+
     if (type == kZeroType && length == 0) {
       // Skip zero length record without reporting any drops since
       // such records are produced by the mmap based writing code in
@@ -243,7 +337,8 @@ unsigned int Reader::ReadPhysicalRecord(Slice* result) {
     // Check crc
     if (checksum_) {
       uint32_t expected_crc = crc32c::Unmask(DecodeFixed32(header));
-      uint32_t actual_crc = crc32c::Value(header + 6, 1 + length);
+      uint32_t actual_crc =
+          crc32c::Value(header + 6, header_size - 6 + length);
       if (actual_crc != expected_crc) {
         // Drop the rest of the buffer since "length" itself may have
         // been corrupted and if we trust it, we could find some
@@ -251,21 +346,24 @@ unsigned int Reader::ReadPhysicalRecord(Slice* result) {
         // like a valid log record.
         size_t drop_size = buffer_.size();
         buffer_.clear();
+        if (recycled_) {
+          return kOldRecord;
+        }
         ReportCorruption(drop_size, "checksum mismatch");
         return kBadRecord;
       }
     }
 
-    buffer_.remove_prefix(kHeaderSize + length);
+    buffer_.remove_prefix(header_size + length);
 
     // Skip physical record that started before initial_offset_
-    if (end_of_buffer_offset_ - buffer_.size() - kHeaderSize - length <
+    if (end_of_buffer_offset_ - buffer_.size() - header_size - length <
         initial_offset_) {
       result->clear();
       return kBadRecord;
     }
 
-    *result = Slice(header + kHeaderSize, length);
+    *result = Slice(header + header_size, length);
     return type;
   }
 }
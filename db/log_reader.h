@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_DB_LOG_READER_H_
 
 #include <cstdint>
+#include <string>
 
 #include "db/log_format.h"
 #include "leveldb/slice.h"
@@ -40,8 +41,12 @@ class Reader {
   //
   // The Reader will start reading at the first record located at physical
   // position >= initial_offset within the file.
+  //
+  // "log_number" is the number of the log being read.  Recyclable records
+  // tagged with a different number are leftovers from a previous use of a
+  // recycled log file and end the log.  Zero accepts any log number.
   Reader(SequentialFile* file, Reporter* reporter, bool checksum,
-         uint64_t initial_offset);
+         uint64_t initial_offset, uint64_t log_number = 0);
 
   Reader(const Reader&) = delete;
   Reader& operator=(const Reader&) = delete;
@@ -60,6 +65,10 @@ class Reader {
   // Undefined before the first call to ReadRecord.
   uint64_t LastRecordOffset();
 
+  // Returns true if a record in the recyclable format has been read, i.e.
+  // the file may hold stale data of an older log after the current one.
+  bool IsRecycled() const { return recycled_; }
+
  private:
   // Extend record types with the following special values
   enum {
@@ -69,7 +78,11 @@ class Reader {
     // * The record has an invalid CRC (ReadPhysicalRecord reports a drop)
     // * The record is a 0-length record (No drop is reported)
     // * The record is below constructor's initial_offset (No drop is reported)
-    kBadRecord = kMaxRecordType + 2
+    kBadRecord = kMaxRecordType + 2,
+    // Returned when we find stale data left over from a previous use of a
+    // recycled log file (wrong log number, or an invalid record after a
+    // recyclable one).  Treated as the end of the log; no drop is reported.
+    kOldRecord = kMaxRecordType + 3
   };
 
   // Skips all blocks that are completely before "initial_offset_".
@@ -80,6 +93,10 @@ class Reader {
   // Return type, or one of the preceding special values
   unsigned int ReadPhysicalRecord(Slice* result);
 
+  // Replace *record, a compressed payload, by its uncompressed contents.
+  // Returns false after reporting a drop if it cannot be uncompressed.
+  bool UncompressRecord(Slice* record);
+
   // Reports dropped bytes to the reporter.
   // buffer_ must be updated to remove the dropped bytes prior to invocation.
   void ReportCorruption(uint64_t bytes, const char* reason);
@@ -104,6 +121,12 @@ class Reader {
   // particular, a run of kMiddleType and kLastType records can be silently
   // skipped in this mode
   bool resyncing_;
+
+  uint64_t const log_number_;
+  // True once a recyclable record has been read from this file
+  bool recycled_;
+  // Backing store of the last uncompressed record
+  std::string uncompressed_;
 };
 
 }  // namespace log
@@ -7,7 +7,10 @@
 
 #include <cstdint>
 
+#include <string>
+
 #include "db/log_format.h"
+#include "leveldb/options.h"
 #include "leveldb/slice.h"
 #include "leveldb/status.h"
 
@@ -29,6 +32,18 @@ class Writer {
   // "*dest" must remain live while this Writer is in use.
   Writer(WritableFile* dest, uint64_t dest_length);
 
+  // Create a writer that will append data to "*dest".
+  // If "recycle_log_files" is true, records are written in the recyclable
+  // format tagged with "log_number", so "*dest" may be a reused log file
+  // whose tail still holds records of an older log.
+  // If "compression" is kSnappyCompression, record payloads are stored
+  // compressed whenever that saves enough space.
+  // "*dest" must have initial length "dest_length".
+  // "*dest" must remain live while this Writer is in use.
+  Writer(WritableFile* dest, uint64_t dest_length, uint64_t log_number,
+         bool recycle_log_files,
+         CompressionType compression = kNoCompression);
+
   Writer(const Writer&) = delete;
   Writer& operator=(const Writer&) = delete;
 
@@ -41,6 +56,11 @@ class Writer {
 
   WritableFile* dest_;
   int block_offset_;  // Current offset in block
+  uint64_t log_number_;
+  const bool recycle_log_files_;
+  const int header_size_;  //kHeaderSize或kRecyclableHeaderSize
+  const CompressionType compression_;
+  std::string compressed_;  // Scratch space for compressed payloads
 
   // crc32c values for all supported record types.  These are
   // pre-computed to reduce the overhead of computing the crc of the
@@ -0,0 +1,116 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <map>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "db/dbformat.h"
+#include "helpers/memenv/memenv.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "util/random.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class ManualCompactionTest : public testing::Test {
+ public:
+  ManualCompactionTest()
+      : env_(NewMemEnv(Env::Default())), db_(nullptr) {
+    dbname_ = "/manual_compaction_test";
+    options_.env = env_;
+    options_.create_if_missing = true;
+    options_.compression = kNoCompression;
+    DestroyDB(dbname_, options_);
+    EXPECT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  ~ManualCompactionTest() {
+    delete db_;
+    DestroyDB(dbname_, options_);
+    delete env_;
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  int NumRunsAtLevel(int level) {
+    std::string property;
+    EXPECT_TRUE(db_->GetProperty(
+        "leveldb.num-runs-at-level" + std::to_string(level), &property));
+    return std::stoi(property);
+  }
+
+  // Compare the whole DB with "model".
+  void CheckContents(const std::map<std::string, std::string>& model) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    auto expected = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+      ASSERT_TRUE(expected != model.end());
+      ASSERT_EQ(expected->first, iter->key().ToString());
+      ASSERT_EQ(expected->second, iter->value().ToString());
+    }
+    ASSERT_LEVELDB_OK(iter->status());
+    ASSERT_TRUE(expected == model.end());
+    delete iter;
+  }
+
+ protected:
+  Env* env_;
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+};
+
+TEST_F(ManualCompactionTest, ChunksAreNotMergedAgain) {
+  // 一次手动compaction最多合并25 * max_file_size(至少1MB)字节的run
+  const int64_t kChunkBytes = 25 << 20;
+  const int kRuns = 80;
+  const int kKeysPerRun = 100;
+  const int kValueSize = 10 << 10;
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  for (int r = 0; r < kRuns; r++) {
+    for (int i = 0; i < kKeysPerRun; i++) {
+      char key[20];
+      std::snprintf(key, sizeof(key), "key%06d", rnd.Uniform(20000));
+      std::string value;
+      test::RandomString(&rnd, kValueSize, &value);
+      ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), key, value));
+      model[key] = value;
+    }
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+
+  db_->CompactRange(nullptr, nullptr);
+  CheckContents(model);
+
+  // Everything ends up in one level, merged in chunks of at most
+  // kChunkBytes of input.  Each chunk's output is left alone
+  // by the following chunks, so the level keeps one run per chunk instead
+  // of rewriting the growing first run again and again.
+  int level_with_runs = -1;
+  int runs = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    if (NumRunsAtLevel(level) > 0) {
+      ASSERT_EQ(-1, level_with_runs) << "runs left at level " << level;
+      level_with_runs = level;
+      runs = NumRunsAtLevel(level);
+    }
+  }
+  ASSERT_GT(level_with_runs, 0);
+  const int64_t data_bytes = static_cast<int64_t>(model.size()) * kValueSize;
+  ASSERT_GT(data_bytes, kChunkBytes);
+  ASSERT_GE(runs, 2);
+  ASSERT_LE(runs, data_bytes / kChunkBytes + 1);
+
+  // Runs stay ordered by age across reopen
+  delete db_;
+  db_ = nullptr;
+  ASSERT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  CheckContents(model);
+}
+
+}  // namespace leveldb
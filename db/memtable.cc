@@ -7,8 +7,17 @@
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "port/port.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
 
 namespace leveldb {
 
@@ -19,12 +28,308 @@ static Slice GetLengthPrefixedSlice(const char* data) {
   return Slice(p, len);
 }
 
-MemTable::MemTable(const InternalKeyComparator& comparator)
-    : comparator_(comparator), refs_(0), table_(comparator_, &arena_) {}
+namespace {
 
-MemTable::~MemTable() { assert(refs_ == 0); }
+typedef std::vector<const char*> EntryVector;
 
-size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
+// Orders encoded entries for the standard algorithms.
+struct EntryLess {
+  const InternalKeyComparator* cmp;
+  bool operator()(const char* a, const char* b) const {
+    return cmp->Compare(GetLengthPrefixedSlice(a), GetLengthPrefixedSlice(b)) <
+           0;
+  }
+};
+
+// Sort *entries.  Large inputs are split into chunks sorted on separate
+// threads, which are then merged pairwise, also in parallel.
+void SortEntries(EntryVector* entries, const EntryLess& less) {
+  static const size_t kMinEntriesPerThread = 1 << 16;
+  const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  const size_t chunks =
+      std::min(cores, entries->size() / kMinEntriesPerThread);
+  if (chunks <= 1) {
+    std::sort(entries->begin(), entries->end(), less);
+    return;
+  }
+  std::vector<EntryVector::iterator> bounds;
+  for (size_t i = 0; i <= chunks; i++) {
+    bounds.push_back(entries->begin() + entries->size() * i / chunks);
+  }
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < chunks; i++) {
+    workers.emplace_back(
+        [&bounds, &less, i]() { std::sort(bounds[i], bounds[i + 1], less); });
+  }
+  std::sort(bounds[0], bounds[1], less);
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  //每一轮把相邻的两段有序区间合并
+  for (size_t width = 1; width < chunks; width *= 2) {
+    workers.clear();
+    for (size_t i = 0; i + width < chunks; i += 2 * width) {
+      const size_t end = std::min(i + 2 * width, chunks);
+      workers.emplace_back([&bounds, &less, i, width, end]() {
+        std::inplace_merge(bounds[i], bounds[i + width], bounds[end], less);
+      });
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  }
+}
+
+}  // namespace
+
+// Entries of a kVectorRep memtable.  Insert() only appends; the first read
+// after new inserts sorts the entries added since the previous read and
+// merges them into a new sorted snapshot.  Readers share the snapshot, so
+// inserts can go on while iterators are in use.  Building the snapshot is
+// linear in the memtable size, which is why this rep is only meant for
+// memtables that are not read until they are flushed.
+class MemTable::VectorRep {
+ public:
+  explicit VectorRep(const InternalKeyComparator* cmp)
+      : less_{cmp}, count_(0) {}
+
+  VectorRep(const VectorRep&) = delete;
+  VectorRep& operator=(const VectorRep&) = delete;
+
+  // Safe to call from several threads at once.
+  void Insert(const char* entry) {
+    MutexLock l(&mu_);
+    entries_.push_back(entry);
+    count_.store(entries_.size(), std::memory_order_relaxed);
+  }
+
+  size_t Count() const { return count_.load(std::memory_order_relaxed); }
+
+  // Returns all the entries inserted so far, sorted.
+  std::shared_ptr<const EntryVector> Sorted() {
+    std::shared_ptr<const EntryVector> old;
+    EntryVector added;
+    {
+      MutexLock l(&mu_);
+      if (sorted_ != nullptr && sorted_->size() == entries_.size()) {
+        return sorted_;
+      }
+      old = sorted_;
+      const size_t old_size = (old == nullptr) ? 0 : old->size();
+      added.assign(entries_.begin() + old_size, entries_.end());
+    }
+    //在锁外排序，不阻塞插入
+    SortEntries(&added, less_);
+    std::shared_ptr<EntryVector> result;
+    if (old == nullptr) {
+      result = std::make_shared<EntryVector>(std::move(added));
+    } else {
+      result = std::make_shared<EntryVector>();
+      result->reserve(old->size() + added.size());
+      std::merge(old->begin(), old->end(), added.begin(), added.end(),
+                 std::back_inserter(*result), less_);
+    }
+    MutexLock l(&mu_);
+    // A concurrent reader may have installed a more recent snapshot
+    if (sorted_ == nullptr || sorted_->size() < result->size()) {
+      sorted_ = result;
+    }
+    return result;
+  }
+
+  const EntryLess& less() const { return less_; }
+
+ private:
+  const EntryLess less_;
+  port::Mutex mu_;
+  EntryVector entries_ GUARDED_BY(mu_);  // In insertion order
+  std::shared_ptr<const EntryVector> sorted_ GUARDED_BY(mu_);
+  std::atomic<size_t> count_;
+};
+
+namespace {
+
+// A piece [start, end) of the key space and the sequence numbers of the
+// range tombstones covering all of it, newest first.  The slices point
+// into the memtable's arena.
+struct TombstoneFragment {
+  Slice start;
+  Slice end;
+  std::vector<SequenceNumber> seqs;
+};
+
+typedef std::vector<TombstoneFragment> FragmentVector;
+
+}  // namespace
+
+// The range tombstones of a memtable, cut into non-overlapping fragments
+// ordered by start key, so that a point lookup binary searches them instead
+// of scanning every tombstone.  The first lookup after new tombstones were
+// added rebuilds the fragments; lookups share the current list.
+class MemTable::TombstoneCache {
+ public:
+  explicit TombstoneCache(const Comparator* ucmp) : ucmp_(ucmp), count_(0) {}
+
+  TombstoneCache(const TombstoneCache&) = delete;
+  TombstoneCache& operator=(const TombstoneCache&) = delete;
+
+  // Called after a tombstone was inserted into the memtable.  Safe to call
+  // from several threads at once.
+  void Added() { count_.fetch_add(1, std::memory_order_release); }
+
+  // Return the largest sequence number <= snapshot among the tombstones
+  // of "table" covering user_key, or 0 if there is none.
+  SequenceNumber MaxCovering(Table* table, const Slice& user_key,
+                             SequenceNumber snapshot) {
+    if (count_.load(std::memory_order_acquire) == 0) {
+      return 0;
+    }
+    std::shared_ptr<const FragmentVector> fragments = Fragments(table);
+    //最后一个start <= user_key的片段
+    auto iter = std::upper_bound(
+        fragments->begin(), fragments->end(), user_key,
+        [this](const Slice& key, const TombstoneFragment& f) {
+          return ucmp_->Compare(key, f.start) < 0;
+        });
+    if (iter == fragments->begin()) {
+      return 0;
+    }
+    --iter;
+    if (ucmp_->Compare(user_key, iter->end) >= 0) {
+      return 0;
+    }
+    auto seq = std::lower_bound(iter->seqs.begin(), iter->seqs.end(),
+                                snapshot, std::greater<SequenceNumber>());
+    return (seq == iter->seqs.end()) ? 0 : *seq;
+  }
+
+ private:
+  std::shared_ptr<const FragmentVector> Fragments(Table* table) {
+    const size_t count = count_.load(std::memory_order_acquire);
+    {
+      MutexLock l(&mu_);
+      if (fragments_ != nullptr && fragments_count_ == count) {
+        return fragments_;
+      }
+    }
+    //在锁外切分，可能包含比count更多的范围删除，下次查询会再重建
+    std::shared_ptr<const FragmentVector> result = Build(table);
+    MutexLock l(&mu_);
+    if (fragments_ == nullptr || fragments_count_ < count) {
+      fragments_ = result;
+      fragments_count_ = count;
+    }
+    return result;
+  }
+
+  std::shared_ptr<const FragmentVector> Build(Table* table) const {
+    struct Tombstone {
+      Slice start;
+      Slice end;
+      SequenceNumber seq;
+    };
+    //跳表中的范围删除已按起始key有序
+    std::vector<Tombstone> tombstones;
+    std::vector<Slice> bounds;
+    Table::Iterator iter(table);
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+      Slice internal_key = GetLengthPrefixedSlice(iter.key());
+      Tombstone t;
+      t.start = ExtractUserKey(internal_key);
+      t.end = GetLengthPrefixedSlice(internal_key.data() + internal_key.size());
+      t.seq = DecodeFixed64(internal_key.data() + internal_key.size() - 8) >> 8;
+      if (ucmp_->Compare(t.start, t.end) < 0) {
+        tombstones.push_back(t);
+        bounds.push_back(t.start);
+        bounds.push_back(t.end);
+      }
+    }
+    auto less = [this](const Slice& a, const Slice& b) {
+      return ucmp_->Compare(a, b) < 0;
+    };
+    std::sort(bounds.begin(), bounds.end(), less);
+    bounds.erase(std::unique(bounds.begin(), bounds.end(),
+                             [this](const Slice& a, const Slice& b) {
+                               return ucmp_->Compare(a, b) == 0;
+                             }),
+                 bounds.end());
+
+    //从左到右扫描相邻边界之间的区间，维护覆盖它的范围删除
+    auto result = std::make_shared<FragmentVector>();
+    std::vector<const Tombstone*> active;
+    size_t next = 0;
+    for (size_t i = 0; i + 1 < bounds.size(); i++) {
+      const Slice& start = bounds[i];
+      active.erase(std::remove_if(active.begin(), active.end(),
+                                  [&](const Tombstone* t) {
+                                    return ucmp_->Compare(t->end, start) <= 0;
+                                  }),
+                   active.end());
+      while (next < tombstones.size() &&
+             ucmp_->Compare(tombstones[next].start, start) <= 0) {
+        active.push_back(&tombstones[next++]);
+      }
+      if (active.empty()) {
+        continue;
+      }
+      TombstoneFragment fragment;
+      fragment.start = start;
+      fragment.end = bounds[i + 1];
+      for (const Tombstone* t : active) {
+        fragment.seqs.push_back(t->seq);
+      }
+      std::sort(fragment.seqs.begin(), fragment.seqs.end(),
+                std::greater<SequenceNumber>());
+      result->push_back(std::move(fragment));
+    }
+    return result;
+  }
+
+  const Comparator* const ucmp_;
+  std::atomic<size_t> count_;  // Tombstones added to the memtable
+  port::Mutex mu_;
+  std::shared_ptr<const FragmentVector> fragments_ GUARDED_BY(mu_);
+  size_t fragments_count_ GUARDED_BY(mu_) = 0;  // count_ fragments_ covers
+};
+
+MemTable::MemTable(const InternalKeyComparator& comparator,
+                   MemTableRepType rep)
+    : MemTable(comparator, rep, 0, 0, -1) {}
+
+MemTable::MemTable(const InternalKeyComparator& comparator,
+                   const Options& options)
+    : MemTable(comparator, options.memtable_rep,
+               //memtable写满前会略微超出write_buffer_size
+               options.write_buffer_size + options.write_buffer_size / 8,
+               options.memtable_huge_page_size, options.memtable_numa_node) {}
+
+MemTable::MemTable(const InternalKeyComparator& comparator,
+                   MemTableRepType rep, size_t arena_reserved_bytes,
+                   size_t huge_page_size, int numa_node)
+    : comparator_(comparator),
+      refs_(0),
+      arena_(arena_reserved_bytes, huge_page_size, numa_node),
+      table_(comparator_, &arena_),
+      vector_rep_(rep == kVectorRep ? new VectorRep(&comparator_.comparator)
+                                      : nullptr),
+      range_del_table_(comparator_, &arena_),
+      tombstone_cache_(
+          new TombstoneCache(comparator_.comparator.user_comparator())) {}
+
+MemTable::~MemTable() {
+  assert(refs_ == 0);
+  delete vector_rep_;
+  delete tombstone_cache_;
+}
+
+size_t MemTable::ApproximateMemoryUsage() {
+  size_t usage = arena_.MemoryUsage();
+  if (vector_rep_ != nullptr) {
+    //插入顺序的数组和排好序的快照各占一个指针
+    usage += vector_rep_->Count() * 2 * sizeof(const char*);
+  }
+  return usage;
+}
 
 int MemTable::KeyComparator::operator()(const char* aptr,
                                         const char* bptr) const {
@@ -72,10 +377,67 @@ class MemTableIterator : public Iterator {
   std::string tmp_;  // For passing to EncodeKey
 };
 
-Iterator* MemTable::NewIterator() { return new MemTableIterator(&table_); }
+// Iterates over a sorted snapshot of a VectorRep.
+class VectorRepIterator : public Iterator {
+ public:
+  VectorRepIterator(std::shared_ptr<const EntryVector> entries,
+                    const EntryLess& less)
+      : entries_(std::move(entries)), less_(less), pos_(entries_->size()) {}
+
+  VectorRepIterator(const VectorRepIterator&) = delete;
+  VectorRepIterator& operator=(const VectorRepIterator&) = delete;
+
+  ~VectorRepIterator() override = default;
+
+  bool Valid() const override { return pos_ < entries_->size(); }
+  void Seek(const Slice& k) override {
+    pos_ = std::lower_bound(entries_->begin(), entries_->end(),
+                            EncodeKey(&tmp_, k), less_) -
+           entries_->begin();
+  }
+  void SeekToFirst() override { pos_ = 0; }
+  void SeekToLast() override {
+    pos_ = entries_->empty() ? 0 : entries_->size() - 1;
+  }
+  void Next() override {
+    assert(Valid());
+    pos_++;
+  }
+  void Prev() override {
+    assert(Valid());
+    //越过第一个条目后置为无效
+    pos_ = (pos_ == 0) ? entries_->size() : pos_ - 1;
+  }
+  Slice key() const override {
+    return GetLengthPrefixedSlice((*entries_)[pos_]);
+  }
+  Slice value() const override {
+    Slice key_slice = GetLengthPrefixedSlice((*entries_)[pos_]);
+    return GetLengthPrefixedSlice(key_slice.data() + key_slice.size());
+  }
+
+  Status status() const override { return Status::OK(); }
+
+ private:
+  const std::shared_ptr<const EntryVector> entries_;
+  const EntryLess less_;
+  size_t pos_;  // entries_->size() when not valid
+  std::string tmp_;  // For passing to EncodeKey
+};
+
+Iterator* MemTable::NewIterator() {
+  if (vector_rep_ != nullptr) {
+    return new VectorRepIterator(vector_rep_->Sorted(), vector_rep_->less());
+  }
+  return new MemTableIterator(&table_);
+}
+
+Iterator* MemTable::NewRangeTombstoneIterator() {
+  return new MemTableIterator(&range_del_table_);
+}
 
 void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
-                   const Slice& value) {
+                   const Slice& value, bool concurrent, InsertHint* hint) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
@@ -89,7 +451,8 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   const size_t encoded_len = VarintLength(internal_key_size) +
                              internal_key_size + VarintLength(val_size) +
                              val_size;
-  char* buf = arena_.Allocate(encoded_len);
+  char* buf = concurrent ? arena_.AllocateConcurrently(encoded_len)
+                         : arena_.Allocate(encoded_len);
   char* p = EncodeVarint32(buf, internal_key_size);
   std::memcpy(p, key.data(), key_size);
   p += key_size;
@@ -98,15 +461,52 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   p = EncodeVarint32(p, val_size);
   std::memcpy(p, value.data(), val_size);
   assert(p + val_size == buf + encoded_len);
-  table_.Insert(buf);
+  if (vector_rep_ != nullptr && type != kTypeRangeDeletion) {
+    vector_rep_->Insert(buf);
+    return;
+  }
+  Table* table = (type == kTypeRangeDeletion) ? &range_del_table_ : &table_;
+  if (concurrent) {
+    //提示只对应table_，范围删除不使用
+    Table::Splice* splice =
+        (hint != nullptr && table == &table_) ? &hint->splice_ : nullptr;
+    table->InsertConcurrently(buf, splice);
+  } else {
+    table->Insert(buf);
+  }
+  if (type == kTypeRangeDeletion) {
+    tombstone_cache_->Added();
+  }
   //std::cout<<"memtable:"<<buf<<std::endl;
 }
 
+SequenceNumber MemTable::MaxCoveringTombstone(const Slice& user_key,
+                                              SequenceNumber snapshot) {
+  return tombstone_cache_->MaxCovering(&range_del_table_, user_key, snapshot);
+}
+
+const char* MemTable::SeekEntry(const char* memkey) {
+  if (vector_rep_ != nullptr) {
+    std::shared_ptr<const EntryVector> entries = vector_rep_->Sorted();
+    auto iter = std::lower_bound(entries->begin(), entries->end(), memkey,
+                                 vector_rep_->less());
+    //条目本身在arena中，快照释放后指针仍然有效
+    return (iter == entries->end()) ? nullptr : *iter;
+  }
+  Table::Iterator iter(&table_);
+  iter.Seek(memkey);
+  return iter.Valid() ? iter.key() : nullptr;
+}
+
 bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+  Slice internal_key = key.internal_key();
+  const SequenceNumber snapshot =
+      DecodeFixed64(internal_key.data() + internal_key.size() - 8) >> 8;
+  const SequenceNumber tombstone =
+      MaxCoveringTombstone(key.user_key(), snapshot);
   Slice memkey = key.memtable_key();
-  Table::Iterator iter(&table_);
-  iter.Seek(memkey.data());
-  if (iter.Valid()) {
+  const char* entry = SeekEntry(memkey.data());
+  if (entry != nullptr) {
     // entry format is:
     //    klength  varint32
     //    userkey  char[klength]
@@ -116,13 +516,17 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
     // Check that it belongs to same user key.  We do not check the
     // sequence number since the Seek() call above should have skipped
     // all entries with overly large sequence numbers.
-    const char* entry = iter.key();
     uint32_t key_length;
     const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
     if (comparator_.comparator.user_comparator()->Compare(
             Slice(key_ptr, key_length - 8), key.user_key()) == 0) {
       // Correct user key
       const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+      if ((tag >> 8) < tombstone) {
+        //该版本被更新的范围删除覆盖
+        *s = Status::NotFound(Slice());
+        return true;
+      }
       switch (static_cast<ValueType>(tag & 0xff)) {
         case kTypeValue: {
           Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
@@ -132,9 +536,15 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
         case kTypeDeletion:
           *s = Status::NotFound(Slice());
           return true;
+        default:
+          break;
       }
     }
   }
+  if (tombstone > 0) {
+    *s = Status::NotFound(Slice());
+    return true;
+  }
   return false;
 }
 
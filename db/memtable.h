@@ -10,6 +10,7 @@
 #include "db/dbformat.h"
 #include "db/skiplist.h"
 #include "leveldb/db.h"
+#include "leveldb/options.h"
 #include "util/arena.h"
 
 namespace leveldb {
@@ -21,7 +22,14 @@ class MemTable {
  public:
   // MemTables are reference counted.  The initial reference count
   // is zero and the caller must call Ref() at least once.
-  explicit MemTable(const InternalKeyComparator& comparator);
+  // "rep" selects the data structure holding the (non range tombstone)
+  // entries.
+  explicit MemTable(const InternalKeyComparator& comparator,
+                    MemTableRepType rep = kSkipListRep);
+
+  // A memtable configured by "options": memtable_rep, and the huge page
+  // settings of its arena.
+  MemTable(const InternalKeyComparator& comparator, const Options& options);
 
   MemTable(const MemTable&) = delete;
   MemTable& operator=(const MemTable&) = delete;
@@ -50,21 +58,35 @@ class MemTable {
   // db/format.{h,cc} module.
   Iterator* NewIterator();
 
+  // Return an iterator over the range tombstones in the memtable.  Keys
+  // are internal keys of the start user keys; values are the (exclusive)
+  // end user keys.  Same lifetime requirements as NewIterator().
+  Iterator* NewRangeTombstoneIterator();
+
   // Add an entry into memtable that maps key to value at the
   // specified sequence number and with the specified type.
   // Typically value will be empty if type==kTypeDeletion.
+  // If concurrent is true, other threads may be adding entries with
+  // concurrent == true at the same time.  A concurrent Add() starts its
+  // search from the previous one made with the same non-null hint.
+  class InsertHint;
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
-           const Slice& value);
+           const Slice& value, bool concurrent = false,
+           InsertHint* hint = nullptr);
 
   // If memtable contains a value for key, store it in *value and return true.
-  // If memtable contains a deletion for key, store a NotFound() error
-  // in *status and return true.
+  // If memtable contains a deletion for key, or a range tombstone covering
+  // key that is newer than its value, store a NotFound() error in *status
+  // and return true.
   // Else, return false.
   bool Get(const LookupKey& key, std::string* value, Status* s);
 
  private:
   friend class MemTableIterator;
   friend class MemTableBackwardIterator;
+  friend class VectorRepIterator;
+  class VectorRep;
+  class TombstoneCache;
 
   struct KeyComparator {
     const InternalKeyComparator comparator;
@@ -74,12 +96,44 @@ class MemTable {
 
   typedef SkipList<const char*, KeyComparator> Table;
 
+  // The public constructors forward here.  The arena reserves
+  // arena_reserved_bytes of huge pages when huge_page_size is non-zero.
+  MemTable(const InternalKeyComparator& comparator, MemTableRepType rep,
+           size_t arena_reserved_bytes, size_t huge_page_size, int numa_node);
+
   ~MemTable();  // Private since only Unref() should be used to delete it
 
+  // Return the largest sequence number <= snapshot among the range
+  // tombstones covering user_key, or 0 if there is none.  Takes
+  // O(log #tombstones) once the tombstones are fragmented.
+  SequenceNumber MaxCoveringTombstone(const Slice& user_key,
+                                      SequenceNumber snapshot);
+
+  // Return the first entry at or after the encoded key "memkey", or
+  // nullptr if there is none.
+  const char* SeekEntry(const char* memkey);
+
   KeyComparator comparator_;
   int refs_;
   Arena arena_;
   Table table_;
+  //kVectorRep时条目存放在vector_rep_中，table_为空
+  VectorRep* vector_rep_;
+  //范围删除单独存放，按起始key有序
+  Table range_del_table_;
+  //range_del_table_切分成的互不重叠的片段，供点查询二分查找
+  TombstoneCache* tombstone_cache_;
+};
+
+// Where the previous concurrent Add() of a thread went, so that the
+// entries of one write batch, which often have nearby keys, do not each
+// search the memtable from the top.  Must not be shared between threads
+// or used with another memtable.
+class MemTable::InsertHint {
+ private:
+  friend class MemTable;
+
+  Table::Splice splice_;
 };
 
 }  // namespace leveldb
@@ -0,0 +1,66 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/range_del.h"
+
+#include "leveldb/comparator.h"
+#include "leveldb/iterator.h"
+
+namespace leveldb {
+
+void RangeDelAggregator::Add(const Slice& start, const Slice& end,
+                             SequenceNumber seq) {
+  if (seq > upper_bound_ || ucmp_->Compare(start, end) >= 0) {
+    return;
+  }
+  RangeTombstone t;
+  t.start = start.ToString();
+  t.end = end.ToString();
+  t.seq = seq;
+  tombstones_.push_back(t);
+}
+
+void RangeDelAggregator::AddAll(Iterator* iter) {
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    if (ParseInternalKey(iter->key(), &ikey)) {
+      Add(ikey.user_key, iter->value(), ikey.sequence);
+    }
+  }
+}
+
+bool RangeDelAggregator::ShouldDelete(const Slice& user_key,
+                                      SequenceNumber seq) const {
+  for (size_t i = 0; i < tombstones_.size(); i++) {
+    const RangeTombstone& t = tombstones_[i];
+    if (seq < t.seq && ucmp_->Compare(user_key, t.start) >= 0 &&
+        ucmp_->Compare(user_key, t.end) < 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void RunIndexer::Add(const ParsedInternalKey& ikey, const Slice& value) {
+  if (ikey.type == kTypeRangeDeletion) {
+    range_del_.Add(ikey.user_key, value, ikey.sequence);
+    btree_->update_range(ikey.user_key.ToString(), value.ToString(), 0);
+    //起始key比该范围删除更新的版本已经指向本run，需要恢复
+    if (has_last_key_ && ikey.user_key == Slice(last_key_)) {
+      btree_->insert(last_key_, L0_);
+    }
+    return;
+  }
+  if (range_del_.ShouldDelete(ikey.user_key, ikey.sequence)) {
+    return;
+  }
+  //同一个user key只需要插入一次（最新的版本）
+  if (!has_last_key_ || ikey.user_key != Slice(last_key_)) {
+    last_key_.assign(ikey.user_key.data(), ikey.user_key.size());
+    has_last_key_ = true;
+    btree_->insert(last_key_, L0_);
+  }
+}
+
+}  // namespace leveldb
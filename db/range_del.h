@@ -0,0 +1,80 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_RANGE_DEL_H_
+#define STORAGE_LEVELDB_DB_RANGE_DEL_H_
+
+#include <string>
+#include <vector>
+
+#include "db/dbformat.h"
+#include "trees/vanilla_b_plus_tree.h"
+
+namespace leveldb {
+
+class Comparator;
+class Iterator;
+
+// A range tombstone hides every entry whose user key lies in [start, end)
+// and whose sequence number is smaller than seq.  It is stored as an
+// ordinary entry (start, seq, kTypeRangeDeletion) => end, in the memtable
+// and in table files.
+struct RangeTombstone {
+  std::string start;
+  std::string end;
+  SequenceNumber seq;
+};
+
+// RangeDelAggregator collects the range tombstones visible at a sequence
+// number and answers whether a point entry is covered by one of them.
+// Not thread-safe.
+class RangeDelAggregator {
+ public:
+  // Tombstones newer than "upper_bound" are ignored.
+  RangeDelAggregator(const Comparator* ucmp, SequenceNumber upper_bound)
+      : ucmp_(ucmp), upper_bound_(upper_bound) {}
+
+  RangeDelAggregator(const RangeDelAggregator&) = delete;
+  RangeDelAggregator& operator=(const RangeDelAggregator&) = delete;
+
+  void Add(const Slice& start, const Slice& end, SequenceNumber seq);
+
+  // Add every tombstone yielded by *iter (see MemTable::
+  // NewRangeTombstoneIterator).  Does not take ownership of iter.
+  void AddAll(Iterator* iter);
+
+  // Is the entry (user_key, seq) hidden by a newer tombstone?
+  bool ShouldDelete(const Slice& user_key, SequenceNumber seq) const;
+
+  bool empty() const { return tombstones_.empty(); }
+
+ private:
+  const Comparator* const ucmp_;
+  const SequenceNumber upper_bound_;
+  std::vector<RangeTombstone> tombstones_;
+};
+
+// RunIndexer points the B+ tree at the newest version of every user key of
+// one sorted run.  Entries must be fed in internal key order.  A range
+// tombstone masks the keys it covers (value 0: "not on disk"), including
+// those of older runs already indexed, in one pass over the tree.
+class RunIndexer {
+ public:
+  RunIndexer(const Comparator* ucmp,
+             VanillaBPlusTree<std::string, uint64_t>* btree, uint64_t L0)
+      : range_del_(ucmp, kMaxSequenceNumber), btree_(btree), L0_(L0) {}
+
+  void Add(const ParsedInternalKey& ikey, const Slice& value);
+
+ private:
+  RangeDelAggregator range_del_;
+  VanillaBPlusTree<std::string, uint64_t>* const btree_;
+  const uint64_t L0_;
+  std::string last_key_;  // Last user key pointed at L0_
+  bool has_last_key_ = false;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_RANGE_DEL_H_
@@ -0,0 +1,235 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "db/dbformat.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class RangeDelTest : public testing::Test {
+ public:
+  RangeDelTest() : db_(nullptr) {
+    dbname_ = testing::TempDir() + "range_del_test";
+    options_.create_if_missing = true;
+    DestroyDB(dbname_, options_);
+    Reopen();
+  }
+
+  ~RangeDelTest() {
+    delete db_;
+    DestroyDB(dbname_, options_);
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  void Reopen() {
+    delete db_;
+    db_ = nullptr;
+    ASSERT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  Status Put(const std::string& k, const std::string& v) {
+    return db_->Put(WriteOptions(), k, v);
+  }
+
+  Status DeleteRange(const std::string& begin, const std::string& end) {
+    return db_->BulkDeleteForRange(WriteOptions(), begin, end);
+  }
+
+  std::string Get(const std::string& k, const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::string result;
+    Status s = db_->Get(options, k, &result);
+    if (s.IsNotFound()) {
+      result = "NOT_FOUND";
+    } else if (!s.ok()) {
+      result = s.ToString();
+    }
+    return result;
+  }
+
+  // All keys of the DB in order, scanned forward, and checked against a
+  // backward scan.
+  std::string Keys(const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    Iterator* iter = db_->NewIterator(options);
+    std::string forward;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      forward += iter->key().ToString();
+    }
+    std::string backward;
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      backward.insert(0, iter->key().ToString());
+    }
+    EXPECT_LEVELDB_OK(iter->status());
+    EXPECT_EQ(forward, backward);
+    delete iter;
+    return forward;
+  }
+
+  int NumFiles() {
+    int files = 0;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      std::string property;
+      EXPECT_TRUE(db_->GetProperty(
+          "leveldb.num-files-at-level" + std::to_string(level), &property));
+      files += std::stoi(property);
+    }
+    return files;
+  }
+
+  void PutKeys(const std::string& keys) {
+    for (char c : keys) {
+      ASSERT_LEVELDB_OK(Put(std::string(1, c), std::string("v") + c));
+    }
+  }
+
+ protected:
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+};
+
+TEST_F(RangeDelTest, MemTable) {
+  PutKeys("abcdefgh");
+  ASSERT_LEVELDB_OK(DeleteRange("c", "f"));
+  ASSERT_EQ("vb", Get("b"));
+  ASSERT_EQ("NOT_FOUND", Get("c"));
+  ASSERT_EQ("NOT_FOUND", Get("e"));
+  ASSERT_EQ("vf", Get("f"));
+  ASSERT_EQ("abfgh", Keys());
+
+  // Overlapping tombstones, and a key written again after the tombstone
+  ASSERT_LEVELDB_OK(DeleteRange("b", "d"));
+  ASSERT_LEVELDB_OK(DeleteRange("e", "h"));
+  ASSERT_LEVELDB_OK(Put("d", "new"));
+  ASSERT_EQ("NOT_FOUND", Get("b"));
+  ASSERT_EQ("new", Get("d"));
+  ASSERT_EQ("NOT_FOUND", Get("g"));
+  ASSERT_EQ("vh", Get("h"));
+  ASSERT_EQ("adh", Keys());
+
+  // An empty range deletes nothing
+  ASSERT_LEVELDB_OK(DeleteRange("h", "h"));
+  ASSERT_EQ("adh", Keys());
+}
+
+TEST_F(RangeDelTest, AcrossFlushAndCompaction) {
+  PutKeys("abcdefgh");
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+
+  // The tombstone is in the memtable, the data on disk
+  ASSERT_LEVELDB_OK(DeleteRange("b", "e"));
+  ASSERT_LEVELDB_OK(Put("c", "new"));
+  ASSERT_EQ("NOT_FOUND", Get("b"));
+  ASSERT_EQ("new", Get("c"));
+  ASSERT_EQ("NOT_FOUND", Get("d"));
+  ASSERT_EQ("acefgh", Keys());
+
+  // Both on disk, in different runs
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ("NOT_FOUND", Get("b"));
+  ASSERT_EQ("new", Get("c"));
+  ASSERT_EQ("acefgh", Keys());
+
+  // Merged into one run
+  db_->CompactRange(nullptr, nullptr);
+  ASSERT_EQ("NOT_FOUND", Get("d"));
+  ASSERT_EQ("new", Get("c"));
+  ASSERT_EQ("acefgh", Keys());
+
+  // Data written after the compaction is not hidden by the old tombstone
+  ASSERT_LEVELDB_OK(Put("b", "again"));
+  ASSERT_EQ("again", Get("b"));
+  ASSERT_EQ("abcefgh", Keys());
+
+  Reopen();
+  ASSERT_EQ("again", Get("b"));
+  ASSERT_EQ("NOT_FOUND", Get("d"));
+  ASSERT_EQ("abcefgh", Keys());
+}
+
+TEST_F(RangeDelTest, Snapshot) {
+  PutKeys("abcdef");
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_LEVELDB_OK(DeleteRange("a", "e"));
+  ASSERT_LEVELDB_OK(Put("c", "new"));
+
+  // While the tombstone is in a memtable, reads at the snapshot still see
+  // the versions it covers, and nothing written after the snapshot
+  ASSERT_EQ("NOT_FOUND", Get("b"));
+  ASSERT_EQ("new", Get("c"));
+  ASSERT_EQ("cef", Keys());
+  ASSERT_EQ("vb", Get("b", snapshot));
+  ASSERT_EQ("vc", Get("c", snapshot));
+  ASSERT_EQ("abcdef", Keys(snapshot));
+
+  const Snapshot* after = db_->GetSnapshot();
+  ASSERT_EQ("NOT_FOUND", Get("b", after));
+  ASSERT_EQ("cef", Keys(after));
+  db_->ReleaseSnapshot(after);
+  db_->ReleaseSnapshot(snapshot);
+
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  db_->CompactRange(nullptr, nullptr);
+  ASSERT_EQ("NOT_FOUND", Get("b"));
+  ASSERT_EQ("new", Get("c"));
+  ASSERT_EQ("cef", Keys());
+}
+
+TEST_F(RangeDelTest, SnapshotKeepsFiles) {
+  PutKeys("bcd");
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(1, NumFiles());
+
+  // The table lies entirely inside the range, but a snapshot older than
+  // the tombstone can still read it: it must not be dropped
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_LEVELDB_OK(DeleteRange("a", "e"));
+  ASSERT_EQ(1, NumFiles());
+  ASSERT_EQ("", Keys());
+  ASSERT_EQ("vc", Get("c", snapshot));
+  ASSERT_EQ("bcd", Keys(snapshot));
+
+  // Once the snapshot is gone the next range deletion drops it
+  db_->ReleaseSnapshot(snapshot);
+  ASSERT_LEVELDB_OK(DeleteRange("a", "e"));
+  ASSERT_EQ(0, NumFiles());
+  ASSERT_EQ("NOT_FOUND", Get("c"));
+  ASSERT_EQ("", Keys());
+}
+
+TEST_F(RangeDelTest, Reopen) {
+  PutKeys("abcdef");
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  PutKeys("xyz");
+
+  // Recovered from the log only
+  ASSERT_LEVELDB_OK(DeleteRange("b", "y"));
+  Reopen();
+  ASSERT_EQ("va", Get("a"));
+  ASSERT_EQ("NOT_FOUND", Get("c"));
+  ASSERT_EQ("NOT_FOUND", Get("x"));
+  ASSERT_EQ("ayz", Keys());
+
+  // And again once the recovered tombstone was written to a table
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  Reopen();
+  ASSERT_EQ("ayz", Keys());
+  db_->CompactRange(nullptr, nullptr);
+  Reopen();
+  ASSERT_EQ("NOT_FOUND", Get("c"));
+  ASSERT_EQ("ayz", Keys());
+}
+
+}  // namespace leveldb
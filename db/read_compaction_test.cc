@@ -0,0 +1,112 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "db/dbformat.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class ReadCompactionTest : public testing::Test {
+ public:
+  ReadCompactionTest() : db_(nullptr) {
+    dbname_ = testing::TempDir() + "read_compaction_test";
+    options_.create_if_missing = true;
+    options_.compression = kNoCompression;
+    DestroyDB(dbname_, options_);
+    EXPECT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  ~ReadCompactionTest() {
+    delete db_;
+    DestroyDB(dbname_, options_);
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  int NumRunsAtLevel(int level) {
+    std::string property;
+    EXPECT_TRUE(db_->GetProperty(
+        "leveldb.num-runs-at-level" + std::to_string(level), &property));
+    return std::stoi(property);
+  }
+
+  // Scan the whole DB once, checking every value.
+  void Scan(int num_keys, int version) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    int n = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), n++) {
+      ASSERT_EQ(Key(n), iter->key().ToString());
+      ASSERT_EQ(Value(n, version), iter->value().ToString());
+    }
+    ASSERT_LEVELDB_OK(iter->status());
+    ASSERT_EQ(num_keys, n);
+    delete iter;
+  }
+
+  static std::string Key(int i) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+  static std::string Value(int i, int version) {
+    std::string value = Key(i) + "." + std::to_string(version);
+    value.resize(kValueSize, 'x');
+    return value;
+  }
+
+  static const int kValueSize = 1000;
+
+ protected:
+  Options options_;
+  std::string dbname_;
+  DB* db_;
+};
+
+// 几个互相重叠的run不足以触发按大小的compaction，但扫描时迭代器要在它们
+// 之间来回跳转。采样到的读把较新的run的seek预算耗尽后，它们被合并
+TEST_F(ReadCompactionTest, HotRunIsMerged) {
+  const int kNumKeys = 1000;
+  const int kNumRuns = 3;
+  ASSERT_LT(kNumRuns, config::kTieredTrigger);
+  for (int r = 0; r < kNumRuns; r++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), Key(i), Value(i, r)));
+    }
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ(kNumRuns, NumRunsAtLevel(0));
+
+  // Each scan reads about 1MB, so about one sample per scan.  A run has at
+  // least 100 seeks to spend.
+  int scans = 0;
+  while (NumRunsAtLevel(0) == kNumRuns && scans < 2000) {
+    Scan(kNumKeys, kNumRuns - 1);
+    scans++;
+  }
+  ASSERT_LT(NumRunsAtLevel(0), kNumRuns) << "no merge after " << scans
+                                         << " scans";
+  ASSERT_GE(scans, 10);
+
+  // Wait for the compaction to be installed, then check the merged data
+  for (int i = 0; i < 1000 && NumRunsAtLevel(1) == 0; i++) {
+    Env::Default()->SleepForMicroseconds(10000);
+  }
+  ASSERT_GT(NumRunsAtLevel(1), 0);
+  Scan(kNumKeys, kNumRuns - 1);
+
+  delete db_;
+  db_ = nullptr;
+  ASSERT_LEVELDB_OK(DB::Open(options_, dbname_, &db_));
+  ASSERT_LT(NumRunsAtLevel(0), kNumRuns);
+  Scan(kNumKeys, kNumRuns - 1);
+}
+
+}  // namespace leveldb
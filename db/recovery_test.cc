@@ -2,15 +2,24 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <map>
+#include <string>
+
 #include "gtest/gtest.h"
 #include "db/db_impl.h"
 #include "db/filename.h"
+#include "db/log_format.h"
+#include "db/snapshot.h"
+#include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/write_batch.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
 #include "util/logging.h"
+#include "util/mutexlock.h"
 #include "util/testutil.h"
 
 namespace leveldb {
@@ -30,6 +39,7 @@ class RecoveryTest : public testing::Test {
 
   DBImpl* dbfull() const { return reinterpret_cast<DBImpl*>(db_); }
   Env* env() const { return env_; }
+  const std::string& dbname() const { return dbname_; }
 
   bool CanAppend() {
     WritableFile* tmp;
@@ -95,6 +105,10 @@ class RecoveryTest : public testing::Test {
 
   std::string LogName(uint64_t number) { return LogFileName(dbname_, number); }
 
+  std::string ManifestName(uint64_t number) {
+    return DescriptorFileName(dbname_, number);
+  }
+
   size_t RemoveLogFiles() {
     // Linux allows unlinking open files, but Windows does not.
     // Closing the db allows for file deletion.
@@ -152,6 +166,59 @@ class RecoveryTest : public testing::Test {
     delete file;
   }
 
+  // Directly construct a log file of "batches" write batches of three
+  // puts each, numbered from "seq" on, and record them in "model".  Keys
+  // are overwritten within the log and across logs.
+  void MakeLargeLogFile(uint64_t lognum, SequenceNumber seq, int batches,
+                        std::map<std::string, std::string>* model) {
+    std::string fname = LogFileName(dbname_, lognum);
+    WritableFile* file;
+    ASSERT_LEVELDB_OK(env_->NewWritableFile(fname, &file));
+    log::Writer writer(file);
+    for (int i = 0; i < batches; i++) {
+      WriteBatch batch;
+      for (int j = 0; j < 3; j++) {
+        char key[20];
+        std::snprintf(key, sizeof(key), "key%06d",
+                      static_cast<int>((seq + j) % 1000));
+        std::string value = std::to_string(seq + j);
+        value.resize(500, 'v');
+        batch.Put(key, value);
+        (*model)[key] = value;
+      }
+      WriteBatchInternal::SetSequence(&batch, seq);
+      seq += 3;
+      ASSERT_LEVELDB_OK(
+          writer.AddRecord(WriteBatchInternal::Contents(&batch)));
+    }
+    ASSERT_LEVELDB_OK(file->Flush());
+    delete file;
+  }
+
+  SequenceNumber LastSequence() {
+    const Snapshot* snapshot = db_->GetSnapshot();
+    const SequenceNumber result =
+        static_cast<const SnapshotImpl*>(snapshot)->sequence_number();
+    db_->ReleaseSnapshot(snapshot);
+    return result;
+  }
+
+  void CheckContents(const std::map<std::string, std::string>& model) {
+    for (const auto& kv : model) {
+      ASSERT_EQ(kv.second, Get(kv.first)) << kv.first;
+    }
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    auto expected = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+      ASSERT_TRUE(expected != model.end());
+      ASSERT_EQ(expected->first, iter->key().ToString());
+      ASSERT_EQ(expected->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(expected == model.end());
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+  }
+
  private:
   std::string dbname_;
   Env* env_;
@@ -207,6 +274,95 @@ TEST_F(RecoveryTest, LargeManifestCompacted) {
   ASSERT_EQ("bar", Get("foo"));
 }
 
+TEST_F(RecoveryTest, ManifestRolledOver) {
+  Options options;
+  options.create_if_missing = true;
+  options.max_manifest_file_size = 4096;
+  Open(&options);
+  const std::string old_manifest = ManifestFileName();
+  int n = 0;
+  for (; n < 1000 && ManifestFileName() == old_manifest; n++) {
+    char key[20];
+    std::snprintf(key, sizeof(key), "key%06d", n);
+    ASSERT_LEVELDB_OK(Put(key, key));
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+  const std::string new_manifest = ManifestFileName();
+  ASSERT_NE(old_manifest, new_manifest);
+  ASSERT_GT(4096, FileSize(new_manifest));
+
+  Open(&options);
+  ASSERT_FALSE(env()->FileExists(old_manifest));
+  for (int i = 0; i < n; i++) {
+    char key[20];
+    std::snprintf(key, sizeof(key), "key%06d", i);
+    ASSERT_EQ(key, Get(key));
+  }
+}
+
+namespace {
+
+// Fails every rename while fail_renames is set, so that installing a new
+// CURRENT file fails.
+class RenameErrorEnv : public EnvWrapper {
+ public:
+  explicit RenameErrorEnv(Env* base) : EnvWrapper(base), fail_renames(false) {}
+
+  Status RenameFile(const std::string& src, const std::string& dst) override {
+    if (fail_renames) {
+      return Status::IOError(dst, "fake rename error");
+    }
+    return target()->RenameFile(src, dst);
+  }
+
+  bool fail_renames;
+};
+
+}  // namespace
+
+TEST_F(RecoveryTest, ManifestRolloverFailure) {
+  Close();
+  RenameErrorEnv error_env(env());
+  Options options;
+  options.env = &error_env;
+  options.max_manifest_file_size = 1024;
+  InternalKeyComparator icmp(options.comparator);
+  TableCache table_cache(dbname(), options, 100);
+  VersionSet vset(dbname(), &options, &table_cache, &icmp);
+  bool save_manifest;
+  ASSERT_LEVELDB_OK(vset.Recover(&save_manifest));
+  port::Mutex mu;
+  MutexLock l(&mu);
+
+  // Grow the MANIFEST until it is rolled over once
+  const uint64_t first_manifest = vset.ManifestFileNumber();
+  for (int i = 0; i < 1000 && vset.ManifestFileNumber() == first_manifest;
+       i++) {
+    VersionEdit edit;
+    ASSERT_LEVELDB_OK(vset.LogAndApply(&edit, &mu));
+  }
+  ASSERT_NE(first_manifest, vset.ManifestFileNumber());
+
+  // The next rollover fails: keep writing to the old MANIFEST
+  const uint64_t manifest = vset.ManifestFileNumber();
+  error_env.fail_renames = true;
+  Status s;
+  for (int i = 0; i < 1000 && s.ok(); i++) {
+    VersionEdit edit;
+    s = vset.LogAndApply(&edit, &mu);
+  }
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+  ASSERT_EQ(manifest, vset.ManifestFileNumber());
+  ASSERT_EQ(ManifestName(manifest), ManifestFileName());
+
+  // The old MANIFEST is still too large, so the next edit retries
+  error_env.fail_renames = false;
+  VersionEdit edit;
+  ASSERT_LEVELDB_OK(vset.LogAndApply(&edit, &mu));
+  ASSERT_NE(manifest, vset.ManifestFileNumber());
+  ASSERT_EQ(ManifestName(vset.ManifestFileNumber()), ManifestFileName());
+}
+
 TEST_F(RecoveryTest, NoLogFiles) {
   ASSERT_LEVELDB_OK(Put("foo", "bar"));
   ASSERT_EQ(1, RemoveLogFiles());
@@ -322,6 +478,93 @@ TEST_F(RecoveryTest, MultipleLogFiles) {
   ASSERT_EQ("there", Get("hi"));
 }
 
+// 多个日志、每个日志恢复出多个memtable时，并行回放和单线程回放的结果一样：
+// 内容是最新的，序列号接着日志中最大的序列号
+TEST_F(RecoveryTest, ManyMemTablesPerLog) {
+  for (int threads : {1, 4}) {
+    Close();
+    DestroyDB(dbname(), Options());
+    Open();
+    std::map<std::string, std::string> model;
+    ASSERT_LEVELDB_OK(Put("foo", "bar"));
+    model["foo"] = "bar";
+    Close();
+
+    const int kLogs = 3;
+    const int kBatches = 300;  // About 450KB per log
+    uint64_t old_log = FirstLogFile();
+    SequenceNumber seq = 1000;
+    for (int i = 1; i <= kLogs; i++) {
+      MakeLargeLogFile(old_log + i, seq, kBatches, &model);
+      seq += 3 * kBatches;
+    }
+    const SequenceNumber last_sequence = seq - 1;
+
+    Options options;
+    options.reuse_logs = true;
+    options.write_buffer_size = 64 << 10;
+    options.recovery_threads = threads;
+    for (int i = 1; i <= kLogs; i++) {
+      ASSERT_LT(4 * options.write_buffer_size, FileSize(LogName(old_log + i)));
+    }
+    Open(&options);
+    ASSERT_EQ(last_sequence, LastSequence());
+    CheckContents(model);
+
+    // Nothing is replayed twice, and new writes follow the recovered ones
+    Open(&options);
+    ASSERT_EQ(last_sequence, LastSequence());
+    CheckContents(model);
+    ASSERT_LEVELDB_OK(Put("foo", "new"));
+    model["foo"] = "new";
+    ASSERT_EQ(last_sequence + 1, LastSequence());
+    Open(&options);
+    ASSERT_EQ(last_sequence + 1, LastSequence());
+    CheckContents(model);
+  }
+}
+
+static bool SnappyCompressionSupported() {
+  std::string out;
+  Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  return port::Snappy_Compress(in.data(), in.size(), &out);
+}
+
+TEST_F(RecoveryTest, CompressedLogWithoutSnappy) {
+  if (SnappyCompressionSupported())
+    GTEST_SKIP() << "snappy is compiled in";
+
+  // wal_compression falls back to uncompressed logs
+  Options options;
+  options.create_if_missing = true;
+  options.reuse_logs = true;
+  options.wal_compression = kSnappyCompression;
+  Open(&options);
+  ASSERT_LEVELDB_OK(Put("foo", std::string(1000, 'a')));
+  Close();
+  const std::string fname = LogName(FirstLogFile());
+  std::string contents;
+  ASSERT_LEVELDB_OK(ReadFileToString(env(), fname, &contents));
+  ASSERT_EQ(static_cast<char>(log::kFullType), contents[6]);
+  Open(&options);
+  ASSERT_EQ(std::string(1000, 'a'), Get("foo"));
+  Close();
+
+  // A compressed record written by a build with snappy cannot be read:
+  // recovery fails instead of dropping the write, paranoid or not
+  contents[6] = static_cast<char>(log::kCompressedFullType);
+  const size_t length = static_cast<uint8_t>(contents[4]) |
+                        (static_cast<uint8_t>(contents[5]) << 8);
+  uint32_t crc = crc32c::Value(&contents[6], 1 + length);
+  EncodeFixed32(&contents[0], crc32c::Mask(crc));
+  ASSERT_LEVELDB_OK(WriteStringToFile(env(), contents, fname));
+  Status s = OpenWithStatus(&options);
+  ASSERT_TRUE(s.IsNotSupportedError()) << s.ToString();
+  options.paranoid_checks = true;
+  s = OpenWithStatus(&options);
+  ASSERT_TRUE(s.IsNotSupportedError()) << s.ToString();
+}
+
 TEST_F(RecoveryTest, ManifestMissing) {
   ASSERT_LEVELDB_OK(Put("foo", "bar"));
   Close();
@@ -172,7 +172,7 @@ class Repairer {
     // propagating bad information (like overly large sequence
     // numbers).
     log::Reader reader(lfile, &reporter, false /*do not checksum*/,
-                       0 /*initial_offset*/);
+                       0 /*initial_offset*/, log);
 
     // Read all the records and add to a memtable
     std::string scratch;
@@ -205,7 +205,8 @@ class Repairer {
     meta.number = next_file_number_++;
     Iterator* iter = mem->NewIterator();
     VanillaBPlusTree<std::string, uint32_t> btree(options_.bTree_capacity);
-    status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta, &btree);
+    status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta, &btree,
+                        kMaxSequenceNumber);
     delete iter;
     mem->Unref();
     mem = nullptr;
@@ -8,8 +8,9 @@
 // Thread safety
 // -------------
 //
-// Writes require external synchronization, most likely a mutex.
-// Reads require a guarantee that the SkipList will not be destroyed
+// Writes require external synchronization, most likely a mutex, except
+// that several threads may call InsertConcurrently() at once (but not
+// together with Insert()).  Reads require a guarantee that the SkipList will not be destroyed
 // while the read is in progress.  Apart from that, reads progress
 // without any internal locking or synchronization.
 //
@@ -41,7 +42,29 @@ class SkipList {
  private:
   struct Node;
 
+  enum { kMaxHeight = 12 };
+
  public:
+  // Remembers where the previous insert through it went: for every level,
+  // the nodes the new key was linked between.  The next insert checks
+  // these bounds from the bottom level up and only searches the levels
+  // where they no longer bracket its key, so inserting keys that are
+  // close to each other does not descend from head_ every time.
+  // A Splice belongs to one list and must not be used by two threads at
+  // once.
+  class Splice {
+   public:
+    Splice() : height_(0) {}
+
+   private:
+    friend class SkipList;
+
+    int height_;  // Levels [0, height_) are filled in; 0 if unused
+    // Level height_ holds the sentinels head_ and nullptr
+    Node* prev_[kMaxHeight + 1];
+    Node* next_[kMaxHeight + 1];
+  };
+
   // Create a new SkipList object that will use "cmp" for comparing keys,
   // and will allocate memory using "*arena".  Objects allocated in the arena
   // must remain allocated for the lifetime of the skiplist object.
@@ -50,13 +73,27 @@ class SkipList {
   SkipList(const SkipList&) = delete;
   SkipList& operator=(const SkipList&) = delete;
 
-  // Insert key into the list.
+  // Insert key into the list.  Starts from where the previous Insert()
+  // went, so ascending keys are inserted in amortized constant time.
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Like Insert(), but may run in several threads at once.  The new node
+  // is linked level by level with compare-and-swap on the next pointers,
+  // and its memory comes from arena->AllocateAlignedConcurrently().
+  // If splice is non-null, the search starts from the previous insert
+  // made through it, and it is updated for the next one.
+  // REQUIRES: nothing that compares equal to key is currently in the list.
+  // REQUIRES: no concurrent Insert().
+  void InsertConcurrently(const Key& key, Splice* splice = nullptr);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
+  // Returns true iff every level of the list is in strictly ascending
+  // order.  Not thread-safe with respect to writers.
+  bool TEST_Validate() const;
+
   // Iteration over the contents of a skip list
   class Iterator {
    public:
@@ -97,14 +134,15 @@ class SkipList {
   };
 
  private:
-  enum { kMaxHeight = 12 };
-
   inline int GetMaxHeight() const {
     return max_height_.load(std::memory_order_relaxed);
   }
 
-  Node* NewNode(const Key& key, int height);
-  int RandomHeight();
+  Node* NewNode(const Key& key, int height, bool concurrent = false);
+  int RandomHeight(Random* rnd);
+
+  // Random generator of the calling thread, for InsertConcurrently()
+  static Random* ThreadLocalRandom();
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
   // Return true if key is greater than the data stored in "n"
@@ -117,6 +155,19 @@ class SkipList {
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting at "before", whose key is < key, walk the list at "level" and
+  // store in *out_prev and *out_next the nodes between which key belongs.
+  // The walk stops at "after" (nullptr for the end of the list), which
+  // must not sort before key.
+  void FindSpliceForLevel(const Key& key, Node* before, Node* after,
+                          int level, Node** out_prev,
+                          Node** out_next) const;
+
+  // Make levels [0, max_height) of *splice bracket key.  The levels of
+  // the previous insert that still bracket it are kept; the ones below
+  // the lowest of them are searched again.
+  void PrepareSplice(const Key& key, int max_height, Splice* splice) const;
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -131,12 +182,13 @@ class SkipList {
 
   Node* const head_;
 
-  // Modified only by Insert().  Read racily by readers, but stale
-  // values are ok.
+  // Modified only by Insert() and InsertConcurrently().  Read racily by
+  // readers, but stale values are ok.
   std::atomic<int> max_height_;  // Height of the entire list
 
   // Read/written only by Insert().
   Random rnd_;
+  Splice seq_splice_;
 };
 
 // Implementation details follow
@@ -171,6 +223,15 @@ struct SkipList<Key, Comparator>::Node {
     next_[n].store(x, std::memory_order_relaxed);
   }
 
+  // Link x after this node iff the next node is still "expected".  Has
+  // release semantics, like SetNext().
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].compare_exchange_strong(expected, x,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed);
+  }
+
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
   std::atomic<Node*> next_[1];
@@ -178,9 +239,11 @@ struct SkipList<Key, Comparator>::Node {
 
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::NewNode(
-    const Key& key, int height) {
-  char* const node_memory = arena_->AllocateAligned(
-      sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1));
+    const Key& key, int height, bool concurrent) {
+  const size_t bytes = sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
+  char* const node_memory = concurrent
+                                ? arena_->AllocateAlignedConcurrently(bytes)
+                                : arena_->AllocateAligned(bytes);
   return new (node_memory) Node(key);
 }
 
@@ -237,11 +300,11 @@ inline void SkipList<Key, Comparator>::Iterator::SeekToLast() {
 }
 
 template <typename Key, class Comparator>
-int SkipList<Key, Comparator>::RandomHeight() {
+int SkipList<Key, Comparator>::RandomHeight(Random* rnd) {
   // Increase height with probability 1 in kBranching
   static const unsigned int kBranching = 4;
   int height = 1;
-  while (height < kMaxHeight && rnd_.OneIn(kBranching)) {
+  while (height < kMaxHeight && rnd->OneIn(kBranching)) {
     height++;
   }
   assert(height > 0);
@@ -249,6 +312,14 @@ int SkipList<Key, Comparator>::RandomHeight() {
   return height;
 }
 
+template <typename Key, class Comparator>
+Random* SkipList<Key, Comparator>::ThreadLocalRandom() {
+  static std::atomic<uint32_t> next_seed(0xdeadbeef);
+  thread_local Random rnd(
+      next_seed.fetch_add(0x9e3779b9, std::memory_order_relaxed));
+  return &rnd;
+}
+
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
   // null n is considered infinite
@@ -278,6 +349,58 @@ SkipList<Key, Comparator>::FindGreaterOrEqual(const Key& key,
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FindSpliceForLevel(const Key& key,
+                                                   Node* before, Node* after,
+                                                   int level,
+                                                   Node** out_prev,
+                                                   Node** out_next) const {
+  while (true) {
+    Node* next = before->Next(level);
+    if (next != after && KeyIsAfterNode(key, next)) {
+      before = next;
+    } else {
+      *out_prev = before;
+      *out_next = next;
+      return;
+    }
+  }
+}
+
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::PrepareSplice(const Key& key, int max_height,
+                                              Splice* splice) const {
+  int recompute_height = 0;
+  if (splice->height_ < max_height) {
+    // Unused, or the list has grown taller since the last insert
+    splice->prev_[max_height] = head_;
+    splice->next_[max_height] = nullptr;
+    splice->height_ = max_height;
+    recompute_height = max_height;
+  } else {
+    while (recompute_height < max_height) {
+      Node* prev = splice->prev_[recompute_height];
+      Node* next = splice->next_[recompute_height];
+      if (prev->Next(recompute_height) != next) {
+        // Other keys were linked in between since: the bounds may still be
+        // right, but finding the exact splice here could take long
+        recompute_height++;
+      } else if ((prev != head_ && !KeyIsAfterNode(key, prev)) ||
+                 KeyIsAfterNode(key, next)) {
+        // key lies outside the bounds of this level
+        recompute_height++;
+      } else {
+        break;
+      }
+    }
+  }
+  //从仍然包住key的最低一层往下重新查找
+  for (int i = recompute_height - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, splice->prev_[i + 1], splice->next_[i + 1], i,
+                       &splice->prev_[i], &splice->next_[i]);
+  }
+}
+
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node*
 SkipList<Key, Comparator>::FindLessThan(const Key& key) const {
@@ -333,19 +456,21 @@ SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena)
 
 template <typename Key, class Comparator>
 void SkipList<Key, Comparator>::Insert(const Key& key) {
-  // TODO(opt): We can use a barrier-free variant of FindGreaterOrEqual()
-  // here since Insert() is externally synchronized.
-  Node* prev[kMaxHeight];
-  Node* x = FindGreaterOrEqual(key, prev);
+  Splice* splice = &seq_splice_;
+  PrepareSplice(key, GetMaxHeight(), splice);
+  Node** prev = splice->prev_;
+  Node** next = splice->next_;
 
   // Our data structure does not allow duplicate insertion
-  assert(x == nullptr || !Equal(key, x->key));
+  assert(next[0] == nullptr || !Equal(key, next[0]->key));
 
-  int height = RandomHeight();
+  int height = RandomHeight(&rnd_);
   if (height > GetMaxHeight()) {
-    for (int i = GetMaxHeight(); i < height; i++) {
+    for (int i = GetMaxHeight(); i <= height; i++) {
       prev[i] = head_;
+      next[i] = nullptr;
     }
+    splice->height_ = height;
     // It is ok to mutate max_height_ without any synchronization
     // with concurrent readers.  A concurrent reader that observes
     // the new value of max_height_ will see either the old value of
@@ -356,12 +481,72 @@ void SkipList<Key, Comparator>::Insert(const Key& key) {
     max_height_.store(height, std::memory_order_relaxed);
   }
 
-  x = NewNode(key, height);
+  Node* x = NewNode(key, height);
   for (int i = 0; i < height; i++) {
+    //PrepareSplice只检查到第一层仍包住key的区间，更高层的区间里可能
+    //已经被InsertConcurrently()插入了节点，需要在区间内重新查找
+    if (prev[i]->NoBarrier_Next(i) != next[i]) {
+      FindSpliceForLevel(key, prev[i], next[i], i, &prev[i], &next[i]);
+    }
     // NoBarrier_SetNext() suffices since we will add a barrier when
     // we publish a pointer to "x" in prev[i].
-    x->NoBarrier_SetNext(i, prev[i]->NoBarrier_Next(i));
+    x->NoBarrier_SetNext(i, next[i]);
     prev[i]->SetNext(i, x);
+    // The next key of an ascending sequence goes right after x
+    prev[i] = x;
+  }
+}
+
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::InsertConcurrently(const Key& key,
+                                                   Splice* splice) {
+  const int height = RandomHeight(ThreadLocalRandom());
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    // As in Insert(), readers that see the new height before the new
+    // links from head_ just drop to the next level.
+    if (max_height_.compare_exchange_weak(max_height, height,
+                                          std::memory_order_relaxed)) {
+      max_height = height;
+    }
+  }
+
+  Splice local_splice;
+  if (splice == nullptr) {
+    splice = &local_splice;
+  }
+  PrepareSplice(key, max_height, splice);
+  Node** prev = splice->prev_;
+  Node** next = splice->next_;
+
+  // Our data structure does not allow duplicate insertion
+  assert(next[0] == nullptr || !Equal(key, next[0]->key));
+
+  Node* x = NewNode(key, height, true);
+  bool splice_is_valid = true;
+  // Link from the bottom up, so that a node reachable at some level is
+  // reachable at every level below it.
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      // Another node was linked right after prev[i].  prev[i] still sorts
+      // before key, so resume the search from there.
+      FindSpliceForLevel(key, prev[i], nullptr, i, &prev[i], &next[i]);
+      //第i层的区间变窄后，可能不再落在第i+1层的区间内
+      if (i > 0) {
+        splice_is_valid = false;
+      }
+    }
+  }
+  if (splice_is_valid) {
+    for (int i = 0; i < height; i++) {
+      prev[i] = x;
+    }
+  } else {
+    splice->height_ = 0;
   }
 }
 
@@ -375,6 +560,21 @@ bool SkipList<Key, Comparator>::Contains(const Key& key) const {
   }
 }
 
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::TEST_Validate() const {
+  for (int level = 0; level < kMaxHeight; level++) {
+    Node* x = head_->Next(level);
+    while (x != nullptr) {
+      Node* next = x->Next(level);
+      if (next != nullptr && compare_(x->key, next->key) >= 0) {
+        return false;
+      }
+      x = next;
+    }
+  }
+  return true;
+}
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_DB_SKIPLIST_H_
@@ -125,6 +125,54 @@ TEST(SkipTest, InsertAndLookup) {
   }
 }
 
+// Inserts whose keys are close to the previous one reuse its splice
+TEST(SkipTest, InsertNearPrevious) {
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  SkipList<Key, Comparator>::Splice splice;
+  std::set<Key> keys;
+  Random rnd(301);
+  for (Key k = 1000; k < 3000; k++) {  // Ascending
+    list.Insert(k * 10);
+    keys.insert(k * 10);
+  }
+  for (Key k = 999; k > 0; k--) {  // Descending
+    list.InsertConcurrently(k * 10, &splice);
+    keys.insert(k * 10);
+  }
+  for (int i = 0; i < 5000; i++) {  // Short runs at random places
+    Key k = rnd.Uniform(30000) * 10 + 1;
+    for (int j = 0; j < 5; j++, k++) {
+      if (keys.insert(k).second) {
+        if (i % 2 == 0) {
+          list.Insert(k);
+        } else {
+          list.InsertConcurrently(k, &splice);
+        }
+      }
+    }
+  }
+  for (Key k = 30001; k < 40000; k++) {  // Ascending, and just behind it
+    list.Insert(k * 10);
+    keys.insert(k * 10);
+    if (k % 7 == 0) {
+      list.InsertConcurrently(k * 10 - 5);
+      keys.insert(k * 10 - 5);
+    }
+  }
+  ASSERT_TRUE(list.TEST_Validate());
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (Key k : keys) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
 // We want to make sure that with a single writer and multiple
 // concurrent readers (with no synchronization other than when a
 // reader's iterator is created), the reader always observes all the
@@ -365,4 +413,60 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+// Several threads inserting disjoint keys with InsertConcurrently()
+namespace {
+struct ConcurrentInsertState {
+  static const int kThreads = 4;
+  static const int kPerThread = 20000;
+
+  ConcurrentInsertState() : list(cmp, &arena), next_id(0), done(0) {}
+
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list;
+  std::atomic<int> next_id;
+  std::atomic<int> done;
+};
+
+void ConcurrentInserter(void* arg) {
+  ConcurrentInsertState* state = reinterpret_cast<ConcurrentInsertState*>(arg);
+  const int id = state->next_id.fetch_add(1);
+  // Half of the threads start each search from their previous insert
+  SkipList<Key, Comparator>::Splice splice;
+  for (int i = 0; i < ConcurrentInsertState::kPerThread; i++) {
+    // Interleave the key ranges of the threads so that they race for the
+    // same splices
+    state->list.InsertConcurrently(
+        static_cast<Key>(i) * ConcurrentInsertState::kThreads + id,
+        (id % 2 == 0) ? &splice : nullptr);
+  }
+  state->done.fetch_add(1, std::memory_order_release);
+}
+}  // namespace
+
+TEST(SkipTest, ConcurrentInsert) {
+  ConcurrentInsertState state;
+  for (int i = 0; i < ConcurrentInsertState::kThreads; i++) {
+    Env::Default()->StartThread(ConcurrentInserter, &state);
+  }
+  while (state.done.load(std::memory_order_acquire) <
+         ConcurrentInsertState::kThreads) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+
+  const Key total = static_cast<Key>(ConcurrentInsertState::kThreads) *
+                    ConcurrentInsertState::kPerThread;
+  SkipList<Key, Comparator>::Iterator iter(&state.list);
+  iter.SeekToFirst();
+  for (Key k = 0; k < total; k++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+  for (Key k = 0; k < total; k += 997) {
+    ASSERT_TRUE(state.list.Contains(k));
+  }
+}
+
 }  // namespace leveldb
@@ -47,6 +47,11 @@ class TableCache {
              uint64_t file_size, const Slice& k, void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
+  // Returns false if internal key "k" is definitely not in the specified
+  // file according to its filter.  Errors opening the file count as a
+  // possible match.
+  bool KeyMayMatch(uint64_t file_number, uint64_t file_size, const Slice& k);
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
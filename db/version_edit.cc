@@ -12,6 +12,7 @@
 #include "db/version_set.h"
 #include "util/coding.h"
 #include <iostream>
+#include <unordered_map>
 
 namespace leveldb {
 
@@ -32,7 +33,10 @@ enum Tag {
   kNewRun = 12,
   kInputLevel = 13,
   kOutputLevel = 14,
-  kDeletedMap = 15
+  kDeletedMap = 15,
+  kDeletedRunFile = 16,
+  kDroppedLineage = 17,
+  kFileStats = 18
 };
 
 //Version记录db中的所有文件
@@ -52,6 +56,8 @@ void VersionEdit::Clear() {
   //deleted_files_.clear();
   //new_files_.clear();
   deleted_map_.clear();
+  deleted_run_files_.clear();
+  dropped_lineage_.clear();
   //deleted_runs_.clear();
   snapshot_runs_.clear();
   input_level_ = -1;
@@ -81,6 +87,21 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutVarint64(dst, last_sequence_);
   }
 
+  //可以单独出现（BulkDeleteForRange），不依赖compaction的输入输出层
+  for (const auto& deleted_run_file_kvp : deleted_run_files_) {
+    PutVarint32(dst, kDeletedRunFile);
+    PutVarint64(dst, deleted_run_file_kvp.first);   // run id
+    PutVarint64(dst, deleted_run_file_kvp.second);  // file number
+  }
+  for (const auto& dropped_lineage_kvp : dropped_lineage_) {
+    PutVarint32(dst, kDroppedLineage);
+    PutVarint64(dst, dropped_lineage_kvp.first);  // run id
+    PutVarint32(dst, dropped_lineage_kvp.second.size());
+    for (uint64_t L0 : dropped_lineage_kvp.second) {
+      PutVarint64(dst, L0);
+    }
+  }
+
   if(snapshot_runs_.empty() && output_level_ != -1){
     PutVarint32(dst, kInputLevel);
     PutVarint32(dst, input_level_);
@@ -104,12 +125,14 @@ void VersionEdit::EncodeTo(std::string* dst) const {
 
     PutVarint32(dst, kNewRun);
     EncodeRun(dst, new_run_);
+    EncodeFileStats(dst, new_run_);
 
   }else{
     for(size_t i = 0; i < snapshot_runs_.size(); i++){
       PutVarint32(dst, kSnapShotRun);
       const SortedRun& run = snapshot_runs_[i];
       EncodeRun(dst, run);
+      EncodeFileStats(dst, run);
     }
   }
 
@@ -180,6 +203,19 @@ void VersionEdit::EncodeRun(std::string* dst, const SortedRun& run) const{
   } 
 }
 
+void VersionEdit::EncodeFileStats(std::string* dst, const SortedRun& run) const{
+  for (const FileMetaData* f : *(run.GetContainFile())) {
+    //条目数未知（来自旧MANIFEST）的文件不记录
+    if (f->num_entries == 0) {
+      continue;
+    }
+    PutVarint32(dst, kFileStats);
+    PutVarint64(dst, f->number);
+    PutVarint64(dst, f->num_entries);
+    PutVarint64(dst, f->num_deletions);
+  }
+}
+
 bool VersionEdit::DecodeRun(Slice* input, SortedRun* run){
   const char* msg = nullptr;
   uint64_t id;
@@ -243,6 +279,9 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   uint32_t file_number;
   uint64_t L0_number;
   std::vector<uint64_t> run_to_L0;
+  //file number -> <entries, deletions>，解析完后填入本edit中run的文件
+  std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> file_stats;
+  uint64_t num_entries, num_deletions;
 
   while (msg == nullptr && GetVarint32(&input, &tag)) {
     //std::cout<<tag<<std::endl;
@@ -347,6 +386,33 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kDeletedRunFile:
+        if (GetVarint64(&input, &number) && GetVarint64(&input, &L0_number)) {
+          deleted_run_files_.insert(std::make_pair(number, L0_number));
+        } else {
+          msg = "deleted run file";
+        }
+        break;
+
+      case kDroppedLineage:
+        run_to_L0.clear();
+        if (GetVarint64(&input, &number) &&
+            GetVarint32(&input, &file_number)) {
+          for (uint32_t i = 0; i < file_number && msg == nullptr; i++) {
+            if (GetVarint64(&input, &L0_number)) {
+              run_to_L0.push_back(L0_number);
+            } else {
+              msg = "dropped lineage";
+            }
+          }
+          if (msg == nullptr) {
+            dropped_lineage_[number] = run_to_L0;
+          }
+        } else {
+          msg = "dropped lineage";
+        }
+        break;
+
       case kNewRun:
         r.clear();
         if(DecodeRun(&input, &r)){
@@ -356,6 +422,15 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kFileStats:
+        if (GetVarint64(&input, &number) && GetVarint64(&input, &num_entries) &&
+            GetVarint64(&input, &num_deletions)) {
+          file_stats[number] = std::make_pair(num_entries, num_deletions);
+        } else {
+          msg = "file stats";
+        }
+        break;
+
       /*case kCompactPointer:
         if (GetLevel(&input, &level) && GetInternalKey(&input, &key)) {
           compact_pointers_.push_back(std::make_pair(level, key));
@@ -393,6 +468,23 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
     msg = "invalid tag";
   }
 
+  if (msg == nullptr && !file_stats.empty()) {
+    std::vector<SortedRun*> runs;
+    runs.push_back(&new_run_);
+    for (SortedRun& run : snapshot_runs_) {
+      runs.push_back(&run);
+    }
+    for (SortedRun* run : runs) {
+      for (FileMetaData* f : *(run->GetContainFile())) {
+        auto iter = file_stats.find(f->number);
+        if (iter != file_stats.end()) {
+          f->num_entries = iter->second.first;
+          f->num_deletions = iter->second.second;
+        }
+      }
+    }
+  }
+
   Status result;
   if (msg != nullptr) {
     result = Status::Corruption("VersionEdit", msg);
@@ -429,6 +521,18 @@ std::string VersionEdit::DebugString() const {
     r.append(" ");
     r.append(compact_pointers_[i].second.DebugString());
   }*/
+  for (const auto& deleted_run_file_kvp : deleted_run_files_) {
+    r.append("\n  RemoveRunFile: ");
+    AppendNumberTo(&r, deleted_run_file_kvp.first);
+    r.append(" ");
+    AppendNumberTo(&r, deleted_run_file_kvp.second);
+  }
+  for (const auto& dropped_lineage_kvp : dropped_lineage_) {
+    r.append("\n  DropRunLineage: ");
+    AppendNumberTo(&r, dropped_lineage_kvp.first);
+    r.append(" ");
+    AppendNumberTo(&r, dropped_lineage_kvp.second.size());
+  }
   /*for (const auto& deleted_files_kvp : deleted_files_) {
     r.append("\n  RemoveFile: ");
     AppendNumberTo(&r, deleted_files_kvp.first);
@@ -5,6 +5,7 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 #define STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 
+#include <map>
 #include <set>
 #include <utility>
 #include <vector>
@@ -17,7 +18,12 @@ namespace leveldb {
 class VersionSet;
 
 struct FileMetaData {
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) {}
+  FileMetaData()
+      : refs(0),
+        allowed_seeks(1 << 30),
+        file_size(0),
+        num_entries(0),
+        num_deletions(0) {}
 
   int refs;//引用计数
   int allowed_seeks;  // Seeks allowed until compaction
@@ -25,6 +31,9 @@ struct FileMetaData {
   uint64_t file_size;    // File size in bytes
   InternalKey smallest;  // Smallest internal key served by table
   InternalKey largest;   // Largest internal key served by table
+  //旧MANIFEST中的文件没有记录，为0
+  uint64_t num_entries;    // Entries in the table
+  uint64_t num_deletions;  // Deletion markers and range tombstones among them
 };
 
 class SortedRun{//结构1
@@ -32,8 +41,12 @@ class SortedRun{//结构1
   SortedRun(uint64_t id = 0, int level = 0):id_(id),
                               level_(level),
                               ref_(0),
+                              allowed_seeks_(1 << 30),
                               contain_file_(new std::vector<FileMetaData*>),
-                              run_to_L0_file_(new std::vector<uint64_t>){}
+                              run_to_L0_file_(new std::vector<uint64_t>),
+                              num_entries_(0),
+                              num_deletions_(0),
+                              total_bytes_(0){}
 
   void InsertContainFile(FileMetaData* file){
     contain_file_->push_back(file);
@@ -43,14 +56,46 @@ class SortedRun{//结构1
     id_=0;
     level_=0;
     ref_=0;
+    allowed_seeks_ = 1 << 30;
     contain_file_ = new std::vector<FileMetaData*>();
     run_to_L0_file_ = new std::vector<uint64_t>();
+    smallest_.Clear();
+    largest_.Clear();
+    num_entries_ = 0;
+    num_deletions_ = 0;
+    total_bytes_ = 0;
+  }
+
+  //由run内文件汇总key范围、条目数和大小。run加入Version后文件不再变化，
+  //只需在加入时计算一次
+  void UpdateMetadata(){
+    num_entries_ = 0;
+    num_deletions_ = 0;
+    total_bytes_ = 0;
+    if (contain_file_->empty()) {
+      smallest_.Clear();
+      largest_.Clear();
+      return;
+    }
+    //run内文件有序且不重叠，首尾文件即run的范围
+    smallest_ = contain_file_->front()->smallest;
+    largest_ = contain_file_->back()->largest;
+    for (const FileMetaData* f : *contain_file_) {
+      num_entries_ += f->num_entries;
+      num_deletions_ += f->num_deletions;
+      total_bytes_ += f->file_size;
+    }
   }
 
   void InsertL0File(uint64_t file){
     run_to_L0_file_->push_back(file);
   }
 
+  //换用新的空血缘，不改动与其他run共享的旧vector
+  void ResetL0Files(){
+    run_to_L0_file_ = new std::vector<uint64_t>();
+  }
+
   void SetLevel(int level){
     level_ = level;
   }
@@ -75,13 +120,42 @@ class SortedRun{//结构1
     return run_to_L0_file_;
   }
 
+  // Aggregates over the files of the run, set by UpdateMetadata().  The
+  // keys are empty for a run without files.
+  const InternalKey& GetSmallest() const{
+    return smallest_;
+  }
+
+  const InternalKey& GetLargest() const{
+    return largest_;
+  }
+
+  uint64_t GetNumEntries() const{
+    return num_entries_;
+  }
+
+  uint64_t GetNumDeletions() const{
+    return num_deletions_;
+  }
+
+  uint64_t GetTotalBytes() const{
+    return total_bytes_;
+  }
+
   int ref_;
+  //读操作在该run上浪费的I/O预算，耗尽后触发读驱动的compaction
+  int allowed_seeks_;  // Seeks allowed until compaction
 
  protected:
   uint64_t id_;
   int level_;
   std::vector<FileMetaData*>* contain_file_;
   std::vector<uint64_t>* run_to_L0_file_;
+  InternalKey smallest_;
+  InternalKey largest_;
+  uint64_t num_entries_;
+  uint64_t num_deletions_;
+  uint64_t total_bytes_;
 };
 
 class VersionEdit {
@@ -129,12 +203,15 @@ class VersionEdit {
   }*/
 
   void AddFileToRun(uint64_t file, uint64_t file_size,
-               const InternalKey& smallest, const InternalKey& largest){
+               const InternalKey& smallest, const InternalKey& largest,
+               uint64_t num_entries = 0, uint64_t num_deletions = 0){
     FileMetaData f;
     f.number = file;
     f.file_size = file_size;
     f.smallest = smallest;
     f.largest = largest;
+    f.num_entries = num_entries;
+    f.num_deletions = num_deletions;
     FileMetaData* f_p = new FileMetaData(f);
     //f_p->refs = 1;
     new_run_.InsertContainFile(f_p);
@@ -143,6 +220,9 @@ class VersionEdit {
   void AddRun(SortedRun run){
     new_run_ = run;
   }
+
+  // Id of the run added by AddRun().
+  uint64_t NewRunID() const { return new_run_.GetID(); }
   // Delete the specified "file" from the specified "level".
   /*void RemoveFile(int level, uint64_t file) {
     deleted_files_.insert(std::make_pair(level, file));
@@ -156,10 +236,25 @@ class VersionEdit {
     deleted_map_.insert(std::make_pair(run->GetID(), *(run->GetRunToL0())));
   }
 
+  // Drop "file" from the run "run_id" without rewriting the run.  The run
+  // keeps its id and its L0 lineage.
+  void RemoveFileFromRun(uint64_t run_id, uint64_t file) {
+    deleted_run_files_.insert(std::make_pair(run_id, file));
+  }
+
+  // Drop the L0 numbers "L0s" from the lineage of the run "run_id".  The
+  // B+ tree must no longer hold any of them.
+  void DropRunLineage(uint64_t run_id, const std::vector<uint64_t>& L0s) {
+    dropped_lineage_[run_id] = L0s;
+  }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
   void EncodeRun(std::string* dst, const SortedRun& run) const;
   bool DecodeRun(Slice* input, SortedRun* run);
+  // Entry counts of the files of "run", in records of their own so that
+  // EncodeRun keeps its layout.
+  void EncodeFileStats(std::string* dst, const SortedRun& run) const;
 
   std::string DebugString() const;
 
@@ -183,6 +278,9 @@ class VersionEdit {
   //typedef std::set<uint64_t> DeletedRunSet;
   typedef std::vector<SortedRun> SnapShotRunSet;
   typedef std::unordered_map<uint64_t, std::vector<uint64_t>> DeletedMap;
+  typedef std::set<std::pair<uint64_t, uint64_t>> DeletedRunFileSet;
+  //按run id排序，编码结果与插入顺序无关
+  typedef std::map<uint64_t, std::vector<uint64_t>> DroppedLineageMap;
 
   std::string comparator_;
   uint64_t log_number_;
@@ -202,6 +300,8 @@ class VersionEdit {
   uint32_t input_level_;
   uint32_t output_level_;
   DeletedMap deleted_map_;//被删除的run所包含的L0
+  DeletedRunFileSet deleted_run_files_;//<run id, file number>，从run中直接丢弃的文件
+  DroppedLineageMap dropped_lineage_;//run id -> 从该run血缘中截掉的L0
   //<level,file meta>
   //std::vector<FileMetaData> new_files_;
   SortedRun new_run_;
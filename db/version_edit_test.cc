@@ -127,6 +127,75 @@ TEST(VersionEditTest, NormalEncodeDecode){
   TestEncodeDecode(edit);
 }
 
+TEST(VersionEditTest, DeletedRunFileEncodeDecode){
+  static const uint64_t kBig = 1ull << 50;
+  VersionEdit edit;
+  for (int i = 0; i < 4; i++) {
+    TestEncodeDecode(edit);
+    edit.RemoveFileFromRun(kBig + 10 + i, kBig + 700 + i);
+  }
+  edit.SetLastSequence(kBig + 1000);
+  TestEncodeDecode(edit);
+
+  std::string encoded;
+  edit.EncodeTo(&encoded);
+  VersionEdit parsed;
+  ASSERT_TRUE(parsed.DecodeFrom(encoded).ok());
+  ASSERT_EQ(-1, parsed.GetOutputLevel());
+}
+
+TEST(VersionEditTest, FileStatsEncodeDecode){
+  static const uint64_t kBig = 1ull << 50;
+  VersionEdit edit;
+  edit.SetLevel(-1, 0);
+  SortedRun run(kBig + 1, 0);
+  edit.AddRun(run);
+  edit.AddFileToRun(kBig + 300, kBig + 400,
+                    InternalKey("foo", kBig + 500, kTypeValue),
+                    InternalKey("zoo", kBig + 600, kTypeDeletion),
+                    kBig + 700, kBig + 800);
+  //旧MANIFEST中的文件没有统计信息
+  edit.AddFileToRun(kBig + 301, kBig + 401,
+                    InternalKey("zp", kBig + 501, kTypeValue),
+                    InternalKey("zz", kBig + 601, kTypeValue));
+  edit.SetLastSequence(kBig + 1000);
+  TestEncodeDecode(edit);
+}
+
+TEST(VersionEditTest, DroppedLineageEncodeDecode){
+  static const uint64_t kBig = 1ull << 50;
+  VersionEdit edit;
+  edit.SetLevel(-1, -1);
+  for (int i = 0; i < 3; i++) {
+    std::vector<uint64_t> L0s;
+    for (int j = 0; j <= i * 40; j++) {
+      L0s.push_back(kBig + i * 1000 + j);
+    }
+    edit.DropRunLineage(kBig + 10 + i, L0s);
+    TestEncodeDecode(edit);
+  }
+  //截掉的血缘为空时也能往返
+  edit.DropRunLineage(kBig + 20, std::vector<uint64_t>());
+  edit.SetLastSequence(kBig + 1000);
+  TestEncodeDecode(edit);
+
+  std::string encoded;
+  edit.EncodeTo(&encoded);
+  VersionEdit parsed;
+  ASSERT_TRUE(parsed.DecodeFrom(encoded).ok());
+  const std::string debug = parsed.DebugString();
+  ASSERT_NE(std::string::npos,
+            debug.find("DropRunLineage: " + std::to_string(kBig + 10) + " 1\n"));
+  ASSERT_NE(std::string::npos,
+            debug.find("DropRunLineage: " + std::to_string(kBig + 12) + " 81\n"));
+  ASSERT_NE(std::string::npos,
+            debug.find("DropRunLineage: " + std::to_string(kBig + 20) + " 0\n"));
+
+  //记录被截断时报告损坏
+  VersionEdit truncated;
+  ASSERT_TRUE(truncated.DecodeFrom(Slice(encoded.data(), encoded.size() - 12))
+                  .IsCorruption());
+}
 
 }  // namespace leveldb
 
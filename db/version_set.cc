@@ -14,6 +14,7 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/range_del.h"
 #include "db/table_cache.h"
 #include "trees/vanilla_b_plus_tree.h"
 #include "leveldb/env.h"
@@ -69,6 +70,21 @@ static int64_t TotalFileSize(const std::vector<FileMetaData*>& files) {
   return sum;
 }
 
+// We arrange to automatically compact a run after a certain number of
+// wasted reads, in the same way as files used to be:
+//   (1) One seek costs 10ms
+//   (2) Writing or reading 1MB costs 10ms (100MB/s)
+//   (3) A compaction of 1MB does 25MB of IO
+// so one seek costs approximately the same as the compaction of 40KB of
+// data.  We are a little conservative and allow approximately one seek
+// for every 16KB of data in the run before triggering a compaction.
+static int RunAllowedSeeks(const SortedRun* run) {
+  int64_t allowed = run->GetTotalBytes() / 16384;
+  if (allowed < 100) allowed = 100;
+  if (allowed > (1 << 30)) allowed = 1 << 30;
+  return static_cast<int>(allowed);
+}
+
 Version::~Version() {
   //移除一个Version
   //对这个Version的引用为0时才能释放
@@ -307,16 +323,30 @@ void Version::AddIterators(const ReadOptions& options,
   //对于L0层的所有文件，每个文件上创建一个迭代器
   //迭代的是index block上的内容，每个条目对于一个data block
   int index = iters->size();
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
   for(size_t i = 0; i < config::kNumLevels; i++){//对每层
     for(size_t j = 0; j < runs_[i].size(); j++){//对第i层的第j个run
       std::vector<FileMetaData*>* files = runs_[i][j]->GetContainFile();
       std::vector<uint64_t>* L0 = runs_[i][j]->GetRunToL0();
+      if(files->empty()){
+        //空run没有迭代器，不能映射到下一个run的index
+        continue;
+      }
+      //整个run都在迭代范围之外：范围内的key不会被B+树指向它，不必打开
+      if ((options.iterate_lower_bound != nullptr &&
+           ucmp->Compare(runs_[i][j]->GetLargest().user_key(),
+                         *options.iterate_lower_bound) < 0) ||
+          (options.iterate_upper_bound != nullptr &&
+           ucmp->Compare(runs_[i][j]->GetSmallest().user_key(),
+                         *options.iterate_upper_bound) >= 0)) {
+        continue;
+      }
       for(int k = 0; k < L0->size(); k++){
         //std::cout<<L0->at(k)<<" "<<index<<std::endl;
         index_map->insert(std::make_pair(L0->at(k), index));
       }
-      if(i == 0){
-        assert(files->size() == 1);
+      //flush生成的L0 run只有一个文件；导入外部文件生成的L0 run可以有多个
+      if(i == 0 && files->size() == 1){
         //std::cout<<"L0 conatain:"<<files->at(0)->number<<" index:"<<index<<std::endl;
         iters->push_back(vset_->table_cache_->NewIterator(options, files->at(0)->number, files->at(0)->file_size));
         //std::cout<<"itersize:"<<iters->size()<<" "<<index<<std::endl;
@@ -326,10 +356,8 @@ void Version::AddIterators(const ReadOptions& options,
           iters->push_back(vset_->table_cache_->NewIterator(options, file->number, file->file_size));
         }*/
       }else{
-        if(!files->empty()){
-          iters->push_back(NewConcatenatingIterator(options, files));
-          index++;
-        }
+        iters->push_back(NewConcatenatingIterator(options, files));
+        index++;
       }
     }
   }
@@ -397,40 +425,42 @@ static bool NewestFirst(FileMetaData* a, FileMetaData* b) {
 Status Version::RebuildTree(VanillaBPlusTree<std::string, uint64_t>* btree){
   for(int i = config::kNumLevels - 1; i >= 0; i--){
     for(int j = 0; j < runs_[i].size(); j++){
-      const SortedRun* run = runs_[i][j];
-      std::vector<uint64_t>* run_to_L0 = runs_[i][j]->GetRunToL0();
-      std::vector<FileMetaData*>* contain_files = runs_[i][j]->GetContainFile();
-      //只保留一个run 到 L0的映射
-      uint64_t L0 = run_to_L0->at(0);
-      run_to_L0->clear();
-      run_to_L0->push_back(L0);
-      //std::cout<<"the L0:"<<L0<<std::endl;
-      Iterator* iter = NewConcatenatingIterator(ReadOptions(), contain_files);
-      for(iter->SeekToLast(); iter->Valid(); iter->Prev()){
-        ParsedInternalKey ikey;
-        Slice k = iter->key();
-        if (!ParseInternalKey(k, &ikey)) {
-          Status status = Status::Corruption("corrupted internal key in DBIter");
-          return status;
-        }
-        switch (ikey.type) {
-          case kTypeDeletion:
-            // Arrange to skip all upcoming entries for this key since
-            // they are hidden by this deletion.
-            //是否要改成0？
-            btree->insert(ikey.user_key.ToString(), L0);
-            break;
-          case kTypeValue:
-            btree->insert(ikey.user_key.ToString(), L0);
-            break;
-        }        
+      Status s = IndexRun(runs_[i][j], btree);
+      if (!s.ok()) {
+        return s;
       }
     }
   }
+  return Status::OK();
+}
+
+Status Version::IndexRun(const SortedRun* run,
+                         VanillaBPlusTree<std::string, uint64_t>* btree){
+  std::vector<uint64_t>* run_to_L0 = run->GetRunToL0();
+  std::vector<FileMetaData*>* contain_files = run->GetContainFile();
+  //重建时run内所有key都映射到第一个L0；其余L0仍留在血缘中，
+  //这样后续compaction删除该run时能把它们一并重新映射
+  uint64_t L0 = run_to_L0->at(0);
+  //std::cout<<"the L0:"<<L0<<std::endl;
+  Iterator* iter = NewConcatenatingIterator(ReadOptions(), contain_files);
+  //run从旧到新处理，范围删除会屏蔽更旧run中已经插入的key
+  RunIndexer indexer(vset_->icmp_.user_comparator(), btree, L0);
+  for(iter->SeekToFirst(); iter->Valid(); iter->Next()){
+    ParsedInternalKey ikey;
+    Slice k = iter->key();
+    if (!ParseInternalKey(k, &ikey)) {
+      Status status = Status::Corruption("corrupted internal key in DBIter");
+      delete iter;
+      return status;
+    }
+    indexer.Add(ikey, iter->value());
+  }
+  Status status = iter->status();
+  delete iter;
+  return status;
 }
 
 void Version::PrintMap(VanillaBPlusTree<std::string, uint64_t>* btree){
-  //std::unordered_map<uint64_t, SortedRun*> L0_file_to_run_; 
   /*for(const auto& L0 : L0_file_to_run_){
     std::cout<<"map contain L0:"<<L0.first<<std::endl;
   }
@@ -472,9 +502,14 @@ void Version::ForEachOverlapping(SortedRun* search_run, Slice user_key, Slice in
   const Comparator* ucmp = vset_->icmp_.user_comparator();
   std::vector<FileMetaData*>* files = search_run->GetContainFile();
   uint32_t index = FindFile(vset_->icmp_, *files, internal_key);
-  assert(index < files->size());
+  //compaction可能丢弃了key（甚至整个run为空），此时索引仍指向该run
+  if (index >= files->size()) {
+    return;
+  }
   FileMetaData* f = files->at(index);
-  assert(ucmp->Compare(user_key, f->smallest.user_key()) >= 0);
+  if (ucmp->Compare(user_key, f->smallest.user_key()) < 0) {
+    return;
+  }
   if (!(*func)(arg, search_run->GetLevel(), f)) {
     return;
   }
@@ -506,8 +541,8 @@ void Version::ForEachOverlapping(SortedRun* search_run, Slice user_key, Slice in
 //为k寻找value
 Status Version::Get(const ReadOptions& options, const LookupKey& k,
                     std::string* value, GetStats* stats, uint64_t L0_id) {
-  stats->seek_file = nullptr;//filemeta
-  stats->seek_file_level = -1;
+  stats->seek_run = nullptr;
+  stats->seek_run_level = -1;
 
   struct State {
     Saver saver;
@@ -524,14 +559,6 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
     //对f执行的match判断
     static bool Match(void* arg, int level, FileMetaData* f) {
       State* state = reinterpret_cast<State*>(arg);
-      if (state->stats->seek_file == nullptr &&
-          state->last_file_read != nullptr) {
-        // We have had more than one seek for this read.  Charge the 1st file.
-        //seek记录上次的
-        state->stats->seek_file = state->last_file_read;
-        state->stats->seek_file_level = state->last_file_read_level;
-      }
-
       //last记录当前的f（本次
       state->last_file_read = f;
       state->last_file_read_level = level;
@@ -580,80 +607,81 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
   state.saver.value = value;
 
   //对每个文件待查文件都调用Match函数，直到match到所查key，就停止查找过程
-  if(L0_id != 0){
-    if(L0_file_to_run_.find(L0_id) == L0_file_to_run_.end()){
-      L0_id = 0;
-    }else{
-      SortedRun* search_run = GetMapRun(L0_id);
-      //修改这个函数：
-      //state.found=true;
-      ForEachOverlapping(search_run, state.saver.user_key, state.ikey, &state, &State::Match);          
-    }  
+  SortedRun* search_run = (L0_id != 0) ? GetMapRun(L0_id) : nullptr;
+  if(search_run != nullptr){
+    ForEachOverlapping(search_run, state.saver.user_key, state.ikey, &state, &State::Match);          
+    //读了该run的文件却没有找到本次读可见的版本（例如快照读的旧版本在更旧的run中），
+    //这次I/O白费了，计入该run
+    if (state.last_file_read != nullptr && state.saver.state == kNotFound) {
+      stats->seek_run = search_run;
+      stats->seek_run_level = state.last_file_read_level;
+    }
   }
 
-  //SortedRun* search_run = GetMapRun(L0_id);
-  //修改这个函数：
-  //ForEachOverlapping(search_run, state.saver.user_key, state.ikey, &state, &State::Match);
-
   return state.found ? state.s : Status::NotFound(Slice());
 }
 
 SortedRun* Version::GetMapRun(uint64_t id){
-  std::unordered_map<uint64_t, SortedRun*>::iterator iter = L0_file_to_run_.find(id);
-  return iter->second;
+  return L0_file_to_run_.Get(id);
 }
 
-//？
 bool Version::UpdateStats(const GetStats& stats) {
-  FileMetaData* f = stats.seek_file;
-  if (f != nullptr) {
-    f->allowed_seeks--;
-    if (f->allowed_seeks <= 0 && file_to_compact_ == nullptr) {
-      file_to_compact_ = f;
-      file_to_compact_level_ = stats.seek_file_level;
-      return true;
-    }
+  if (stats.seek_run != nullptr) {
+    return ChargeRun(stats.seek_run, stats.seek_run_level);
+  }
+  return false;
+}
+
+bool Version::ChargeRun(SortedRun* run, int level) {
+  run->allowed_seeks_--;
+  //合并需要本层至少两个run，否则只是把同一个run下移一层，读放大不变
+  if (run->allowed_seeks_ <= 0 && run_to_compact_ == nullptr &&
+      runs_[level].size() >= 2) {
+    run_to_compact_ = run;
+    run_to_compact_level_ = level;
+    return true;
   }
   return false;
 }
 
-//？
 bool Version::RecordReadSample(Slice internal_key) {
-  /*ParsedInternalKey ikey;
+  ParsedInternalKey ikey;
   if (!ParseInternalKey(internal_key, &ikey)) {
     return false;
   }
 
-  struct State {
-    GetStats stats;  // Holds first matching file
-    int matches;
-
-    static bool Match(void* arg, int level, FileMetaData* f) {
-      State* state = reinterpret_cast<State*>(arg);
-      state->matches++;
-      if (state->matches == 1) {
-        // Remember first match.
-        state->stats.seek_file = f;
-        state->stats.seek_file_level = level;
+  //找出所有包含该key的run（从新到旧）。迭代器在这段key空间上会在这些run之间来回跳转
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  std::vector<std::pair<SortedRun*, int>> overlaps;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    //同一层中新的run在后
+    for (size_t i = runs_[level].size(); i > 0; i--) {
+      SortedRun* run = runs_[level][i - 1];
+      const std::vector<FileMetaData*>& files = *(run->GetContainFile());
+      if (files.empty() ||
+          ucmp->Compare(ikey.user_key, run->GetSmallest().user_key()) < 0 ||
+          ucmp->Compare(ikey.user_key, run->GetLargest().user_key()) > 0) {
+        continue;
+      }
+      uint32_t index = FindFile(vset_->icmp_, files, internal_key);
+      if (index < files.size() &&
+          ucmp->Compare(ikey.user_key, files[index]->smallest.user_key()) >=
+              0) {
+        overlaps.push_back(std::make_pair(run, level));
       }
-      // We can stop iterating once we have a second match.
-      return state->matches < 2;
     }
-  };
-
-  State state;
-  state.matches = 0;
-  ForEachOverlapping(ikey.user_key, internal_key, &state, &State::Match);
+  }
 
   // Must have at least two matches since we want to merge across
-  // files. But what if we have a single file that contains many
-  // overwrites and deletions?  Should we have another mechanism for
-  // finding such files?
-  if (state.matches >= 2) {
-    // 1MB cost is about 1 seek (see comment in Builder::Apply).
-    return UpdateStats(state.stats);
-  }*/
-  return false;
+  // runs.  A key served by a single run costs no bounce, every further
+  // run costs one, so all runs but the oldest are charged.
+  bool result = false;
+  for (size_t i = 0; i + 1 < overlaps.size(); i++) {
+    if (ChargeRun(overlaps[i].first, overlaps[i].second)) {
+      result = true;
+    }
+  }
+  return result;
 }
 
 //增加对Version的引用
@@ -762,6 +790,33 @@ void Version::GetOverlappingInputs(int level, const InternalKey* begin,
   }
 }
 
+void Version::GetOverlappingRuns(int level, const InternalKey* begin,
+                                 const InternalKey* end,
+                                 std::vector<SortedRun*>* runs) {
+  assert(level >= 0);
+  assert(level < config::kNumLevels);
+  runs->clear();
+  const Comparator* user_cmp = vset_->icmp_.user_comparator();
+  for (size_t i = 0; i < runs_[level].size(); i++) {
+    SortedRun* run = runs_[level][i];
+    const std::vector<FileMetaData*>* files = run->GetContainFile();
+    if (files->empty()) {
+      continue;
+    }
+    const Slice run_start = run->GetSmallest().user_key();
+    const Slice run_limit = run->GetLargest().user_key();
+    if (begin != nullptr &&
+        user_cmp->Compare(run_limit, begin->user_key()) < 0) {
+      // "run" is completely before specified range; skip it
+    } else if (end != nullptr &&
+               user_cmp->Compare(run_start, end->user_key()) > 0) {
+      // "run" is completely after specified range; skip it
+    } else {
+      runs->push_back(run);
+    }
+  }
+}
+
 std::string Version::DebugString() const {
   std::string r;
   for (int level = 0; level < config::kNumLevels; level++) {
@@ -810,19 +865,28 @@ class VersionSet::Builder {
   };*/
 
   //typedef std::set<FileMetaData*, BySmallestKey> FileSet;
-  typedef std::set<SortedRun*> RunSet;
+  typedef std::vector<SortedRun*> RunSet;
   struct LevelState {
     //LevelState():added_run(nullptr){};
     //std::set<uint64_t> deleted_files;
     std::set<uint64_t> deleted_runs;
     //FileSet* added_files;
+    //按edit应用的顺序记录新增的run，持有它们的引用
     RunSet* added_run;
+    //本层所有run从旧到新的顺序，由base runs开始，随edit一起更新
+    std::vector<SortedRun*> runs;
   };
 
   VersionSet* vset_;
   Version* base_;
   LevelState levels_[config::kNumLevels];
   std::unordered_map<uint64_t, SortedRun*> L0_file_to_run_tmp_;
+  //run id -> 需要从该run中直接丢弃的文件
+  std::unordered_map<uint64_t, std::set<uint64_t>> deleted_run_files_;
+  //run id -> 从该run血缘中截掉的L0
+  std::unordered_map<uint64_t, std::set<uint64_t>> dropped_lineage_;
+  //SaveTo中因丢弃文件或截断血缘而替换出的新run，需要把其血缘中的L0重新映射过去
+  std::vector<SortedRun*> replaced_runs_;
 
  public:
   // Initialize a builder with the files from *base and other info from *vset
@@ -836,6 +900,7 @@ class VersionSet::Builder {
     }*/
     for (int level = 0; level < config::kNumLevels; level++){
       levels_[level].added_run = new RunSet();
+      levels_[level].runs = base_->runs_[level];
     }
   }
 
@@ -874,13 +939,26 @@ class VersionSet::Builder {
   // Apply all of the edits in *edit to the current state.
   //将edit中的所有编辑应用于当前状态。
   void Apply(const VersionEdit* edit) {
+    for (const auto& deleted_run_file : edit->deleted_run_files_) {
+      deleted_run_files_[deleted_run_file.first].insert(deleted_run_file.second);
+    }
+    //截掉的L0不再映射到任何run
+    for (const auto& dropped : edit->dropped_lineage_) {
+      for (uint64_t L0 : dropped.second) {
+        dropped_lineage_[dropped.first].insert(L0);
+        L0_file_to_run_tmp_[L0] = nullptr;
+      }
+    }
     //一次edit只有一个新增run
     if(!edit->snapshot_runs_.empty()){
       for(int i = 0; i < edit->snapshot_runs_.size(); i++){
         uint64_t output_level = edit->snapshot_runs_[i].GetLevel();
         SortedRun* r = new SortedRun(edit->snapshot_runs_[i]);
         r->ref_ = 1;
-        levels_[output_level].added_run->insert(r);
+        r->UpdateMetadata();
+        r->allowed_seeks_ = RunAllowedSeeks(r);
+        levels_[output_level].added_run->push_back(r);
+        levels_[output_level].runs.push_back(r);
         std::vector<uint64_t>* Run_To_L0_File = r->GetRunToL0();
         std::vector<uint64_t>::iterator iter = Run_To_L0_File->begin();
         for(; iter != Run_To_L0_File->end(); iter++){
@@ -895,10 +973,33 @@ class VersionSet::Builder {
       return ;
     }
     SortedRun* r = new SortedRun(edit->new_run_);//ref初始化为0
+    //r与edit->new_run_共享血缘vector，在上面追加会使编码进MANIFEST的血缘
+    //在恢复时被重复追加。新run的血缘只由下面删除的run决定
+    r->ResetL0Files();
     r->ref_ = 1;//version对run的引用
+    r->UpdateMetadata();
+    r->allowed_seeks_ = RunAllowedSeeks(r);
     //对新增run，更新contains_file_
 
-    levels_[output_level].added_run->insert(r);
+    levels_[output_level].added_run->push_back(r);
+    //合并到下一层的输出比下一层已有的run都新，放在最后；
+    //原地合并的输入是本层相邻的若干run，输出放在它们原来的位置
+    std::vector<SortedRun*>* order = &levels_[output_level].runs;
+    size_t pos = order->size();
+    if (output_level > 0) {
+      std::vector<SortedRun*>* inputs = &levels_[input_level].runs;
+      size_t kept = 0;
+      for (size_t i = 0; i < inputs->size(); i++) {
+        if (edit->deleted_map_.count((*inputs)[i]->GetID()) == 0) {
+          (*inputs)[kept++] = (*inputs)[i];
+        } else if (input_level == output_level && kept < pos) {
+          pos = kept;
+        }
+      }
+      inputs->resize(kept);
+      pos = std::min(pos, order->size());
+    }
+    order->insert(order->begin() + pos, r);
 
     //需要删除的run：把映射到该run的L0映射改到新run：写在L0_file_to_run_temp_;
     //对于新run，加入映射到该run的L0
@@ -916,6 +1017,7 @@ class VersionSet::Builder {
           }
           r->InsertL0File(iter);
         }
+        ForgetAddedRun(input_level, deleted_run_set_kvp.first);
       }
     }else{
       //对于L0层的run，其包含的file，就是会映射到它的L0 file
@@ -925,22 +1027,42 @@ class VersionSet::Builder {
     }
   }
 
+  // A run added by an earlier edit of this builder was merged away again:
+  // release it now instead of carrying it to SaveTo.  Recovery applies the
+  // whole MANIFEST to one builder, so only the runs still live at the end
+  // stay in memory.
+  void ForgetAddedRun(int level, uint64_t id) {
+    RunSet* added = levels_[level].added_run;
+    for (RunSet::iterator it = added->begin(); it != added->end(); ++it) {
+      SortedRun* run = *it;
+      if (run->GetID() != id) {
+        continue;
+      }
+      added->erase(it);
+      //血缘已经重新映射到新run，这里只清理遗留的映射
+      for (uint64_t L0 : *(run->GetRunToL0())) {
+        auto L0_iter = L0_file_to_run_tmp_.find(L0);
+        if (L0_iter != L0_file_to_run_tmp_.end() && L0_iter->second == run) {
+          L0_iter->second = nullptr;
+        }
+      }
+      run->ref_--;
+      if (run->ref_ <= 0) {
+        delete run;
+      }
+      return;
+    }
+  }
+
   // Save the current state in *v.
   void SaveTo(Version* v) {
     //BySmallestKey cmp;
     //cmp.internal_comparator = &vset_->icmp_;
 
     for (int level = 0; level < config::kNumLevels; level++) {
-      const std::vector<SortedRun*>& base_runs = base_->runs_[level];
-      std::vector<SortedRun*>::const_iterator base_run_iter = base_runs.begin();
-      std::vector<SortedRun*>::const_iterator base_run_end = base_runs.end();
-      RunSet* added_run = levels_[level].added_run;
-      v->runs_[level].reserve(base_runs.size() + added_run->size());
-      for(; base_run_iter != base_run_end; ++base_run_iter){
-        MaybeAddRun(v, level, *base_run_iter);
-      }
-      const RunSet* added_runs = levels_[level].added_run;
-      for (const auto& run : *added_runs) {
+      const std::vector<SortedRun*>& level_runs = levels_[level].runs;
+      v->runs_[level].reserve(level_runs.size());
+      for (SortedRun* run : level_runs) {
         MaybeAddRun(v, level, run);
       }
 
@@ -953,14 +1075,14 @@ class VersionSet::Builder {
       }
     }
 
-    const std::unordered_map<uint64_t, SortedRun*>& base_map = base_->L0_file_to_run_;
-    v->L0_file_to_run_ = base_map;
+    //新Version与base共享映射表，只复制被修改的路径
+    v->L0_file_to_run_ = base_->L0_file_to_run_;
     for(const auto& map : L0_file_to_run_tmp_){
-      const std::unordered_map<uint64_t, SortedRun*>::iterator iter = v->L0_file_to_run_.find(map.first);
-      if(iter != v->L0_file_to_run_.end()){
-        iter->second = map.second;
-      }else{
-        v->L0_file_to_run_.insert(map);
+      v->L0_file_to_run_.Set(map.first, map.second);
+    }
+    for (SortedRun* run : replaced_runs_) {
+      for (uint64_t L0 : *(run->GetRunToL0())) {
+        v->L0_file_to_run_.Set(L0, run);
       }
     }
 
@@ -990,10 +1112,44 @@ class VersionSet::Builder {
       //本来存在在旧文件中的run，此时要删除
 
     } else {
+      auto dropped = deleted_run_files_.find(run->GetID());
+      auto truncated = dropped_lineage_.find(run->GetID());
+      if (dropped != deleted_run_files_.end() ||
+          truncated != dropped_lineage_.end()) {
+        run = ReplaceRun(
+            level, run,
+            dropped != deleted_run_files_.end() ? &dropped->second : nullptr,
+            truncated != dropped_lineage_.end() ? &truncated->second
+                                                : nullptr);
+      }
       run->ref_++;
       runs->push_back(run);
     }
   }
+
+  // Return a copy of "run" without the files in "dropped" and without the
+  // L0 numbers in "dropped_lineage" (either may be null).  The copy keeps
+  // the id and the rest of the lineage so the B+ tree entries still
+  // resolve to it.
+  SortedRun* ReplaceRun(int level, const SortedRun* run,
+                        const std::set<uint64_t>* dropped,
+                        const std::set<uint64_t>* dropped_lineage) {
+    SortedRun* r = new SortedRun(run->GetID(), level);
+    r->allowed_seeks_ = run->allowed_seeks_;
+    for (FileMetaData* f : *(run->GetContainFile())) {
+      if (dropped == nullptr || dropped->count(f->number) == 0) {
+        r->InsertContainFile(f);
+      }
+    }
+    for (uint64_t L0 : *(run->GetRunToL0())) {
+      if (dropped_lineage == nullptr || dropped_lineage->count(L0) == 0) {
+        r->InsertL0File(L0);
+      }
+    }
+    r->UpdateMetadata();
+    replaced_runs_.push_back(r);
+    return r;
+  }
 };
 
 //一个数据库只有一个VersionSet
@@ -1014,6 +1170,7 @@ VersionSet::VersionSet(const std::string& dbname, const Options* options,
       next_run_number_(1),
       descriptor_file_(nullptr),
       descriptor_log_(nullptr),
+      manifest_file_size_(0),
       dummy_versions_(this),
       current_(nullptr) {
   AppendVersion(new Version(this));
@@ -1059,6 +1216,21 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     edit->SetPrevLogNumber(prev_log_number_);
   }
 
+  //MANIFEST过大时换用新的MANIFEST：新文件以current_的快照开头，
+  //恢复时不必再重放旧文件中的edit。新文件编号要在记录next file之前分配
+  const uint64_t old_manifest_file_number = manifest_file_number_;
+  const uint64_t old_manifest_file_size = manifest_file_size_;
+  log::Writer* old_descriptor_log = nullptr;
+  WritableFile* old_descriptor_file = nullptr;
+  if (descriptor_log_ != nullptr &&
+      manifest_file_size_ >= options_->max_manifest_file_size) {
+    old_descriptor_log = descriptor_log_;
+    old_descriptor_file = descriptor_file_;
+    descriptor_log_ = nullptr;
+    descriptor_file_ = nullptr;
+    manifest_file_number_ = NewFileNumber();
+  }
+
   edit->SetNextFile(next_file_number_);
   edit->SetLastSequence(last_sequence_);
 
@@ -1079,37 +1251,48 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   //这样通过原始的version加上一系列的versionedit的记录，就可以恢复到最新状态。
   //博客：https://blog.csdn.net/weixin_36145588/article/details/77978433
   std::string new_manifest_file;
+  std::vector<std::string> snapshot;
   Status s;
   if (descriptor_log_ == nullptr) {
-    // No reason to unlock *mu here since we only hit this path in the
-    // first call to LogAndApply (when opening the database).
-    //只有打开数据库时会运行这段
+    // Hit when opening the database, and when the old MANIFEST grew past
+    // max_manifest_file_size.
+    //打开数据库时、或者旧MANIFEST过大时运行这段
     assert(descriptor_file_ == nullptr);
     //返回dbname/MANIFEST-number （文件名）
     new_manifest_file = DescriptorFileName(dbname_, manifest_file_number_);
-    s = env_->NewWritableFile(new_manifest_file, &descriptor_file_);
-    if (s.ok()) {
-      //descriptor_log_用来写file
-      descriptor_log_ = new log::Writer(descriptor_file_);
-      //保存一次完整快照（整个数据库中那些层保存哪些文件..）
-      //作为Manifest的新起点，在此基准上叠加edit
-      //这次快照保存的Version是LogAndAppend调用之前的Version
-      //因为前半段LogAndAppend并没有修改VersionSet的current_指针
-      //“保存Version”=将这个Version的所有内容以edit形式记录
-      s = WriteSnapshot(descriptor_log_);
-    }
+    //保存一次完整快照（整个数据库中那些层保存哪些文件..）
+    //作为Manifest的新起点，在此基准上叠加edit
+    //这次快照保存的Version是LogAndAppend调用之前的Version
+    //因为前半段LogAndAppend并没有修改VersionSet的current_指针
+    //“保存Version”=将这个Version的所有内容以edit形式记录
+    //快照在持锁时编码，释放锁之后再写入
+    EncodeSnapshot(&snapshot);
   }
 
   // Unlock during expensive MANIFEST log write
   {
     mu->Unlock();
 
+    if (!new_manifest_file.empty()) {
+      s = env_->NewWritableFile(new_manifest_file, &descriptor_file_);
+      if (s.ok()) {
+        //descriptor_log_用来写file
+        descriptor_log_ = new log::Writer(descriptor_file_);
+        manifest_file_size_ = 0;
+        for (size_t i = 0; i < snapshot.size() && s.ok(); i++) {
+          s = descriptor_log_->AddRecord(snapshot[i]);
+          manifest_file_size_ += snapshot[i].size();
+        }
+      }
+    }
+
     // Write new record to MANIFEST log
     if (s.ok()) {
       std::string record;
       edit->EncodeTo(&record);
       //把本次应用的edit加入manifest
       s = descriptor_log_->AddRecord(record);
+      manifest_file_size_ += record.size();
       if (s.ok()) {
         s = descriptor_file_->Sync();
       }
@@ -1146,6 +1329,23 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     }
   }
 
+  if (old_descriptor_log != nullptr) {
+    if (s.ok()) {
+      //旧MANIFEST由RemoveObsoleteFiles删除
+      Log(options_->info_log, "Rolled MANIFEST #%llu over to #%llu\n",
+          static_cast<unsigned long long>(old_manifest_file_number),
+          static_cast<unsigned long long>(manifest_file_number_));
+      delete old_descriptor_log;
+      delete old_descriptor_file;
+    } else {
+      //新MANIFEST没有装上，继续写旧的
+      descriptor_log_ = old_descriptor_log;
+      descriptor_file_ = old_descriptor_file;
+      manifest_file_number_ = old_manifest_file_number;
+      manifest_file_size_ = old_manifest_file_size;
+    }
+  }
+
   return s;
 }
 
@@ -1191,6 +1391,7 @@ Status VersionSet::Recover(bool* save_manifest) {
   uint64_t last_sequence = 0;
   uint64_t log_number = 0;
   uint64_t prev_log_number = 0;
+  uint64_t max_run_number = 0;
   //以current_为base开始恢复
   //此时的current为空
   Builder builder(this, current_);
@@ -1219,6 +1420,11 @@ Status VersionSet::Recover(bool* save_manifest) {
       if (s.ok()) {
         //应用到builder上
         builder.Apply(&edit);
+        //run编号不单独记录，从出现过的run中恢复
+        max_run_number = std::max(max_run_number, edit.new_run_.GetID());
+        for (const SortedRun& r : edit.snapshot_runs_) {
+          max_run_number = std::max(max_run_number, r.GetID());
+        }
       }
 
       if (edit.has_log_number_) {
@@ -1276,6 +1482,7 @@ Status VersionSet::Recover(bool* save_manifest) {
     last_sequence_ = last_sequence;
     log_number_ = log_number;
     prev_log_number_ = prev_log_number;
+    next_run_number_ = max_run_number + 1;
 
     // See if we can reuse the existing MANIFEST file.
     //dscname=dbname+current
@@ -1339,6 +1546,7 @@ bool VersionSet::ReuseManifest(const std::string& dscname,
 
   Log(options_->info_log, "Reusing MANIFEST %s\n", dscname.c_str());
   descriptor_log_ = new log::Writer(descriptor_file_, manifest_size);
+  manifest_file_size_ = manifest_size;
   manifest_file_number_ = manifest_number;//记录当前正在写入的manifestfile num
   return true;
 }
@@ -1389,10 +1597,31 @@ void VersionSet::Finalize(Version* v) {
           static_cast<double>(level_bytes) / MaxBytesForLevel(options_, level);
     }*/
   
+  int num_runs = 0;
+  int64_t pending_bytes = 0;
+  bool long_lineage = false;
   for (int level = 0; level < config::kNumLevels; level++){
+    num_runs += v->runs_[level].size();
+    for (const SortedRun* run : v->runs_[level]) {
+      if (run->GetRunToL0()->size() > config::kMaxRunLineage) {
+        long_lineage = true;
+      }
+    }
+    //最后一层只能在本层内合并，单个run无需再合并
+    if (level == config::kNumLevels - 1 && v->runs_[level].size() < 2) {
+      continue;
+    }
     const uint64_t level_bytes = TotalFileSize(v->files_[level]);
     double score;
     score = static_cast<double>(level_bytes) / MaxBytesForLevel(options_, level);
+    //run过多的层即使没超过大小上限也需要合并，防止run无限堆积
+    score = std::max(score, v->runs_[level].size() /
+                                static_cast<double>(
+                                    config::kLevelRunCompactionTrigger));
+    //超过上限的层迟早要整体重写一次，计入待compaction字节数
+    if (score >= 1) {
+      pending_bytes += level_bytes;
+    }
 
     //记录最高分和对应的层
     if (score > best_score) {
@@ -1404,11 +1633,13 @@ void VersionSet::Finalize(Version* v) {
   //记录即将进行compaction的层
   v->compaction_level_ = best_level;
   v->compaction_score_ = best_score;
+  v->num_runs_ = num_runs;
+  v->pending_compaction_bytes_ = pending_bytes;
+  v->long_lineage_ = long_lineage;
 }
 
-Status VersionSet::WriteSnapshot(log::Writer* log) {
-  // TODO: Break up into multiple records to reduce memory usage on recovery?
-
+void VersionSet::EncodeSnapshot(std::vector<std::string>* records) {
+  //快照按run拆成多条记录，恢复时不必一次读入整个Version
   // Save metadata
   //保存一次完整记录（数据库的完整信息）
   VersionEdit edit;
@@ -1425,6 +1656,8 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
   }*/
 
   // Save files
+  //run按层、层内从旧到新的顺序写出，恢复时按同样的顺序加入
+  size_t entries = 0;
   for (int level = 0; level < config::kNumLevels; level++) {
     //只记录current这个Version的信息
     /*const std::vector<FileMetaData*>& files = current_->files_[level];
@@ -1436,15 +1669,22 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<SortedRun*>& runs = current_->runs_[level];
     for(size_t i = 0; i < runs.size(); i++){
       SortedRun* r = runs[i];
+      const size_t run_entries =
+          r->GetContainFile()->size() + r->GetRunToL0()->size();
+      if (entries > 0 &&
+          entries + run_entries > config::kSnapshotEntriesPerRecord) {
+        records->resize(records->size() + 1);
+        edit.EncodeTo(&records->back());
+        edit.Clear();
+        entries = 0;
+      }
       edit.AddSnapshotRun(*r);
-
+      entries += run_entries;
     }
   }
 
-  std::string record;
-  edit.EncodeTo(&record);
-  //edit的信息写入log(manifest)
-  return log->AddRecord(record);
+  records->resize(records->size() + 1);
+  edit.EncodeTo(&records->back());
 }
 
 //返回level层有多少个文件
@@ -1454,6 +1694,12 @@ int VersionSet::NumLevelFiles(int level) const {
   return current_->files_[level].size();
 }
 
+int VersionSet::NumLevelRuns(int level) const {
+  assert(level >= 0);
+  assert(level < config::kNumLevels);
+  return current_->runs_[level].size();
+}
+
 //  struct LevelSummaryStorage {
 //    char buffer[100];
 //  };
@@ -1472,43 +1718,69 @@ const char* VersionSet::LevelSummary(LevelSummaryStorage* scratch) const {
 //返回ikey在数据库中大概的偏移量
 uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
   uint64_t result = 0;
-  //对每一层
+  //同一层的多个run相互重叠，files_[level]不再整体有序，逐个run计算：
+  //整个run在ikey之前时直接加上run的大小，在ikey之后时跳过，都不必打开文件
   for (int level = 0; level < config::kNumLevels; level++) {
-    const std::vector<FileMetaData*>& files = v->files_[level];
-    //对每一层的每一个文件
-    for (size_t i = 0; i < files.size(); i++) {
-      //ikey超出了当前这个文件的范围
-      if (icmp_.Compare(files[i]->largest, ikey) <= 0) {
-        // Entire file is before "ikey", so just add the file size
-        result += files[i]->file_size;//加上当前的文件
-      } else if (icmp_.Compare(files[i]->smallest, ikey) > 0) {
-        //ikey在这个文件的开头之前
-        // Entire file is after "ikey", so ignore
-        if (level > 0) {
-          //非L0层，后面的文件不可能包含ikey
-          // Files other than level 0 are sorted by meta->smallest, so
-          // no further files in this level will contain data for
-          // "ikey".
+    for (const SortedRun* run : v->runs_[level]) {
+      const std::vector<FileMetaData*>& files = *(run->GetContainFile());
+      if (files.empty()) {
+        continue;
+      }
+      if (icmp_.Compare(run->GetLargest(), ikey) <= 0) {
+        // Entire run is before "ikey", so just add the run size
+        result += run->GetTotalBytes();
+        continue;
+      }
+      if (icmp_.Compare(run->GetSmallest(), ikey) > 0) {
+        // Entire run is after "ikey", so ignore
+        continue;
+      }
+      for (size_t i = 0; i < files.size(); i++) {
+        if (icmp_.Compare(files[i]->largest, ikey) <= 0) {
+          // Entire file is before "ikey", so just add the file size
+          result += files[i]->file_size;
+        } else if (icmp_.Compare(files[i]->smallest, ikey) > 0) {
+          // Files of a run are sorted by meta->smallest, so no further
+          // files in this run will contain data for "ikey".
           break;
+        } else {
+          // "ikey" falls in the range for this table.  Add the
+          // approximate offset of "ikey" within the table.
+          Table* tableptr;
+          Iterator* iter = table_cache_->NewIterator(
+              ReadOptions(), files[i]->number, files[i]->file_size, &tableptr);
+          if (tableptr != nullptr) {
+            result += tableptr->ApproximateOffsetOf(ikey.Encode());
+          }
+          delete iter;
         }
-      } else {
-        //落在文件里
-        // "ikey" falls in the range for this table.  Add the
-        // approximate offset of "ikey" within the table.
-        Table* tableptr;
-        //跳过table cache获得读table的迭代器
-        Iterator* iter = table_cache_->NewIterator(
-            ReadOptions(), files[i]->number, files[i]->file_size, &tableptr);
-        if (tableptr != nullptr) {//获得ikey在table中的大致位置
-          result += tableptr->ApproximateOffsetOf(ikey.Encode());
-        }
-        delete iter;
       }
     }
   }
   return result;
 }
 
+void VersionSet::PickLineageCompaction(
+    VersionEdit* edit, std::unordered_map<uint64_t, uint64_t>* remap) {
+  for (int level = 0; level < config::kNumLevels; level++) {
+    for (const SortedRun* run : current_->runs_[level]) {
+      const std::vector<uint64_t>* lineage = run->GetRunToL0();
+      if (lineage->size() <= config::kMaxRunLineage) {
+        continue;
+      }
+      //保留第一个L0（与RebuildTree一致），其余的都映射到它
+      const uint64_t kept = lineage->at(0);
+      std::vector<uint64_t> dropped;
+      for (uint64_t L0 : *lineage) {
+        if (L0 != kept && remap->insert(std::make_pair(L0, kept)).second) {
+          dropped.push_back(L0);
+        }
+      }
+      edit->DropRunLineage(run->GetID(), dropped);
+    }
+  }
+}
+
 //保存仍被引用的文件（暂时还不能删除）到live中
 void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
   //对于每个Version
@@ -1538,6 +1810,16 @@ int64_t VersionSet::NumLevelBytes(int level) const {
   return TotalFileSize(current_->files_[level]);
 }
 
+size_t VersionSet::MaxRunLineage() const {
+  size_t result = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    for (const SortedRun* run : current_->runs_[level]) {
+      result = std::max(result, run->GetRunToL0()->size());
+    }
+  }
+  return result;
+}
+
 int64_t VersionSet::MaxNextLevelOverlappingBytes() {
   int64_t result = 0;
   std::vector<FileMetaData*> overlaps;
@@ -1600,6 +1882,8 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   options.verify_checksums = options_->paranoid_checks;
   //这些迭代器读出的数据不缓存在内存
   options.fill_cache = false;
+  //输入文件是顺序读的：每次预读一大段，而不是每个block一次小读
+  options.readahead_size = options_->compaction_readahead_size;
 
   // Level-0 files have to be merged together.  For other levels,
   // we will make a concatenating iterator per level.
@@ -1644,10 +1928,14 @@ Compaction* VersionSet::PickCompaction() {
   //std::cout<<"score:"<<current_->compaction_score_<<std::endl;
   //std::cout<<"level:"<<current_->compaction_level_<<std::endl;
 
+  const bool seek_compaction = (current_->run_to_compact_ != nullptr);
+
   if (size_compaction) {
     level = current_->compaction_level_;
     assert(level >= 0);
-    c = new Compaction(options_, level);
+    //最后一层没有下一层，只能在本层内合并
+    c = new Compaction(options_, level,
+                       std::min(level + 1, config::kNumLevels - 1));
 
     for(size_t i = 0; i < current_->runs_[level].size() && i < GetTieredTriggerNum(level); i++){
       //if(level == 0){
@@ -1662,6 +1950,31 @@ Compaction* VersionSet::PickCompaction() {
       //}
     }
     
+  } else if (seek_compaction) {
+    //读驱动的compaction：从本层最旧的run开始合并到被频繁读取的run为止，
+    //输入的run数和字节数都有上限，超出时先合并最旧的一部分
+    level = current_->run_to_compact_level_;
+    c = new Compaction(options_, level,
+                       std::min(level + 1, config::kNumLevels - 1));
+    const std::vector<SortedRun*>& runs = current_->runs_[level];
+    const int64_t budget = ExpandedCompactionByteSizeLimit(options_);
+    int64_t input_bytes = 0;
+    for (size_t i = 0; i < runs.size(); i++) {
+      if (i >= 2 && (i >= static_cast<size_t>(GetTieredTriggerNum(level)) ||
+                     input_bytes >= budget)) {
+        break;
+      }
+      SortedRun* run = runs[i];
+      c->inputs_runs_.push_back(run);
+      std::vector<FileMetaData*>* files = run->GetContainFile();
+      for (size_t j = 0; j < files->size(); j++) {
+        c->inputs_.push_back((*files)[j]);
+      }
+      input_bytes += run->GetTotalBytes();
+      if (run == current_->run_to_compact_) {
+        break;
+      }
+    }
   } else {
     return nullptr;
   }
@@ -1828,51 +2141,83 @@ FileMetaData* FindSmallestBoundaryFile(
   c->edit_.SetCompactPointer(level, largest);
 }*/
 
-/*Compaction* VersionSet::CompactRange(int level, const InternalKey* begin,
-                                     const InternalKey* end) {
-  std::vector<FileMetaData*> inputs;
-  current_->GetOverlappingInputs(level, begin, end, &inputs);
-  if (inputs.empty()) {
+Compaction* VersionSet::CompactRange(int level, int output_level,
+                                     const InternalKey* begin,
+                                     const InternalKey* end,
+                                     const std::set<uint64_t>& merged_runs) {
+  assert(output_level == level || output_level == level + 1);
+  assert(output_level > 0);  // L0 runs hold exactly one file
+  assert(output_level < config::kNumLevels);
+  std::vector<SortedRun*> overlapping;
+  current_->GetOverlappingRuns(level, begin, end, &overlapping);
+  if (overlapping.empty()) {
+    return nullptr;
+  }
+
+  // Runs of a level are kept from oldest to newest and every run of a
+  // level is newer than the runs below it.  To preserve that order the
+  // inputs are a contiguous sequence of runs, up to and including the
+  // newest run that overlaps the range.  They start with the oldest run of
+  // the level, or right after the newest run an earlier chunk of this
+  // compaction produced, so that those outputs are not merged again.
+  const std::vector<SortedRun*>& level_runs = current_->runs_[level];
+  size_t first = 0;
+  for (size_t i = 0; i < level_runs.size(); i++) {
+    if (merged_runs.count(level_runs[i]->GetID()) > 0) {
+      first = i + 1;
+    }
+  }
+  std::vector<SortedRun*> runs;
+  for (size_t i = first; i < level_runs.size(); i++) {
+    runs.push_back(level_runs[i]);
+    if (level_runs[i] == overlapping.back()) {
+      break;
+    }
+  }
+  if (runs.empty() || runs.back() != overlapping.back()) {
+    return nullptr;
+  }
+
+  // Merging in place only makes progress if there are at least two runs.
+  const size_t min_runs = (output_level == level) ? 2 : 1;
+  if (runs.size() < min_runs) {
     return nullptr;
   }
 
   // Avoid compacting too much in one shot in case the range is large.
-  // But we cannot do this for level-0 since level-0 files can overlap
-  // and we must not pick one file and drop another older file if the
-  // two files overlap.
-  if (level > 0) {
-    //获得参数信息
-    const uint64_t limit = MaxFileSizeForLevel(options_, level);
-    uint64_t total = 0;
-    for (size_t i = 0; i < inputs.size(); i++) {
-      uint64_t s = inputs[i]->file_size;
-      total += s;
-      if (total >= limit) {
-        inputs.resize(i + 1);
-        break;
-      }
+  // Runs are whole units here (the L0 lineage of a run cannot be split),
+  // so the limit is applied run by run; the remaining runs are picked up
+  // by the next call once pending flushes had a chance to run.
+  const int64_t limit = ExpandedCompactionByteSizeLimit(options_);
+  int64_t total = 0;
+  for (size_t i = 0; i < runs.size(); i++) {
+    total += runs[i]->GetTotalBytes();
+    if (i + 1 >= min_runs && total >= limit) {
+      runs.resize(i + 1);
+      break;
     }
   }
 
-  Compaction* c = new Compaction(options_, level);
+  Compaction* c = new Compaction(options_, level, output_level);
   c->input_version_ = current_;
   c->input_version_->Ref();
-  c->inputs_[0] = inputs;
-  SetupOtherInputs(c);
+  for (size_t i = 0; i < runs.size(); i++) {
+    c->inputs_runs_.push_back(runs[i]);
+    const std::vector<FileMetaData*>* files = runs[i]->GetContainFile();
+    c->inputs_.insert(c->inputs_.end(), files->begin(), files->end());
+  }
   return c;
-}*/
+}
 
-Compaction::Compaction(const Options* options, int level)
+Compaction::Compaction(const Options* options, int level, int output_level)
     : level_(level),
+      output_level_(output_level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
       input_version_(nullptr),
       grandparent_index_(0),
       seen_key_(false),
-      overlapped_bytes_(0) {
-  for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
-  }
-}
+      overlapped_bytes_(0),
+      older_runs_ready_(false) {}
 
 Compaction::~Compaction() {
   if (input_version_ != nullptr) {
@@ -1895,31 +2240,116 @@ void Compaction::AddRunDeletions(VersionEdit* edit){
     edit->RemoveRun(inputs_runs_[i]);
   }
 }
+
+void Compaction::AddInputLineage(std::set<uint64_t>* lineage) const {
+  for (const SortedRun* run : inputs_runs_) {
+    lineage->insert(run->GetRunToL0()->begin(), run->GetRunToL0()->end());
+  }
+}
+//输入是level_中相邻的若干run，同层在它们之前的run和更深的层保存着更旧的数据
+void Compaction::GetOlderRuns(std::vector<SortedRun*>* runs) const {
+  for (SortedRun* run : input_version_->runs_[level_]) {
+    if (inputs_runs_.empty() || run == inputs_runs_.front()) {
+      break;
+    }
+    runs->push_back(run);
+  }
+  for (int lvl = level_ + 1; lvl < config::kNumLevels; lvl++) {
+    runs->insert(runs->end(), input_version_->runs_[lvl].begin(),
+                 input_version_->runs_[lvl].end());
+  }
+}
+
 //当key的type是delete的时候
 //如果level+1以上都没有该key
 //则直接丢弃该key
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
-  // Maybe use binary search to find right entry instead of linear search?
+void Compaction::InitOlderRuns() {
+  //所有输入run的key范围，与之不重叠的更旧run不可能包含输入中的key
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
-  for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
-    //对level+1后的每一层的文件
-    const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    //level_ptrs_[lvl]用来保存已经检查到lvl的哪一个sstable
-    while (level_ptrs_[lvl] < files.size()) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
-      //userkey在f访问内，退出
+  Slice smallest, largest;
+  bool has_range = false;
+  for (const SortedRun* run : inputs_runs_) {
+    if (run->GetContainFile()->empty()) {
+      continue;
+    }
+    if (!has_range ||
+        user_cmp->Compare(run->GetSmallest().user_key(), smallest) < 0) {
+      smallest = run->GetSmallest().user_key();
+    }
+    if (!has_range ||
+        user_cmp->Compare(run->GetLargest().user_key(), largest) > 0) {
+      largest = run->GetLargest().user_key();
+    }
+    has_range = true;
+  }
+  std::vector<SortedRun*> candidates;
+  GetOlderRuns(&candidates);
+  for (SortedRun* run : candidates) {
+    if (run->GetContainFile()->empty()) {
+      continue;
+    }
+    if (has_range &&
+        (user_cmp->Compare(run->GetLargest().user_key(), smallest) < 0 ||
+         user_cmp->Compare(run->GetSmallest().user_key(), largest) > 0)) {
+      continue;
+    }
+    older_runs_.push_back(run);
+  }
+  run_ptrs_.assign(older_runs_.size(), 0);
+  older_runs_ready_ = true;
+}
+
+bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+  if (!older_runs_ready_) {
+    InitOlderRuns();
+  }
+  const VersionSet* vset = input_version_->vset_;
+  const Comparator* user_cmp = vset->icmp_.user_comparator();
+  for (size_t i = 0; i < older_runs_.size(); i++) {
+    //run内文件有序且不重叠，key递增，所以每个run只需向前推进
+    const std::vector<FileMetaData*>& files = *(older_runs_[i]->GetContainFile());
+    while (run_ptrs_[i] < files.size()) {
+      FileMetaData* f = files[run_ptrs_[i]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
-          // Key falls in this file's range, so definitely not base level
-          return false;//不可直接丢弃
+          // Key falls in this file's range; ask its filter
+          InternalKey ikey(user_key, kMaxSequenceNumber, kValueTypeForSeek);
+          if (vset->table_cache_->KeyMayMatch(f->number, f->file_size,
+                                              ikey.Encode())) {
+            return false;
+          }
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      run_ptrs_[i]++;
     }
   }
-  return true;//后续level都不存在该key
+  return true;
+}
+
+bool Compaction::IsBaseLevelForRange(const Slice& begin, const Slice& end) {
+  const InternalKeyComparator& icmp = input_version_->vset_->icmp_;
+  const Comparator* user_cmp = icmp.user_comparator();
+  InternalKey begin_key(begin, kMaxSequenceNumber, kValueTypeForSeek);
+  //范围删除的end可以超出输入run的范围，不能用older_runs_，逐个检查所有更旧的run
+  std::vector<SortedRun*> older;
+  GetOlderRuns(&older);
+  for (SortedRun* run : older) {
+    const std::vector<FileMetaData*>& files = *(run->GetContainFile());
+    if (files.empty() ||
+        user_cmp->Compare(run->GetLargest().user_key(), begin) < 0 ||
+        user_cmp->Compare(run->GetSmallest().user_key(), end) >= 0) {
+      continue;
+    }
+    //第一个largest >= begin的文件，若它从end之前开始则与[begin, end)重叠
+    uint32_t index = FindFile(icmp, files, begin_key.Encode());
+    if (index < files.size() &&
+        user_cmp->Compare(files[index]->smallest.user_key(), end) < 0) {
+      return false;
+    }
+  }
+  return true;
 }
 
 //compaction到这个key时与level+2层重叠是否超出阈值
@@ -23,9 +23,11 @@
 
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 #include "db/dbformat.h"
+#include "db/l0_run_map.h"
 #include "db/version_edit.h"
 #include "db/run_manager.h"
 #include "port/port.h"
@@ -71,13 +73,19 @@ bool SomeFileOverlapsRange(const InternalKeyComparator& icmp,
 
 class Version {
  public:
+  //一次Get只读B+树指向的run，记录在其中白读（没有找到可见版本）的run
   struct GetStats {
-    FileMetaData* seek_file;
-    int seek_file_level;
+    SortedRun* seek_run;
+    int seek_run_level;
   };
 
   Status RebuildTree(VanillaBPlusTree<std::string, uint64_t>* btree);
 
+  // Insert the keys of "run" into the B+ tree, mapped to the first L0 of
+  // its lineage.  Runs must be indexed from oldest to newest.
+  Status IndexRun(const SortedRun* run,
+                  VanillaBPlusTree<std::string, uint64_t>* btree);
+
   // Append to *iters a sequence of iterators that will
   // yield the contents of this Version when merged together.
   // REQUIRES: This version has been saved (see VersionSet::SaveTo)
@@ -99,7 +107,10 @@ class Version {
 
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
-  // bytes.  Returns true if a new compaction may need to be triggered.
+  // bytes.  Every run overlapping the key but the oldest one is charged a
+  // seek, since an iterator over that part of the key space bounces
+  // between those runs.  Returns true if a new compaction may need to be
+  // triggered.
   // REQUIRES: lock is held
   bool RecordReadSample(Slice key);
 
@@ -116,6 +127,14 @@ class Version {
       const InternalKey* end,    // nullptr means after all keys
       std::vector<FileMetaData*>* inputs);
 
+  // Store in "*runs" every non-empty run in "level" whose key range
+  // overlaps [begin,end], oldest run first.
+  void GetOverlappingRuns(
+      int level,
+      const InternalKey* begin,  // nullptr means before all keys
+      const InternalKey* end,    // nullptr means after all keys
+      std::vector<SortedRun*>* runs);
+
   // Returns true iff some file in the specified level overlaps
   // some part of [*smallest_user_key,*largest_user_key].
   // smallest_user_key==nullptr represents a key smaller than all the DB's keys.
@@ -148,10 +167,13 @@ class Version {
         next_(this),
         prev_(this),
         refs_(0),
-        file_to_compact_(nullptr),
-        file_to_compact_level_(-1),
+        run_to_compact_(nullptr),
+        run_to_compact_level_(-1),
         compaction_score_(-1),
-        compaction_level_(-1) {}
+        compaction_level_(-1),
+        num_runs_(0),
+        pending_compaction_bytes_(0),
+        long_lineage_(false) {}
 
   Version(const Version&) = delete;
   Version& operator=(const Version&) = delete;
@@ -177,16 +199,32 @@ class Version {
   std::vector<FileMetaData*> files_[config::kNumLevels];
   //每层的run
   std::vector<SortedRun*> runs_[config::kNumLevels];
-  std::unordered_map<uint64_t, SortedRun*> L0_file_to_run_;
-  // Next file to compact based on seek stats.
-  FileMetaData* file_to_compact_;
-  int file_to_compact_level_;
+  //L0文件 -> 其数据当前所在的run，与其他Version共享结构
+  L0RunMap L0_file_to_run_;
+  // Charge a wasted read to "run" at "level".  Returns true if the run
+  // ran out of seeks and became run_to_compact_.
+  bool ChargeRun(SortedRun* run, int level);
+
+  // Next run to compact based on seek stats.  Compacting it merges the
+  // oldest runs of its level up to it.
+  SortedRun* run_to_compact_;
+  int run_to_compact_level_;
 
   // Level that should be compacted next and its compaction score.
   // Score < 1 means compaction is not strictly needed.  These fields
   // are initialized by Finalize().
   double compaction_score_;
   int compaction_level_;
+
+  // Write stall inputs, also initialized by Finalize(): the total number
+  // of runs over all levels, and the bytes of the levels whose score is
+  // >= 1 (an estimate of what compaction still has to rewrite).
+  int num_runs_;
+  int64_t pending_compaction_bytes_;
+
+  // True iff some run's lineage is longer than config::kMaxRunLineage.
+  // Also initialized by Finalize().
+  bool long_lineage_;
 };
 
 class VersionSet {
@@ -234,9 +272,21 @@ class VersionSet {
   // Return the number of Table files at the specified level.
   int NumLevelFiles(int level) const;
 
+  // Return the number of runs at the specified level.
+  int NumLevelRuns(int level) const;
+
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
+  // Return the number of runs over all levels.
+  int NumRuns() const { return current_->num_runs_; }
+
+  // Return the estimated bytes compaction has to rewrite before every
+  // level is back under its size limit.
+  int64_t PendingCompactionBytes() const {
+    return current_->pending_compaction_bytes_;
+  }
+
   // Return the last sequence number.
   uint64_t LastSequence() const { return last_sequence_; }
 
@@ -262,17 +312,27 @@ class VersionSet {
   // describes the compaction.  Caller should delete the result.
   Compaction* PickCompaction();
 
-  // Return a compaction object for compacting the range [begin,end] in
-  // the specified level.  Returns nullptr if there is nothing in that
-  // level that overlaps the specified range.  Caller should delete
-  // the result.
-  /*Compaction* CompactRange(int level, const InternalKey* begin,
-                           const InternalKey* end);*/
+  // Return a compaction object that merges the runs of "level" overlapping
+  // the range [begin,end] into a single run at "output_level", which must
+  // be either "level" or "level+1".  Older runs of the level are merged
+  // along so that runs stay ordered by age.  At most
+  // ExpandedCompactionByteSizeLimit bytes of runs are picked per call, so
+  // callers loop until nullptr is returned, passing the ids of the runs
+  // earlier calls produced in "merged_runs": those runs and the runs older
+  // than them are not picked again.  Returns nullptr if nothing left in
+  // that level overlaps the range (or, when output_level == level, if only
+  // one run is left to merge).  Caller should delete the result.
+  Compaction* CompactRange(int level, int output_level,
+                           const InternalKey* begin, const InternalKey* end,
+                           const std::set<uint64_t>& merged_runs);
 
   // Return the maximum overlapping data (in bytes) at next level for any
   // file at a level >= 1.
   int64_t MaxNextLevelOverlappingBytes();
 
+  // Return the length of the longest run lineage.
+  size_t MaxRunLineage() const;
+
   // Create an iterator that reads over the compaction inputs for "*c".
   // The caller should delete the iterator when no longer needed.
   Iterator* MakeInputIterator(Compaction* c);
@@ -281,9 +341,21 @@ class VersionSet {
   bool NeedsCompaction() const {
     Version* v = current_;
     //std::cout<<v->compaction_score_<<std::endl;
-    return (v->compaction_score_ >= 1) || (v->file_to_compact_ != nullptr);
+    return (v->compaction_score_ >= 1) || (v->run_to_compact_ != nullptr) ||
+           v->long_lineage_;
   }
 
+  // Returns true iff some run's lineage should be truncated.
+  bool NeedsLineageCompaction() const { return current_->long_lineage_; }
+
+  // Pick the runs whose lineage is longer than config::kMaxRunLineage.
+  // Each keeps the first L0 number of its lineage: every other one is
+  // added to *remap (mapped to the kept number) and dropped in *edit.
+  // The caller must point the B+ tree entries of *remap at the kept
+  // numbers before applying *edit.
+  void PickLineageCompaction(VersionEdit* edit,
+                             std::unordered_map<uint64_t, uint64_t>* remap);
+
   // Add all files listed in any live version to *live.
   // May also mutate some internal state.
   void AddLiveFiles(std::set<uint64_t>* live);
@@ -320,8 +392,10 @@ class VersionSet {
 
   void SetupOtherInputs(Compaction* c);
 
-  // Save current contents to *log
-  Status WriteSnapshot(log::Writer* log);
+  // Encode the current contents as MANIFEST records appended to *records.
+  // Runs are split over several records of about
+  // config::kSnapshotEntriesPerRecord files and lineage entries each.
+  void EncodeSnapshot(std::vector<std::string>* records);
 
   void AppendVersion(Version* v);
 
@@ -339,6 +413,7 @@ class VersionSet {
   // Opened lazily
   WritableFile* descriptor_file_;
   log::Writer* descriptor_log_;
+  uint64_t manifest_file_size_;  // Bytes written to descriptor_file_
   Version dummy_versions_;  // Head of circular doubly-linked list of versions.
   Version* current_;        // == dummy_versions_.prev_
 
@@ -356,9 +431,14 @@ class Compaction {
   ~Compaction();
 
   // Return the level that is being compacted.  Inputs from "level"
-  // and "level+1" will be merged to produce a set of "level+1" files.
+  // will be merged to produce a single run at "output_level()".
   int level() const { return level_; }
 
+  // Return the level the merged run is written to.  Normally level()+1;
+  // equal to level() for compactions at the last level and for manual
+  // compactions that only merge the runs of a level in place.
+  int output_level() const { return output_level_; }
+
   // Return the object that holds the edits to the descriptor done
   // by this compaction.
   //一个compaction和一个edit相关联，记录compaction之后LSM结构的变化
@@ -387,12 +467,22 @@ class Compaction {
   void AddInputDeletions(VersionEdit* edit);
 
   void AddRunDeletions(VersionEdit* edit);
-  // Returns true if the information we have available guarantees that
-  // the compaction is producing data in "level+1" for which no data exists
-  // in levels greater than "level+1".
-  // 待修改：暂时不用这个函数
+
+  // Add the L0 lineage of every input run to *lineage.  The B+ tree points
+  // a key at the compaction output iff its value is one of them.
+  void AddInputLineage(std::set<uint64_t>* lineage) const;
+
+  // Returns true if the information we have available guarantees that no
+  // run older than the inputs holds data for "user_key": the runs of
+  // "level" before the inputs and the runs in deeper levels are checked,
+  // by key range and then by the file's filter.
+  // REQUIRES: successive calls pass keys in increasing order.
   bool IsBaseLevelForKey(const Slice& user_key);
 
+  // Like IsBaseLevelForKey() for every key in [begin, end), using key
+  // ranges only.
+  bool IsBaseLevelForRange(const Slice& begin, const Slice& end);
+
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
   // 需要新建sstable
@@ -407,9 +497,10 @@ class Compaction {
   friend class Version;
   friend class VersionSet;
 
-  Compaction(const Options* options, int level);
+  Compaction(const Options* options, int level, int output_level);
 
   int level_;
+  int output_level_;
   uint64_t max_output_file_size_;
   Version* input_version_;
   VersionEdit edit_;
@@ -428,11 +519,17 @@ class Compaction {
 
   // State for implementing IsBaseLevelForKey
 
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
+  // Store in *runs the runs older than the inputs: the runs of level_
+  // before the first input and all runs in deeper levels.
+  void GetOlderRuns(std::vector<SortedRun*>* runs) const;
+
+  // Runs older than the inputs whose key range overlaps that of the
+  // inputs, collected on the first call.  run_ptrs_[i] is the index of the first file of
+  // older_runs_[i] that may still contain the keys passed from now on.
+  void InitOlderRuns();
+  bool older_runs_ready_;
+  std::vector<SortedRun*> older_runs_;
+  std::vector<size_t> run_ptrs_;
 
   bool last_level_;
 };
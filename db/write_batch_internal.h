@@ -35,7 +35,10 @@ class WriteBatchInternal {
 
   static void SetContents(WriteBatch* batch, const Slice& contents);
 
-  static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
+  // If concurrent is true, other threads may be inserting into memtable
+  // (also with concurrent == true) at the same time.
+  static Status InsertInto(const WriteBatch* batch, MemTable* memtable,
+                           bool concurrent = false);
 
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
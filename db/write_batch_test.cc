@@ -8,12 +8,14 @@
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "util/logging.h"
+#include "util/random.h"
 
 namespace leveldb {
 
-static std::string PrintContents(WriteBatch* b) {
+static std::string PrintContents(WriteBatch* b,
+                                 MemTableRepType rep = kSkipListRep) {
   InternalKeyComparator cmp(BytewiseComparator());
-  MemTable* mem = new MemTable(cmp);
+  MemTable* mem = new MemTable(cmp, rep);
   mem->Ref();
   std::string state;
   Status s = WriteBatchInternal::InsertInto(b, mem);
@@ -37,11 +39,30 @@ static std::string PrintContents(WriteBatch* b) {
         state.append(")");
         count++;
         break;
+      case kTypeRangeDeletion:
+        //范围删除只在NewRangeTombstoneIterator()中出现
+        ADD_FAILURE() << "range tombstone in the point iterator";
+        break;
     }
     state.append("@");
     state.append(NumberToString(ikey.sequence));
   }
   delete iter;
+  iter = mem->NewRangeTombstoneIterator();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    EXPECT_TRUE(ParseInternalKey(iter->key(), &ikey));
+    EXPECT_EQ(kTypeRangeDeletion, ikey.type);
+    state.append("DeleteRange(");
+    state.append(ikey.user_key.ToString());
+    state.append(", ");
+    state.append(iter->value().ToString());
+    state.append(")");
+    count++;
+    state.append("@");
+    state.append(NumberToString(ikey.sequence));
+  }
+  delete iter;
   if (!s.ok()) {
     state.append("ParseError()");
   } else if (count != WriteBatchInternal::Count(b)) {
@@ -72,6 +93,20 @@ TEST(WriteBatchTest, Multiple) {
       PrintContents(&batch));
 }
 
+TEST(WriteBatchTest, DeleteRange) {
+  WriteBatch batch;
+  batch.Put(Slice("foo"), Slice("bar"));
+  batch.DeleteRange(Slice("a"), Slice("g"));
+  batch.Delete(Slice("box"));
+  WriteBatchInternal::SetSequence(&batch, 100);
+  ASSERT_EQ(3, WriteBatchInternal::Count(&batch));
+  ASSERT_EQ(
+      "Delete(box)@102"
+      "Put(foo, bar)@100"
+      "DeleteRange(a, g)@101",
+      PrintContents(&batch));
+}
+
 TEST(WriteBatchTest, Corruption) {
   WriteBatch batch;
   batch.Put(Slice("foo"), Slice("bar"));
@@ -129,4 +164,71 @@ TEST(WriteBatchTest, ApproximateSize) {
   ASSERT_LT(two_keys_size, post_delete_size);
 }
 
+TEST(WriteBatchTest, VectorRep) {
+  WriteBatch batch;
+  Random rnd(301);
+  for (int i = 0; i < 1000; i++) {
+    std::string key = "k" + NumberToString(rnd.Uniform(200));
+    if (rnd.OneIn(4)) {
+      batch.Delete(key);
+    } else {
+      batch.Put(key, NumberToString(i));
+    }
+  }
+  batch.DeleteRange("k150", "k160");
+  WriteBatchInternal::SetSequence(&batch, 100);
+  ASSERT_EQ(PrintContents(&batch), PrintContents(&batch, kVectorRep));
+}
+
+TEST(WriteBatchTest, VectorRepReadsBetweenWrites) {
+  InternalKeyComparator cmp(BytewiseComparator());
+  MemTable* mem = new MemTable(cmp, kVectorRep);
+  mem->Ref();
+  WriteBatch b1;
+  b1.Put("b", "v1");
+  b1.Put("d", "v1");
+  WriteBatchInternal::SetSequence(&b1, 1);
+  ASSERT_TRUE(WriteBatchInternal::InsertInto(&b1, mem).ok());
+
+  std::string value;
+  Status s;
+  ASSERT_TRUE(mem->Get(LookupKey("b", 10), &value, &s));
+  ASSERT_EQ("v1", value);
+  ASSERT_FALSE(mem->Get(LookupKey("c", 10), &value, &s));
+
+  // An iterator keeps seeing the entries that existed when it was created
+  Iterator* iter = mem->NewIterator();
+  WriteBatch b2;
+  b2.Put("a", "v2");
+  b2.Put("c", "v2");
+  b2.Delete("d");
+  WriteBatchInternal::SetSequence(&b2, 3);
+  ASSERT_TRUE(WriteBatchInternal::InsertInto(&b2, mem).ok());
+  int count = 0;
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    count++;
+  }
+  ASSERT_EQ(2, count);
+  delete iter;
+
+  ASSERT_TRUE(mem->Get(LookupKey("c", 10), &value, &s));
+  ASSERT_EQ("v2", value);
+  ASSERT_TRUE(mem->Get(LookupKey("d", 10), &value, &s));
+  ASSERT_TRUE(s.IsNotFound());
+  ASSERT_TRUE(mem->Get(LookupKey("d", 2), &value, &s));
+  ASSERT_EQ("v1", value);
+
+  std::string keys;
+  iter = mem->NewIterator();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    keys.append(ExtractUserKey(iter->key()).ToString());
+  }
+  ASSERT_EQ("abcdd", keys);
+  iter->Seek(LookupKey("c", 10).internal_key());
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("v2", iter->value().ToString());
+  delete iter;
+  mem->Unref();
+}
+
 }  // namespace leveldb
@@ -0,0 +1,132 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "db/dbformat.h"
+
+namespace leveldb {
+
+// Shorter delays are carried over to later writes instead of slept.
+static const uint64_t kMinSleepMicros = 1000;
+
+// The delayed write rate never drops below this many bytes per second.
+static const uint64_t kMinDelayedWriteRate = 16 << 10;
+
+WriteController::WriteController(uint64_t max_delayed_write_rate)
+    : max_delayed_write_rate_(
+          std::max(max_delayed_write_rate, kMinDelayedWriteRate)),
+      state_(kNormal),
+      delayed_write_rate_(max_delayed_write_rate_),
+      next_write_micros_(0),
+      num_runs_(0),
+      pending_compaction_bytes_(0),
+      l0_files_(0),
+      delayed_writes_(0),
+      delay_micros_(0),
+      stopped_writes_(0),
+      stop_micros_(0) {}
+
+bool WriteController::Update(int num_runs, int64_t pending_compaction_bytes,
+                             int l0_files) {
+  State state;
+  if (num_runs >= config::kRunStopWritesTrigger ||
+      pending_compaction_bytes >= config::kPendingCompactionBytesStopTrigger ||
+      l0_files >= config::kL0_StopWritesTrigger) {
+    state = kStopped;
+  } else if (num_runs >= config::kRunSlowdownWritesTrigger ||
+             pending_compaction_bytes >=
+                 config::kPendingCompactionBytesSlowdownTrigger ||
+             l0_files >= config::kL0_SlowdownWritesTrigger) {
+    state = kDelayed;
+  } else {
+    state = kNormal;
+  }
+
+  if (state == kDelayed) {
+    if (state_ != kDelayed) {
+      // Start at full speed; the rate only drops if compaction cannot
+      // keep up with it.
+      delayed_write_rate_ = max_delayed_write_rate_;
+      next_write_micros_ = 0;
+    } else if (num_runs > num_runs_ ||
+               pending_compaction_bytes > pending_compaction_bytes_) {
+      delayed_write_rate_ = std::max<uint64_t>(
+          delayed_write_rate_ * 4 / 5, kMinDelayedWriteRate);
+    } else if (num_runs < num_runs_ ||
+               pending_compaction_bytes < pending_compaction_bytes_) {
+      delayed_write_rate_ = std::min<uint64_t>(delayed_write_rate_ * 5 / 4,
+                                               max_delayed_write_rate_);
+    }
+  }
+
+  num_runs_ = num_runs;
+  pending_compaction_bytes_ = pending_compaction_bytes;
+  l0_files_ = l0_files;
+  const bool changed = (state != state_);
+  state_ = state;
+  return changed;
+}
+
+uint64_t WriteController::GetDelay(uint64_t now_micros, uint64_t num_bytes) {
+  if (state_ != kDelayed) {
+    return 0;
+  }
+  // Time not used by earlier writes is not saved up for a later burst.
+  if (next_write_micros_ < now_micros) {
+    next_write_micros_ = now_micros;
+  }
+  next_write_micros_ += num_bytes * 1000000 / delayed_write_rate_;
+  const uint64_t delay = next_write_micros_ - now_micros;
+  return (delay < kMinSleepMicros) ? 0 : delay;
+}
+
+void WriteController::RecordStall(State state, uint64_t micros) {
+  if (state == kDelayed) {
+    delayed_writes_++;
+    delay_micros_ += micros;
+  } else if (state == kStopped) {
+    stopped_writes_++;
+    stop_micros_ += micros;
+  }
+}
+
+const char* WriteController::StateName(State state) {
+  switch (state) {
+    case kNormal:
+      return "normal";
+    case kDelayed:
+      return "delayed";
+    case kStopped:
+      return "stopped";
+  }
+  return "unknown";
+}
+
+std::string WriteController::DebugString() const {
+  char buf[400];
+  std::snprintf(buf, sizeof(buf),
+                "state: %s\n"
+                "delayed-write-rate: %llu\n"
+                "runs: %d\n"
+                "pending-compaction-bytes: %lld\n"
+                "level0-files: %d\n"
+                "delayed-writes: %llu\n"
+                "delay-micros: %llu\n"
+                "stopped-writes: %llu\n"
+                "stop-micros: %llu\n",
+                StateName(state_),
+                static_cast<unsigned long long>(delayed_write_rate_),
+                num_runs_, static_cast<long long>(pending_compaction_bytes_),
+                l0_files_, static_cast<unsigned long long>(delayed_writes_),
+                static_cast<unsigned long long>(delay_micros_),
+                static_cast<unsigned long long>(stopped_writes_),
+                static_cast<unsigned long long>(stop_micros_));
+  return buf;
+}
+
+}  // namespace leveldb
@@ -0,0 +1,77 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+#define STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+
+#include <cstdint>
+#include <string>
+
+namespace leveldb {
+
+// WriteController turns the compaction backlog into write backpressure.
+// Its inputs are the total number of runs over all levels, the estimated
+// pending compaction bytes and the number of level-0 files; see the
+// triggers in dbformat.h.
+//
+// Below every slowdown trigger writes are not throttled.  Above one of
+// them, writes are paced at a delayed write rate: each write is charged
+// num_bytes / rate on a virtual clock, so the delay is spread smoothly
+// over all writes instead of adding a fixed sleep to each of them.  The
+// rate is lowered while the backlog keeps growing and raised again while
+// it shrinks.  Above a stop trigger writes wait for compaction.
+//
+// Not thread-safe: DBImpl accesses it with its mutex held.
+class WriteController {
+ public:
+  enum State { kNormal, kDelayed, kStopped };
+
+  explicit WriteController(uint64_t max_delayed_write_rate);
+
+  WriteController(const WriteController&) = delete;
+  WriteController& operator=(const WriteController&) = delete;
+
+  // Recompute the state from the shape of a newly installed version.
+  // Returns true iff the state changed.
+  bool Update(int num_runs, int64_t pending_compaction_bytes, int l0_files);
+
+  State state() const { return state_; }
+
+  // Current write rate in bytes per second while in kDelayed.
+  uint64_t delayed_write_rate() const { return delayed_write_rate_; }
+
+  // Return how long a write of "num_bytes" issued at "now_micros" has
+  // to sleep, and charge it to the virtual clock.  Delays shorter than a
+  // millisecond are accumulated instead of slept.
+  uint64_t GetDelay(uint64_t now_micros, uint64_t num_bytes);
+
+  // Record time a writer spent sleeping or waiting for compaction.
+  void RecordStall(State state, uint64_t micros);
+
+  // Human readable state, for the "leveldb.write-stall" property.
+  std::string DebugString() const;
+
+  static const char* StateName(State state);
+
+ private:
+  const uint64_t max_delayed_write_rate_;
+  State state_;
+  uint64_t delayed_write_rate_;
+  uint64_t next_write_micros_;  // Virtual clock while kDelayed
+
+  // Inputs of the last Update()
+  int num_runs_;
+  int64_t pending_compaction_bytes_;
+  int l0_files_;
+
+  // Statistics
+  uint64_t delayed_writes_;
+  uint64_t delay_micros_;
+  uint64_t stopped_writes_;
+  uint64_t stop_micros_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
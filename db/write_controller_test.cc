@@ -0,0 +1,156 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include "gtest/gtest.h"
+#include "db/dbformat.h"
+
+namespace leveldb {
+
+static const uint64_t kRate = 1 << 20;
+
+TEST(WriteControllerTest, Triggers) {
+  WriteController controller(kRate);
+  ASSERT_EQ(WriteController::kNormal, controller.state());
+  ASSERT_FALSE(controller.Update(config::kRunSlowdownWritesTrigger - 1,
+                                 config::kPendingCompactionBytesSlowdownTrigger - 1,
+                                 config::kL0_SlowdownWritesTrigger - 1));
+  ASSERT_EQ(WriteController::kNormal, controller.state());
+
+  // Each input on its own crosses the slowdown and the stop trigger
+  ASSERT_TRUE(controller.Update(config::kRunSlowdownWritesTrigger, 0, 0));
+  ASSERT_EQ(WriteController::kDelayed, controller.state());
+  ASSERT_TRUE(controller.Update(config::kRunStopWritesTrigger, 0, 0));
+  ASSERT_EQ(WriteController::kStopped, controller.state());
+  ASSERT_TRUE(controller.Update(0, 0, 0));
+  ASSERT_EQ(WriteController::kNormal, controller.state());
+
+  ASSERT_TRUE(controller.Update(
+      0, config::kPendingCompactionBytesSlowdownTrigger, 0));
+  ASSERT_EQ(WriteController::kDelayed, controller.state());
+  ASSERT_TRUE(
+      controller.Update(0, config::kPendingCompactionBytesStopTrigger, 0));
+  ASSERT_EQ(WriteController::kStopped, controller.state());
+  ASSERT_TRUE(controller.Update(0, 0, 0));
+
+  ASSERT_TRUE(controller.Update(0, 0, config::kL0_SlowdownWritesTrigger));
+  ASSERT_EQ(WriteController::kDelayed, controller.state());
+  ASSERT_FALSE(controller.Update(0, 0, config::kL0_SlowdownWritesTrigger));
+  ASSERT_TRUE(controller.Update(0, 0, config::kL0_StopWritesTrigger));
+  ASSERT_EQ(WriteController::kStopped, controller.state());
+
+  // Stop wins over slowdown
+  ASSERT_FALSE(controller.Update(config::kRunSlowdownWritesTrigger,
+                                 config::kPendingCompactionBytesStopTrigger,
+                                 0));
+  ASSERT_EQ(WriteController::kStopped, controller.state());
+  ASSERT_TRUE(controller.Update(config::kRunSlowdownWritesTrigger, 0, 0));
+  ASSERT_EQ(WriteController::kDelayed, controller.state());
+}
+
+TEST(WriteControllerTest, RateDecayAndRecovery) {
+  WriteController controller(kRate);
+  const int runs = config::kRunSlowdownWritesTrigger;
+  controller.Update(runs, 0, 0);
+  ASSERT_EQ(kRate, controller.delayed_write_rate());
+
+  // The rate drops by a fifth while the backlog grows
+  controller.Update(runs + 1, 0, 0);
+  ASSERT_EQ(kRate * 4 / 5, controller.delayed_write_rate());
+  controller.Update(runs + 1, 10, 0);
+  const uint64_t lowered = kRate * 4 / 5 * 4 / 5;
+  ASSERT_EQ(lowered, controller.delayed_write_rate());
+
+  // An unchanged backlog keeps it
+  controller.Update(runs + 1, 10, 0);
+  ASSERT_EQ(lowered, controller.delayed_write_rate());
+
+  // It rises by a quarter while the backlog shrinks, up to the configured
+  // rate
+  controller.Update(runs, 10, 0);
+  ASSERT_EQ(lowered * 5 / 4, controller.delayed_write_rate());
+  for (int pending = 9; pending >= 0; pending--) {
+    controller.Update(runs, pending, 0);
+  }
+  ASSERT_EQ(kRate, controller.delayed_write_rate());
+
+  // It never drops below a floor
+  for (int pending = 1; pending <= 100; pending++) {
+    controller.Update(runs, pending, 0);
+  }
+  const uint64_t floor = controller.delayed_write_rate();
+  ASSERT_GT(floor, 0);
+  ASSERT_LT(floor, kRate / 16);
+  controller.Update(runs, 1000, 0);
+  ASSERT_EQ(floor, controller.delayed_write_rate());
+
+  // Leaving and re-entering the delayed state starts at full speed
+  controller.Update(0, 0, 0);
+  controller.Update(runs, 1000, 0);
+  ASSERT_EQ(kRate, controller.delayed_write_rate());
+}
+
+// Micros a write of "bytes" costs at "rate" bytes per second.
+static uint64_t Cost(uint64_t bytes, uint64_t rate) {
+  return bytes * 1000000 / rate;
+}
+
+TEST(WriteControllerTest, Delay) {
+  WriteController controller(kRate);
+  // Not throttled in the normal state
+  ASSERT_EQ(0, controller.GetDelay(0, kRate));
+
+  controller.Update(config::kRunSlowdownWritesTrigger, 0, 0);
+  ASSERT_EQ(WriteController::kDelayed, controller.state());
+
+  // Delays under a millisecond are carried over to the next write
+  const uint64_t small = kRate / 1500;
+  ASSERT_LT(Cost(small, kRate), 1000);
+  const uint64_t now = 10000000;
+  ASSERT_EQ(0, controller.GetDelay(now, small));
+  ASSERT_EQ(2 * Cost(small, kRate), controller.GetDelay(now, small));
+
+  // Writes issued back to back queue up on the virtual clock
+  ASSERT_EQ(2 * Cost(small, kRate) + Cost(kRate / 10, kRate),
+            controller.GetDelay(now, kRate / 10));
+
+  // Time left unused is not saved up: once the clock has caught up, only
+  // the write's own cost is charged
+  const uint64_t later = now + 10000000;
+  ASSERT_EQ(Cost(kRate / 4, kRate), controller.GetDelay(later, kRate / 4));
+  ASSERT_EQ(Cost(kRate / 4, kRate),
+            controller.GetDelay(later + Cost(kRate / 4, kRate), kRate / 4));
+
+  // A lower rate makes the same write wait longer
+  controller.Update(config::kRunSlowdownWritesTrigger + 1, 0, 0);
+  const uint64_t idle = later + 100000000;
+  ASSERT_EQ(Cost(kRate / 4, kRate * 4 / 5),
+            controller.GetDelay(idle, kRate / 4));
+
+  // No delay once stopped or back to normal; stopped writers wait for
+  // compaction instead
+  controller.Update(config::kRunStopWritesTrigger, 0, 0);
+  ASSERT_EQ(0, controller.GetDelay(idle, kRate));
+  controller.Update(0, 0, 0);
+  ASSERT_EQ(0, controller.GetDelay(idle, kRate));
+}
+
+TEST(WriteControllerTest, DebugString) {
+  WriteController controller(kRate);
+  controller.Update(config::kRunSlowdownWritesTrigger, 5, 3);
+  controller.RecordStall(WriteController::kDelayed, 100);
+  controller.RecordStall(WriteController::kDelayed, 50);
+  controller.RecordStall(WriteController::kStopped, 7);
+  const std::string s = controller.DebugString();
+  ASSERT_NE(std::string::npos, s.find("state: delayed\n"));
+  ASSERT_NE(std::string::npos, s.find("pending-compaction-bytes: 5\n"));
+  ASSERT_NE(std::string::npos, s.find("level0-files: 3\n"));
+  ASSERT_NE(std::string::npos, s.find("delayed-writes: 2\n"));
+  ASSERT_NE(std::string::npos, s.find("delay-micros: 150\n"));
+  ASSERT_NE(std::string::npos, s.find("stopped-writes: 1\n"));
+  ASSERT_NE(std::string::npos, s.find("stop-micros: 7\n"));
+}
+
+}  // namespace leveldb
@@ -0,0 +1,43 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A CompactionFilter lets the application drop or rewrite entries while
+// compactions merge runs, e.g. to expire data by TTL without issuing
+// explicit deletes.  See Options::compaction_filter.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+#define STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+
+#include <string>
+
+#include "leveldb/export.h"
+
+namespace leveldb {
+
+class Slice;
+
+class LEVELDB_EXPORT CompactionFilter {
+ public:
+  virtual ~CompactionFilter();
+
+  // Called for the newest value of a key written by a compaction to
+  // "level", unless a snapshot may still read it (only values newer than
+  // every live snapshot are passed in).
+  //
+  // Return true to drop the key: it reads as deleted afterwards.
+  // Otherwise, to replace the value, store the new one in *new_value and
+  // set *value_changed to true.
+  //
+  // Compactions run in a background thread and may call this
+  // concurrently with the application, so it must be thread-safe.
+  virtual bool Filter(int level, const Slice& key, const Slice& existing_value,
+                      std::string* new_value, bool* value_changed) const = 0;
+
+  // Return the name of this filter, for the info log.
+  virtual const char* Name() const = 0;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
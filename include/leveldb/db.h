@@ -8,6 +8,8 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <string>
+#include <vector>
 
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
@@ -73,11 +75,31 @@ class LEVELDB_EXPORT DB {
   // Note: consider setting options.sync = true.
   virtual Status Delete(const WriteOptions& options, const Slice& key) = 0;
 
+  // Remove every database entry whose key lies in [begin_key, end_key)
+  // with a single range tombstone.  Table files entirely inside the range
+  // are dropped without being rewritten when no snapshot can still see
+  // their contents.  Returns OK on success, and a non-OK status on error.
+  // Note: consider setting options.sync = true.
+  virtual Status BulkDeleteForRange(const WriteOptions& options,
+                                    const Slice& begin_key,
+                                    const Slice& end_key) = 0;
+
   // Apply the specified updates to the database.
   // Returns OK on success, non-OK on failure.
   // Note: consider setting options.sync = true.
   virtual Status Write(const WriteOptions& options, WriteBatch* updates) = 0;
 
+  // Add the contents of the given table files to the database without
+  // passing them through the log and the memtable.  Each file must have
+  // been written by TableBuilder with this database's comparator, with
+  // strictly increasing keys, and the key ranges of the files must not
+  // overlap.  The files become one new level-0 run that is newer than
+  // every existing entry.  They are copied into the database; the
+  // originals are left in place.  Writes are blocked until ingestion
+  // completes.  Returns OK on success, and a non-OK status on error.
+  virtual Status IngestExternalFiles(
+      const std::vector<std::string>& external_files) = 0;
+
   // If the database contains an entry for "key" store the
   // corresponding value in *value and return OK.
   //
@@ -116,12 +138,22 @@ class LEVELDB_EXPORT DB {
   //
   //  "leveldb.num-files-at-level<N>" - return the number of files at level <N>,
   //     where <N> is an ASCII representation of a level number (e.g. "0").
+  //  "leveldb.num-runs-at-level<N>" - return the number of sorted runs at
+  //     level <N>.
   //  "leveldb.stats" - returns a multi-line string that describes statistics
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
+  //  "leveldb.num-immutable-mem-table" - returns the number of sealed
+  //     memtables waiting to be flushed.
+  //  "leveldb.write-stall" - returns a multi-line string that describes the
+  //     current write stall state (normal, delayed or stopped), the delayed
+  //     write rate and the backlog that drives it.
+  //  "leveldb.rate-limiter" - returns the rate of options.rate_limiter and
+  //     the bytes written through it by flushes and compactions.  Not
+  //     supported without a rate limiter.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -141,11 +173,14 @@ class LEVELDB_EXPORT DB {
   // needed to access the data.  This operation should typically only
   // be invoked by users who understand the underlying implementation.
   //
+  // Every sorted run overlapping the range is merged level by level, and
+  // the deepest level touched ends up holding a single run for the range.
+  //
   // begin==nullptr is treated as a key before all keys in the database.
   // end==nullptr is treated as a key after all keys in the database.
   // Therefore the following call will compact the entire database:
   //    db->CompactRange(nullptr, nullptr);
-  //virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
+  virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
   virtual void PrintTree() = 0;
 };
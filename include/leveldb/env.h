@@ -116,6 +116,22 @@ class LEVELDB_EXPORT Env {
   virtual Status NewAppendableFile(const std::string& fname,
                                    WritableFile** result);
 
+  // Rename the existing file "old_fname" to "fname" and open it for
+  // writing from the beginning, overwriting its contents in place without
+  // truncating it first.  Reusing a file whose blocks are already allocated
+  // avoids growing the file (and syncing its size) on every write.
+  // On success, stores a pointer to the new file in *result and returns OK.
+  // On failure stores nullptr in *result and returns non-OK.
+  //
+  // The default implementation renames the file and then opens it with
+  // NewWritableFile(), which truncates it.
+  //
+  // The returned file will only be accessed by one thread at a time.
+  //复用旧文件：改名后从头覆盖写入，不截断
+  virtual Status ReuseWritableFile(const std::string& fname,
+                                   const std::string& old_fname,
+                                   WritableFile** result);
+
   // Returns true iff the named file exists.
   virtual bool FileExists(const std::string& fname) = 0;
 
@@ -301,6 +317,12 @@ class LEVELDB_EXPORT WritableFile {
   virtual Status Close() = 0;
   virtual Status Flush() = 0;
   virtual Status Sync() = 0;
+
+  // Hint that the file will grow by appends, so space can be reserved
+  // "size" bytes at a time ahead of the written data.  Reserved space does
+  // not change the file size.  The default implementation ignores the hint.
+  //预分配空间，避免每次写入都扩展文件
+  virtual void SetPreallocationBlockSize(size_t /*size*/) {}
 };
 
 // An interface for writing log messages.
@@ -380,6 +402,10 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
   Status NewAppendableFile(const std::string& f, WritableFile** r) override {
     return target_->NewAppendableFile(f, r);
   }
+  Status ReuseWritableFile(const std::string& f, const std::string& old_f,
+                           WritableFile** r) override {
+    return target_->ReuseWritableFile(f, old_f, r);
+  }
   bool FileExists(const std::string& f) override {
     return target_->FileExists(f);
   }
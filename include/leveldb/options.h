@@ -12,10 +12,13 @@
 namespace leveldb {
 
 class Cache;
+class CompactionFilter;
+class RateLimiter;
 class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class Slice;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -29,6 +32,18 @@ enum CompressionType {
   kSnappyCompression = 0x1
 };
 
+// Data structure used to hold the entries of a memtable.
+enum MemTableRepType {
+  // Sorted as entries are added; reads are cheap at any time.
+  kSkipListRep = 0x0,
+  // Entries are appended to a vector and sorted when the memtable is first
+  // read after new writes, typically once at flush.  Inserts are cheaper.
+  // For bulk loads only: the first read after new writes costs time linear
+  // in the size of the memtable, so interleaving reads and writes is
+  // quadratic.
+  kVectorRep = 0x1
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct LEVELDB_EXPORT Options {
   // Create an Options object with default values for all fields.
@@ -81,6 +96,66 @@ struct LEVELDB_EXPORT Options {
   // the next time the database is opened.
   size_t write_buffer_size = 4 * 1024 * 1024;
 
+  // Maximum number of write buffers held in memory: the active one plus
+  // those sealed and waiting for the flush thread.  Writers stall only
+  // when all of them are full.  Values below 2 are treated as 2.
+  int max_write_buffer_number = 2;
+
+  // Number of sealed write buffers merged into a single level-0 run by one
+  // flush.  Versions overwritten within the merged buffers are dropped
+  // before they reach disk or the index.  Must be smaller than
+  // max_write_buffer_number; larger values are clipped.
+  int min_write_buffer_number_to_merge = 1;
+
+  // If true, the writers of a write group insert their own batches into
+  // the memtable in parallel once the group's log record is written,
+  // instead of the group leader inserting the whole group alone.
+  bool allow_concurrent_memtable_write = true;
+
+  // If true, a write group appends (and syncs) its log record while the
+  // previous group is still being applied to the memtable.  Writes still
+  // become visible in sequence order.
+  bool enable_pipelined_write = false;
+
+  // If true, non-sync writes join the write queue through a lock-free
+  // stack and briefly spin for their group leader before blocking, so a
+  // write batched into another thread's group completes without taking
+  // the DB mutex.
+  bool enable_write_fast_path = true;
+
+  // Number of threads inserting the write batches of a log into memtables
+  // during recovery.  While they do, the opening thread keeps reading and
+  // checksumming the log, and filled memtables are written to level-0 in
+  // the background.  1 replays each log serially on the opening thread.
+  // Clipped to the number of CPU cores.
+  int recovery_threads = 4;
+
+  // Data structure of the memtables; see MemTableRepType.  Use kVectorRep
+  // only for ingest-only phases such as an initial bulk load, where the
+  // memtables are not read until they are flushed.  WARNING: with
+  // kVectorRep, the first Get() or iterator after a write copies the whole
+  // memtable into a new sorted vector, so a workload that reads while it
+  // writes slows down quadratically with the memtable size.
+  //
+  // Default: kSkipListRep
+  MemTableRepType memtable_rep = kSkipListRep;
+
+  // If non-zero, every memtable reserves about write_buffer_size bytes up
+  // front in pages of this size, which should be the system's huge page
+  // size (e.g. 2MB).  Reserved huge pages (MAP_HUGETLB) are used when the
+  // system has some, transparent huge pages otherwise.  Memtable reads,
+  // inserts and flushes then take fewer TLB misses.  Ignored where huge
+  // pages are not supported.
+  //
+  // Default: 0
+  size_t memtable_huge_page_size = 0;
+
+  // If >= 0 and memtable_huge_page_size is set, the memory reserved for
+  // memtables is preferably placed on this NUMA node.
+  //
+  // Default: -1
+  int memtable_numa_node = -1;
+
   // Number of open files that can be used by the DB.  You may need to
   // increase this if your database has a large working set (budget
   // one open file per 2MB of working set).
@@ -136,12 +211,63 @@ struct LEVELDB_EXPORT Options {
   // Default: currently false, but may become true later.
   bool reuse_logs = false;
 
+  // If non-zero, keep up to this many obsolete log files around and reuse
+  // them for new logs instead of creating fresh files.  A reused log is
+  // overwritten in place, so appends that stay within its old size only
+  // need fdatasync() of the data, not an update of the file size.  Records
+  // are then written in a format tagged with the log number, and replay
+  // stops at data left over from the file's previous use.
+  //
+  // Logs of the recyclable format cannot be appended to on the next open,
+  // so they are never reused by reuse_logs.
+  //
+  // Default: 0 (always create new log files)
+  //复用的旧日志文件数量上限
+  size_t recycle_log_file_num = 0;
+
+  // Compress write batches in the write-ahead log with the specified
+  // compression algorithm.  Only kSnappyCompression is supported; a batch
+  // is stored compressed only if that saves at least 12.5% of its size.
+  // Worth enabling for large, compressible values, where WAL bandwidth
+  // and Sync() time shrink roughly by the compression ratio.
+  //
+  // Logs with compressed records cannot be read by versions that predate
+  // this option.  Without snappy compiled in, logs are written uncompressed,
+  // and DB::Open() fails with NotSupported on a log with compressed records.
+  //
+  // Default: kNoCompression
+  //WAL记录压缩
+  CompressionType wal_compression = kNoCompression;
+
   // If non-null, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
   const FilterPolicy* filter_policy = nullptr;
 
   int bTree_capacity = 100;
+
+  // Upper bound on the write rate (bytes/second) once the compaction
+  // backlog crosses a slowdown trigger.  The actual rate is lowered from
+  // here while the backlog keeps growing.
+  size_t delayed_write_rate = 16 * 1024 * 1024;
+  // If non-null, table file writes of memtable flushes and compactions
+  // are throttled by this limiter (see rate_limiter.h).  Flushes are
+  // charged but not delayed.
+  RateLimiter* rate_limiter = nullptr;
+
+  // Compactions read their input tables sequentially, this many bytes at a
+  // time, instead of one block per read.  0 disables readahead.
+  size_t compaction_readahead_size = 2 * 1024 * 1024;
+
+  // Once the MANIFEST grows past this many bytes, the next version change
+  // starts a new one with a snapshot of the current version, which bounds
+  // how many records recovery has to replay.
+  size_t max_manifest_file_size = 64 * 1024 * 1024;
+
+  // If non-null, compactions pass the newest value of every key they
+  // write through this filter, which may drop or rewrite it (see
+  // compaction_filter.h).
+  const CompactionFilter* compaction_filter = nullptr;
 };
 
 // Options that control read operations
@@ -159,6 +285,20 @@ struct LEVELDB_EXPORT ReadOptions {
   // not have been released).  If "snapshot" is null, use an implicit
   // snapshot of the state at the beginning of this read operation.
   const Snapshot* snapshot = nullptr;
+
+  // If non-zero, table iterators read their files sequentially, this many
+  // bytes at a time, and serve the following blocks from that buffer.
+  // Useful for long scans on storage where small reads are expensive.
+  // Reverse scans read the same amount backwards, ending at the block
+  // they need.
+  size_t readahead_size = 0;
+
+  // If non-null, iterators only return keys >= *iterate_lower_bound and
+  // < *iterate_upper_bound, and runs lying entirely outside those bounds
+  // are not opened.  The slices must outlive the iterators created with
+  // these options.
+  const Slice* iterate_lower_bound = nullptr;
+  const Slice* iterate_upper_bound = nullptr;
 };
 
 // Options that control write operations
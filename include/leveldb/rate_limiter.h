@@ -0,0 +1,64 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A RateLimiter bounds the rate at which background work (memtable
+// flushes and compactions) writes table files, so that large merges do
+// not saturate the disk under foreground reads.  It has internal
+// synchronization and may be shared by several DBs.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+
+#include <cstdint>
+
+#include "leveldb/export.h"
+
+namespace leveldb {
+
+class Env;
+
+class LEVELDB_EXPORT RateLimiter {
+ public:
+  enum IOPriority {
+    kLow = 0,   // Compaction
+    kHigh = 1,  // Memtable flush
+    kNumPriorities = 2
+  };
+
+  RateLimiter() = default;
+
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  virtual ~RateLimiter();
+
+  // Block until "bytes" may be written at priority "pri".
+  virtual void Request(int64_t bytes, IOPriority pri) = 0;
+
+  // Report the latency of a foreground read.  Auto-tuned limiters lower
+  // their rate while foreground latency is high.
+  virtual void RecordForegroundLatency(uint64_t micros) = 0;
+
+  // Current rate in bytes per second.
+  virtual int64_t GetBytesPerSecond() const = 0;
+
+  // Change the (maximum) rate in bytes per second.
+  virtual void SetBytesPerSecond(int64_t bytes_per_second) = 0;
+
+  // Total bytes requested at priority "pri" so far.
+  virtual int64_t GetTotalBytesThrough(IOPriority pri) const = 0;
+};
+
+// Create a token bucket rate limiter allowing "bytes_per_second".
+// Flushes (kHigh) are never delayed: their bytes are charged to the
+// bucket and paid for by the compactions (kLow) that follow.  If
+// "auto_tuned" is true, the rate moves between bytes_per_second / 20 and
+// bytes_per_second depending on the foreground read latency.
+LEVELDB_EXPORT RateLimiter* NewGenericRateLimiter(int64_t bytes_per_second,
+                                                  bool auto_tuned = false,
+                                                  Env* env = nullptr);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
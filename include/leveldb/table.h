@@ -64,8 +64,16 @@ class LEVELDB_EXPORT Table {
  private:
   friend class TableCache;
   struct Rep;
+  struct Readahead;
 
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
+  // Like BlockReader, for an iterator with a readahead buffer: arg is a
+  // Readahead (see ReadOptions::readahead_size).
+  static Iterator* ReadaheadBlockReader(void*, const ReadOptions&,
+                                        const Slice&);
+  static Iterator* ReadBlockIterator(Table* table, RandomAccessFile* file,
+                                     const ReadOptions& options,
+                                     const Slice& index_value);
 
   explicit Table(Rep* rep) : rep_(rep) {}
 
@@ -76,6 +84,10 @@ class LEVELDB_EXPORT Table {
                      void (*handle_result)(void* arg, const Slice& k,
                                            const Slice& v));
 
+  // Returns false if the filter policy says that internal key "k" is
+  // definitely not in the table.  Without a filter the answer is true.
+  bool KeyMayMatch(const Slice& k) const;
+
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
 
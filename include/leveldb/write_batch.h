@@ -38,6 +38,8 @@ class LEVELDB_EXPORT WriteBatch {
     virtual ~Handler();
     virtual void Put(const Slice& key, const Slice& value) = 0;
     virtual void Delete(const Slice& key) = 0;
+    // The default implementation ignores range deletions.
+    virtual void DeleteRange(const Slice& begin_key, const Slice& end_key);
   };
 
   WriteBatch();
@@ -54,6 +56,9 @@ class LEVELDB_EXPORT WriteBatch {
   // If the database contains a mapping for "key", erase it.  Else do nothing.
   void Delete(const Slice& key);
 
+  // Erase every mapping whose key lies in [begin_key, end_key).
+  void DeleteRange(const Slice& begin_key, const Slice& end_key);
+
   // Clear all updates buffered in this batch.
   void Clear();
 
@@ -11,6 +11,7 @@
 #include "trees/vanilla_b_plus_tree.h"
 #include "db/dbformat.h"
 #include <unordered_map>
+#include <utility>
 
 namespace leveldb {
 
@@ -186,6 +187,238 @@ void MergingIterator::FindLargest() {
   }
   current_ = largest;
 }
+
+// Merging iterator for many children (e.g. a tiered compaction over many
+// runs).  The children are the leaves of a loser tree: every internal node
+// keeps the loser of the match played there and tree_[0] keeps the overall
+// winner, so advancing the winner only replays the log2(n) matches on its
+// path to the root.  On top of that the best loser on the winner's path
+// (the runner-up) is cached: while the same child keeps winning, a step
+// costs a single comparison.
+//
+// Ties are broken the same way as in MergingIterator: the child with the
+// smaller index wins going forward, the one with the larger index going
+// backward.
+class LoserTreeIterator : public Iterator {
+ public:
+  LoserTreeIterator(const Comparator* comparator, Iterator** children, int n)
+      : comparator_(comparator),
+        children_(new IteratorWrapper[n]),
+        n_(n),
+        leaves_(1),
+        tree_(nullptr),
+        runner_up_(-1),
+        current_(nullptr),
+        direction_(kForward) {
+    for (int i = 0; i < n; i++) {
+      children_[i].Set(children[i]);
+    }
+    while (leaves_ < n) {
+      leaves_ *= 2;
+    }
+    tree_ = new int[leaves_];
+  }
+
+  ~LoserTreeIterator() override {
+    delete[] tree_;
+    delete[] children_;
+  }
+
+  bool Valid() const override { return (current_ != nullptr); }
+
+  void SeekToFirst() override {
+    for (int i = 0; i < n_; i++) {
+      children_[i].SeekToFirst();
+    }
+    direction_ = kForward;
+    Rebuild();
+  }
+
+  void SeekToLast() override {
+    for (int i = 0; i < n_; i++) {
+      children_[i].SeekToLast();
+    }
+    direction_ = kReverse;
+    Rebuild();
+  }
+
+  void Seek(const Slice& target) override {
+    for (int i = 0; i < n_; i++) {
+      children_[i].Seek(target);
+    }
+    direction_ = kForward;
+    Rebuild();
+  }
+
+  void Next() override {
+    assert(Valid());
+
+    // See MergingIterator::Next().  Changing direction repositions every
+    // child, so the tree is rebuilt from scratch.
+    if (direction_ != kForward) {
+      for (int i = 0; i < n_; i++) {
+        IteratorWrapper* child = &children_[i];
+        if (child != current_) {
+          child->Seek(key());
+          if (child->Valid() &&
+              comparator_->Compare(key(), child->key()) == 0) {
+            child->Next();
+          }
+        }
+      }
+      direction_ = kForward;
+      current_->Next();
+      Rebuild();
+      return;
+    }
+
+    current_->Next();
+    AdvanceWinner();
+  }
+
+  void Prev() override {
+    assert(Valid());
+
+    // See MergingIterator::Prev().
+    if (direction_ != kReverse) {
+      for (int i = 0; i < n_; i++) {
+        IteratorWrapper* child = &children_[i];
+        if (child != current_) {
+          child->Seek(key());
+          if (child->Valid()) {
+            // Child is at first entry >= key().  Step back one to be < key()
+            child->Prev();
+          } else {
+            // Child has no entries >= key().  Position at last entry.
+            child->SeekToLast();
+          }
+        }
+      }
+      direction_ = kReverse;
+      current_->Prev();
+      Rebuild();
+      return;
+    }
+
+    current_->Prev();
+    AdvanceWinner();
+  }
+
+  Slice key() const override {
+    assert(Valid());
+    return current_->key();
+  }
+
+  Slice value() const override {
+    assert(Valid());
+    return current_->value();
+  }
+
+  Status status() const override {
+    Status status;
+    for (int i = 0; i < n_; i++) {
+      status = children_[i].status();
+      if (!status.ok()) {
+        break;
+      }
+    }
+    return status;
+  }
+
+ private:
+  // Which direction is the iterator moving?
+  enum Direction { kForward, kReverse };
+
+  // Does child a come out before child b in the current direction?
+  // Exhausted children and the padding leaves (index >= n_) never do.
+  bool Beats(int a, int b) const {
+    if (a >= n_ || !children_[a].Valid()) {
+      return false;
+    }
+    if (b >= n_ || !children_[b].Valid()) {
+      return true;
+    }
+    const int r = comparator_->Compare(children_[a].key(), children_[b].key());
+    if (direction_ == kForward) {
+      return r < 0 || (r == 0 && a < b);
+    } else {
+      return r > 0 || (r == 0 && a > b);
+    }
+  }
+
+  // Play the matches of the subtree rooted at "node" and return its winner.
+  int Build(int node) {
+    if (node >= leaves_) {
+      return node - leaves_;
+    }
+    const int left = Build(2 * node);
+    const int right = Build(2 * node + 1);
+    if (Beats(right, left)) {
+      tree_[node] = left;
+      return right;
+    }
+    tree_[node] = right;
+    return left;
+  }
+
+  void Rebuild() {
+    tree_[0] = (leaves_ == 1) ? 0 : Build(1);
+    FindRunnerUp();
+  }
+
+  // The winner's key has changed: replay the matches on its path.
+  void AdvanceWinner() {
+    const int winner = tree_[0];
+    if (runner_up_ >= 0 && !Beats(winner, runner_up_)) {
+      int w = winner;
+      for (int node = (leaves_ + winner) / 2; node >= 1; node /= 2) {
+        if (Beats(tree_[node], w)) {
+          std::swap(tree_[node], w);
+        }
+      }
+      tree_[0] = w;
+      FindRunnerUp();
+    } else {
+      // Fast path: the winner still beats every child it has beaten
+      // before, none of the matches on its path change.
+      current_ = Winner();
+    }
+  }
+
+  // The runner-up only ever lost to the winner, so it is the best of the
+  // losers on the winner's path.
+  void FindRunnerUp() {
+    runner_up_ = -1;
+    const int winner = tree_[0];
+    for (int node = (leaves_ + winner) / 2; node >= 1; node /= 2) {
+      if (runner_up_ < 0 || Beats(tree_[node], runner_up_)) {
+        runner_up_ = tree_[node];
+      }
+    }
+    current_ = Winner();
+  }
+
+  IteratorWrapper* Winner() {
+    const int winner = tree_[0];
+    if (winner < n_ && children_[winner].Valid()) {
+      return &children_[winner];
+    }
+    return nullptr;
+  }
+
+  const Comparator* comparator_;
+  IteratorWrapper* children_;
+  int n_;
+  int leaves_;  // n_ rounded up to a power of two
+  int* tree_;   // tree_[0]: winner; tree_[1..leaves_-1]: losers
+  int runner_up_;
+  IteratorWrapper* current_;
+  Direction direction_;
+};
+
+// Below this many children a linear scan beats maintaining the tree.
+static const int kLoserTreeMinChildren = 5;
+
 }  // namespace
 
 Iterator* NewMergingIterator(const Comparator* comparator, Iterator** children,
@@ -195,8 +428,10 @@ Iterator* NewMergingIterator(const Comparator* comparator, Iterator** children,
     return NewEmptyIterator();
   } else if (n == 1) {
     return children[0];
-  } else {
+  } else if (n < kLoserTreeMinChildren) {
     return new MergingIterator(comparator, children, n);
+  } else {
+    return new LoserTreeIterator(comparator, children, n);
   }
 }
 
@@ -7,6 +7,9 @@
 
 #include "leveldb/table.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "leveldb/cache.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
@@ -176,12 +179,126 @@ static void ReleaseBlock(void* arg, void* h) {
   cache->Release(handle);
 }
 
+namespace {
+
+// Serves the reads of one table iterator from a buffer filled
+// "readahead_size" bytes at a time, so that a sequential scan issues one
+// large read instead of one small read per block.  Data is copied into
+// the caller's scratch space since the buffer is refilled on later reads.
+// A read that misses just before the buffer (a reverse scan) refills the
+// window so that it ends at the requested block instead of starting there.
+class ReadaheadFile : public RandomAccessFile {
+ public:
+  // Reads ahead never go past "limit" (some files reject reads past
+  // their end).
+  ReadaheadFile(RandomAccessFile* file, size_t readahead_size, uint64_t limit)
+      : file_(file),
+        readahead_size_(readahead_size),
+        limit_(limit),
+        buf_(nullptr),
+        buf_offset_(0),
+        buf_len_(0) {}
+
+  ~ReadaheadFile() override { delete[] buf_; }
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override {
+    if (offset < buf_offset_ || offset + n > buf_offset_ + buf_len_) {
+      uint64_t start = offset;
+      size_t size;
+      if (buf_len_ > 0 && offset < buf_offset_) {
+        //向前扫描：预读窗口以请求的block结尾
+        start = (offset + n > readahead_size_) ? offset + n - readahead_size_
+                                               : 0;
+        size = static_cast<size_t>(offset + n - start);
+      } else {
+        const uint64_t left = (offset < limit_) ? limit_ - offset : 0;
+        size = static_cast<size_t>(std::min<uint64_t>(readahead_size_, left));
+      }
+      if (n >= size) {
+        return file_->Read(offset, n, result, scratch);
+      }
+      if (buf_ == nullptr) {
+        buf_ = new char[readahead_size_];
+      }
+      buf_len_ = 0;
+      Slice data;
+      Status s = file_->Read(start, size, &data, buf_);
+      if (!s.ok()) {
+        return s;
+      }
+      if (data.data() != buf_) {
+        // The file keeps its contents in memory (e.g. mmap): hand out a
+        // pointer into it, there is nothing to buffer.
+        const size_t skip = static_cast<size_t>(offset - start);
+        if (data.size() <= skip) {
+          *result = Slice();
+        } else {
+          *result = Slice(data.data() + skip, std::min(n, data.size() - skip));
+        }
+        return s;
+      }
+      buf_offset_ = start;
+      buf_len_ = data.size();
+      if (offset >= buf_offset_ + buf_len_) {
+        // Short read that ended before the requested block
+        *result = Slice();
+        return s;
+      }
+    }
+    const size_t avail =
+        std::min(n, static_cast<size_t>(buf_offset_ + buf_len_ - offset));
+    std::memcpy(scratch, buf_ + (offset - buf_offset_), avail);
+    *result = Slice(scratch, avail);
+    return Status::OK();
+  }
+
+ private:
+  RandomAccessFile* const file_;
+  const size_t readahead_size_;
+  const uint64_t limit_;
+  mutable char* buf_;
+  mutable uint64_t buf_offset_;
+  mutable size_t buf_len_;
+};
+
+}  // namespace
+
+//data block都在metaindex block之前，预读不超过这里
+struct Table::Readahead {
+  Readahead(Table* t, size_t readahead_size)
+      : table(t),
+        file(t->rep_->file, readahead_size,
+             t->rep_->metaindex_handle.offset()) {}
+
+  static void Delete(void* arg, void* ignored) {
+    delete reinterpret_cast<Readahead*>(arg);
+  }
+
+  Table* const table;
+  ReadaheadFile file;
+};
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 //传入index block的一个条目，构造一个对应data block的迭代器
 Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
                              const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
+  return ReadBlockIterator(table, table->rep_->file, options, index_value);
+}
+
+Iterator* Table::ReadaheadBlockReader(void* arg, const ReadOptions& options,
+                                      const Slice& index_value) {
+  Readahead* readahead = reinterpret_cast<Readahead*>(arg);
+  return ReadBlockIterator(readahead->table, &readahead->file, options,
+                           index_value);
+}
+
+//从file（可能带预读缓冲）读出index_value指向的data block
+Iterator* Table::ReadBlockIterator(Table* table, RandomAccessFile* file,
+                                   const ReadOptions& options,
+                                   const Slice& index_value) {
   Cache* block_cache = table->rep_->options.block_cache;
   Block* block = nullptr;
   Cache::Handle* cache_handle = nullptr;
@@ -210,7 +327,7 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
       } else {
         //不存在则还是从file中读
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        s = ReadBlock(file, options, handle, &contents);
         if (s.ok()) {
           block = new Block(contents);
           //如果允许缓存，放入block cache
@@ -221,7 +338,7 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
         }
       }
     } else {//不允许缓存，直接从file读
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      s = ReadBlock(file, options, handle, &contents);
       if (s.ok()) {
         block = new Block(contents);
       }
@@ -247,6 +364,15 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
 
 
 Iterator* Table::NewIterator(const ReadOptions& options) const {
+  if (options.readahead_size > 0) {
+    Readahead* readahead =
+        new Readahead(const_cast<Table*>(this), options.readahead_size);
+    Iterator* iter = NewTwoLevelIterator(
+        rep_->index_block->NewIterator(rep_->options.comparator),
+        &Table::ReadaheadBlockReader, readahead, options);
+    iter->RegisterCleanup(&Readahead::Delete, readahead, nullptr);
+    return iter;
+  }
   return NewTwoLevelIterator(
       rep_->index_block->NewIterator(rep_->options.comparator),//构造index_block上的迭代器
       &Table::BlockReader, const_cast<Table*>(this), options);//BlockReader函数，index value->data block iter
@@ -291,6 +417,29 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
   return s;
 }
 
+//只查index block和filter，不读data block
+bool Table::KeyMayMatch(const Slice& k) const {
+  FilterBlockReader* filter = rep_->filter;
+  if (filter == nullptr) {
+    return true;
+  }
+  bool may_match = true;
+  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  iiter->Seek(k);
+  if (iiter->Valid()) {
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    if (handle.DecodeFrom(&handle_value).ok()) {
+      may_match = filter->KeyMayMatch(handle.offset(), k);
+    }
+  } else if (iiter->status().ok()) {
+    // Past the last block
+    may_match = false;
+  }
+  delete iiter;
+  return may_match;
+}
+
 //key在table中的大概的偏移量
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
   Iterator* index_iter =
@@ -4,6 +4,7 @@
 
 #include "leveldb/table.h"
 
+#include <algorithm>
 #include <map>
 #include <string>
 
@@ -18,6 +19,7 @@
 #include "table/block.h"
 #include "table/block_builder.h"
 #include "table/format.h"
+#include "table/merger.h"
 #include "util/random.h"
 #include "util/testutil.h"
 
@@ -109,14 +111,17 @@ class StringSink : public WritableFile {
 class StringSource : public RandomAccessFile {
  public:
   StringSource(const Slice& contents)
-      : contents_(contents.data(), contents.size()) {}
+      : contents_(contents.data(), contents.size()), num_reads_(0) {}
 
   ~StringSource() override = default;
 
   uint64_t Size() const { return contents_.size(); }
 
+  int num_reads() const { return num_reads_; }
+
   Status Read(uint64_t offset, size_t n, Slice* result,
               char* scratch) const override {
+    num_reads_++;
     if (offset >= contents_.size()) {
       return Status::InvalidArgument("invalid Read offset");
     }
@@ -130,6 +135,7 @@ class StringSource : public RandomAccessFile {
 
  private:
   std::string contents_;
+  mutable int num_reads_;
 };
 
 typedef std::map<std::string, std::string, STLLessThan> KVMap;
@@ -241,6 +247,12 @@ class TableConstructor : public Constructor {
     return table_->ApproximateOffsetOf(key);
   }
 
+  Iterator* NewIterator(const ReadOptions& options) const {
+    return table_->NewIterator(options);
+  }
+
+  int NumReads() const { return source_->num_reads(); }
+
  private:
   void Reset() {
     delete table_;
@@ -745,6 +757,79 @@ TEST(MemTableTest, Simple) {
   memtable->Unref();
 }
 
+TEST(MergerTest, LoserTree) {
+  // Enough children to get the loser tree, and not a power of two so
+  // that the tree has padding leaves.
+  const int kNumChildren = 11;
+  Random rnd(test::RandomSeed());
+  Options options;
+  options.block_restart_interval = 4;
+  std::vector<BlockConstructor*> blocks;
+  std::vector<std::string> all;
+  int next = 0;
+  for (int i = 0; i < kNumChildren; i++) {
+    blocks.push_back(new BlockConstructor(BytewiseComparator()));
+    // Some children stay empty
+    const int num_keys = (i % 4 == 3) ? 0 : 1 + rnd.Uniform(200);
+    for (int j = 0; j < num_keys; j++) {
+      // Distinct keys, randomly spread over the children
+      next += 1 + rnd.Uniform(3);
+      char buf[20];
+      std::snprintf(buf, sizeof(buf), "%08d", next * kNumChildren + i);
+      blocks[i]->Add(buf, "v");
+      all.push_back(buf);
+    }
+  }
+  std::sort(all.begin(), all.end());
+  std::vector<Iterator*> children;
+  for (BlockConstructor* b : blocks) {
+    std::vector<std::string> keys;
+    KVMap kvmap;
+    b->Finish(options, &keys, &kvmap);
+    children.push_back(b->NewIterator());
+  }
+  Iterator* iter = NewMergingIterator(BytewiseComparator(), &children[0],
+                                      kNumChildren);
+
+  size_t pos = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(all[pos++], iter->key().ToString());
+  }
+  ASSERT_EQ(all.size(), pos);
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    ASSERT_EQ(all[--pos], iter->key().ToString());
+  }
+  ASSERT_EQ(0, pos);
+
+  // Random walk, changing direction now and then
+  iter->SeekToFirst();
+  pos = 0;
+  for (int i = 0; i < 2000; i++) {
+    const int op = rnd.Uniform(10);
+    if (op == 0) {
+      const std::string target = all[rnd.Uniform(all.size())];
+      iter->Seek(target);
+      pos = std::lower_bound(all.begin(), all.end(), target) - all.begin();
+    } else if (op < 4) {
+      if (pos == 0 || !iter->Valid()) continue;
+      iter->Prev();
+      pos--;
+    } else {
+      if (pos + 1 >= all.size() || !iter->Valid()) continue;
+      iter->Next();
+      pos++;
+    }
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(all[pos], iter->key().ToString());
+  }
+  ASSERT_TRUE(iter->status().ok());
+
+  delete iter;
+  for (BlockConstructor* b : blocks) {
+    delete b;
+  }
+}
+
 static bool Between(uint64_t val, uint64_t low, uint64_t high) {
   bool result = (val >= low) && (val <= high);
   if (!result) {
@@ -784,6 +869,55 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 610000, 612000));
 }
 
+TEST(TableTest, Readahead) {
+  TableConstructor c(BytewiseComparator());
+  Random rnd(301);
+  for (int i = 0; i < 1000; i++) {
+    char key[20];
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    std::string value;
+    test::RandomString(&rnd, 100, &value);
+    c.Add(key, value);
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  c.Finish(options, &keys, &kvmap);
+
+  ReadOptions read_options;
+  Iterator* iter = c.NewIterator(read_options);
+  int reads = c.NumReads();
+  size_t pos = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(keys[pos++], iter->key().ToString());
+  }
+  ASSERT_EQ(keys.size(), pos);
+  delete iter;
+  const int block_reads = c.NumReads() - reads;
+
+  // Same contents, in both directions, with a small fraction of the reads
+  read_options.readahead_size = 16 * 1024;
+  iter = c.NewIterator(read_options);
+  reads = c.NumReads();
+  pos = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(keys[pos++], iter->key().ToString());
+    ASSERT_EQ(kvmap[keys[pos - 1]], iter->value().ToString());
+  }
+  ASSERT_EQ(keys.size(), pos);
+  ASSERT_LT(4 * (c.NumReads() - reads), block_reads);
+  reads = c.NumReads();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    ASSERT_EQ(keys[--pos], iter->key().ToString());
+  }
+  ASSERT_EQ(0, pos);
+  ASSERT_LT(4 * (c.NumReads() - reads), block_reads);
+  ASSERT_TRUE(iter->status().ok());
+  delete iter;
+}
+
 static bool SnappyCompressionSupported() {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
@@ -7,6 +7,7 @@
 #define B_PLUS_TREE_BPLUSTREE_H
 
 #include <iostream>
+#include <unordered_map>
 #include "leaf_node.h"
 #include "inner_node.h"
 #include "node.h"
@@ -83,14 +84,45 @@ public:
         return new Iterator(static_cast<LeafNode<K, V>*>(leaf_node), offset, key_high);
     };*/
 
+    // Set the value of every key in [low, high) to v, walking the leaf chain
+    // once.  The structure of the tree is not changed, so live iterators
+    // remain usable.
+    void update_range(const K &low, const K &high, const V &v) {
+        int position;
+        LeafNode<K, V> *leaf = locate_leaf(low, position);
+        while (leaf != 0) {
+            for (; position < leaf->size_; ++position) {
+                if (!(leaf->entries_[position].key < high))
+                    return;
+                leaf->entries_[position].val = v;
+            }
+            leaf = leaf->right_sibling_;
+            position = 0;
+        }
+    }
+
+    // Replace every value found in "remap" by its mapped value, walking the
+    // leaf chain once.  Returns the number of entries changed.  Like
+    // update_range, the structure of the tree is not changed.
+    size_t remap_values(const std::unordered_map<V, V> &remap) {
+        size_t changed = 0;
+        LeafNode<K, V> *leaf =
+                static_cast<LeafNode<K, V> *>(root_->get_leftmost_leaf_node());
+        while (leaf != 0) {
+            for (int position = 0; position < leaf->size_; ++position) {
+                auto it = remap.find(leaf->entries_[position].val);
+                if (it != remap.end()) {
+                    leaf->entries_[position].val = it->second;
+                    ++changed;
+                }
+            }
+            leaf = leaf->right_sibling_;
+        }
+        return changed;
+    }
+
     typename BTree<K, V>::Iterator* NewTreeIterator(){
-        LeafNode<K, V> *leftmost;
-        LeafNode<K, V> *rightmost;
-        leftmost = 
-            static_cast<LeafNode<K, V> *>(root_->get_leftmost_leaf_node());
-        rightmost = 
-            static_cast<LeafNode<K, V> *>(root_->get_rightmost_leaf_node());
-        return new TreeIterator(leftmost, rightmost, root_);
+        return new TreeIterator(this);
     }
 
     class TreeIterator: public BTree<K, V>::Iterator {
@@ -98,34 +130,31 @@ public:
     enum Direction { kForward, kReverse };
 
     public:
-        TreeIterator(LeafNode<K, V> *leftmost, LeafNode<K, V> *rightmost, Node<K, V> *root){
-            //root_->FirstNode(leaf_node);
-            leftmost_node_ = leftmost;
-            rightmost_node_ = rightmost;
-            iter_root_ = root;
-        }
+        //根节点会随分裂而改变，所以迭代器持有树本身，每次定位都从当前的根出发
+        TreeIterator(VanillaBPlusTree<K, V> *tree)
+            : tree_(tree), leaf_node_(0), offset_(0), direction_(kForward) {}
         /*TreeIterator(LeafNode<K, V> *leaf_node, int offset): leaf_node_(leaf_node), offset_(offset),
                                                                    upper_bound_(false) {};*/
         /*TreeIterator(LeafNode<K, V> *leaf_node, int offset, K key_high): leaf_node_(leaf_node), offset_(offset),
                                                                    upper_bound_(true), key_high_(key_high) {};*/
         bool Valid() {
-        if(direction_ == kForward)
-            return (offset_ < leaf_node_->size_ || ((offset_ == leaf_node_->size_) && (leaf_node_ != rightmost_node_)) );
-            return (offset_ >= 0 || ((offset_ < 0) && (leaf_node_ != leftmost_node_)));
+            return leaf_node_ != 0 && offset_ >= 0 && offset_ < leaf_node_->size_;
         }
 
         virtual void SeekToFirst(){
-            leaf_node_ = leftmost_node_;
+            leaf_node_ =
+                static_cast<LeafNode<K, V> *>(tree_->root_->get_leftmost_leaf_node());
             offset_ = 0;
-            ParseNextKey();
             direction_ = kForward;
-        }//SeekToFirst()之后还需要next？
+            ParseNextKey();
+        }
 
         virtual void SeekToLast(){ 
-            leaf_node_ = rightmost_node_;    
+            leaf_node_ =
+                static_cast<LeafNode<K, V> *>(tree_->root_->get_rightmost_leaf_node());
             offset_ = leaf_node_->size_-1;
+            direction_ = kReverse;
             ParsePrevKey();  
-            direction_ = kReverse;   
         }
 
         virtual void SetForward(bool flag){
@@ -142,10 +171,11 @@ public:
                 return false;
         }
 
+        //定位到第一个>=key的条目
         virtual void Seek(K key){
-            Node<K, V> *tmp;
-            iter_root_->locate_key(key, tmp, offset_);
-            leaf_node_ = static_cast<LeafNode<K, V>*>(tmp);
+            leaf_node_ = tree_->locate_leaf(key, offset_);
+            direction_ = kForward;
+            ParseNextKey();
         }
 
         bool ParsePrevKey(){
@@ -182,11 +212,13 @@ public:
         }
 
         virtual void Next(){
+            direction_ = kForward;
             offset_++;
             ParseNextKey();
         }
 
         virtual void Prev(){
+            direction_ = kReverse;
             offset_--;
             ParsePrevKey();
         }
@@ -214,10 +246,8 @@ public:
             }
         }*/
     private:
+        VanillaBPlusTree<K, V> *tree_;
         LeafNode<K, V> *leaf_node_;
-        LeafNode<K, V> *rightmost_node_;
-        LeafNode<K, V> *leftmost_node_;
-        Node<K, V> *iter_root_;
         int offset_;
         //bool upper_bound_;
         //K key_high_;
@@ -234,6 +264,22 @@ private:
         capacity_ = capacity;
     }
 
+    // Return the leaf that would hold k; position is set to the index of the
+    // first entry >= k (possibly the size of the leaf).
+    LeafNode<K, V>* locate_leaf(const K &k, int &position) const {
+        Node<K, V> *node = root_;
+        while (node->type() == INNER) {
+            InnerNode<K, V> *inner = static_cast<InnerNode<K, V> *>(node);
+            int index = inner->locate_child_index(k);
+            if (index < 0)
+                index = 0;//k小于最左边界
+            node = inner->child_[index];
+        }
+        LeafNode<K, V> *leaf = static_cast<LeafNode<K, V> *>(node);
+        leaf->search_key_position(k, position);
+        return leaf;
+    }
+
 protected:
     Node<K, V> *root_;
     int depth_;
@@ -4,17 +4,116 @@
 
 #include "util/arena.h"
 
+#if HAVE_MAP_HUGETLB || HAVE_MADV_HUGEPAGE
+#include <sys/mman.h>
+#endif  // HAVE_MAP_HUGETLB || HAVE_MADV_HUGEPAGE
+#if HAVE_MBIND
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // HAVE_MBIND
+
+#include "util/mutexlock.h"
+
 namespace leveldb {
 
 static const int kBlockSize = 4096;
 
+namespace {
+
+// Map "bytes" (a multiple of huge_page_size) of anonymous memory backed by
+// huge pages.  Returns nullptr on failure.
+char* MapHugePages(size_t bytes, size_t huge_page_size) {
+#if HAVE_MAP_HUGETLB
+  void* hugetlb = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (hugetlb != MAP_FAILED) {
+    return static_cast<char*>(hugetlb);
+  }
+#endif  // HAVE_MAP_HUGETLB
+#if HAVE_MADV_HUGEPAGE
+  // No huge pages reserved: map normal pages aligned to huge_page_size and
+  // let the kernel back them with transparent huge pages
+  const size_t mapped_bytes = bytes + huge_page_size;
+  void* mapped = ::mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) {
+    return nullptr;
+  }
+  char* start = static_cast<char*>(mapped);
+  const size_t misalignment =
+      reinterpret_cast<uintptr_t>(start) % huge_page_size;
+  char* aligned =
+      start + (misalignment == 0 ? 0 : huge_page_size - misalignment);
+  //去掉首尾未对齐的部分
+  if (aligned > start) {
+    ::munmap(start, aligned - start);
+  }
+  if (start + mapped_bytes > aligned + bytes) {
+    ::munmap(aligned + bytes, start + mapped_bytes - (aligned + bytes));
+  }
+  // Only advice: the pages still work if the kernel declines
+  ::madvise(aligned, bytes, MADV_HUGEPAGE);
+  return aligned;
+#else
+  (void)bytes;
+  (void)huge_page_size;
+  return nullptr;
+#endif  // HAVE_MADV_HUGEPAGE
+}
+
+// Prefer NUMA node "numa_node" for the pages of [p, p + bytes).  Must be
+// called before the pages are first touched.
+void BindToNumaNode(char* p, size_t bytes, int numa_node) {
+#if HAVE_MBIND
+  if (numa_node < 0 ||
+      numa_node >= static_cast<int>(8 * sizeof(unsigned long))) {
+    return;
+  }
+  const unsigned long nodemask = 1UL << numa_node;
+  //MPOL_PREFERRED：该节点内存不足时仍可使用其他节点
+  ::syscall(SYS_mbind, p, bytes, MPOL_PREFERRED, &nodemask,
+            8 * sizeof(nodemask), 0);
+#else
+  (void)p;
+  (void)bytes;
+  (void)numa_node;
+#endif  // HAVE_MBIND
+}
+
+}  // namespace
+
 Arena::Arena()
-    : alloc_ptr_(nullptr), alloc_bytes_remaining_(0), memory_usage_(0) {}
+    : alloc_ptr_(nullptr),
+      alloc_bytes_remaining_(0),
+      reserved_(nullptr),
+      reserved_size_(0),
+      reserved_used_(0),
+      memory_usage_(0) {}
+
+Arena::Arena(size_t reserved_bytes, size_t huge_page_size, int numa_node)
+    : Arena() {
+  if (reserved_bytes == 0 || huge_page_size == 0) {
+    return;
+  }
+  const size_t bytes =
+      (reserved_bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+  reserved_ = MapHugePages(bytes, huge_page_size);
+  if (reserved_ != nullptr) {
+    reserved_size_ = bytes;
+    BindToNumaNode(reserved_, bytes, numa_node);
+  }
+}
 
 Arena::~Arena() {
   for (size_t i = 0; i < blocks_.size(); i++) {
     delete[] blocks_[i];
   }
+#if HAVE_MAP_HUGETLB || HAVE_MADV_HUGEPAGE
+  if (reserved_ != nullptr) {
+    ::munmap(reserved_, reserved_size_);
+  }
+#endif  // HAVE_MAP_HUGETLB || HAVE_MADV_HUGEPAGE
 }
 
 char* Arena::AllocateFallback(size_t bytes) {
@@ -55,7 +154,27 @@ char* Arena::AllocateAligned(size_t bytes) {
   return result;
 }
 
+char* Arena::AllocateConcurrently(size_t bytes) {
+  MutexLock l(&mu_);
+  return Allocate(bytes);
+}
+
+char* Arena::AllocateAlignedConcurrently(size_t bytes) {
+  MutexLock l(&mu_);
+  return AllocateAligned(bytes);
+}
+
 char* Arena::AllocateNewBlock(size_t block_bytes) {
+  // Blocks are multiples of the alignment AllocateAligned() needs, so
+  // carving them one after another keeps them aligned
+  const size_t align = (sizeof(void*) > 8) ? sizeof(void*) : 8;
+  const size_t carved_bytes = (block_bytes + align - 1) & ~(align - 1);
+  if (carved_bytes <= reserved_size_ - reserved_used_) {
+    char* result = reserved_ + reserved_used_;
+    reserved_used_ += carved_bytes;
+    memory_usage_.fetch_add(carved_bytes, std::memory_order_relaxed);
+    return result;
+  }
   char* result = new char[block_bytes];
   blocks_.push_back(result);
   memory_usage_.fetch_add(block_bytes + sizeof(char*),
@@ -11,12 +11,23 @@
 #include <cstdint>
 #include <vector>
 
+#include "port/port.h"
+
 namespace leveldb {
 
 class Arena {
  public:
   Arena();
 
+  // An arena whose blocks are carved out of one mapping of at least
+  // "reserved_bytes", made of pages of "huge_page_size" bytes (a multiple
+  // of the system page size).  The mapping uses MAP_HUGETLB pages when the
+  // system has some reserved, and transparent huge pages otherwise.  If
+  // numa_node >= 0, its pages are preferably placed on that NUMA node.
+  // Blocks come from new[] once the mapping is used up, or if it could
+  // not be made.
+  Arena(size_t reserved_bytes, size_t huge_page_size, int numa_node);
+
   Arena(const Arena&) = delete;
   Arena& operator=(const Arena&) = delete;
 
@@ -28,6 +39,12 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc.
   char* AllocateAligned(size_t bytes);
 
+  // Thread-safe versions of Allocate() and AllocateAligned(), for arenas
+  // filled by several writers at once.  They must not run concurrently
+  // with the unsynchronized versions.
+  char* AllocateConcurrently(size_t bytes);
+  char* AllocateAlignedConcurrently(size_t bytes);
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena.
   size_t MemoryUsage() const {
@@ -45,11 +62,19 @@ class Arena {
   // Array of new[] allocated memory blocks
   std::vector<char*> blocks_;
 
+  // Huge page mapping that blocks are carved from first, if any
+  char* reserved_;
+  size_t reserved_size_;
+  size_t reserved_used_;
+
   // Total memory usage of the arena.
   //
   // TODO(costan): This member is accessed via atomics, but the others are
   //               accessed without any locking. Is this OK?
   std::atomic<size_t> memory_usage_;
+
+  // Serializes the *Concurrently() allocations
+  port::Mutex mu_;
 };
 
 inline char* Arena::Allocate(size_t bytes) {
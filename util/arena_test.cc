@@ -11,9 +11,8 @@ namespace leveldb {
 
 TEST(ArenaTest, Empty) { Arena arena; }
 
-TEST(ArenaTest, Simple) {
+static void FillAndCheck(Arena* arena) {
   std::vector<std::pair<size_t, char*>> allocated;
-  Arena arena;
   const int N = 100000;
   size_t bytes = 0;
   Random rnd(301);
@@ -32,9 +31,9 @@ TEST(ArenaTest, Simple) {
     }
     char* r;
     if (rnd.OneIn(10)) {
-      r = arena.AllocateAligned(s);
+      r = arena->AllocateAligned(s);
     } else {
-      r = arena.Allocate(s);
+      r = arena->Allocate(s);
     }
 
     for (size_t b = 0; b < s; b++) {
@@ -43,9 +42,9 @@ TEST(ArenaTest, Simple) {
     }
     bytes += s;
     allocated.push_back(std::make_pair(s, r));
-    ASSERT_GE(arena.MemoryUsage(), bytes);
+    ASSERT_GE(arena->MemoryUsage(), bytes);
     if (i > N / 10) {
-      ASSERT_LE(arena.MemoryUsage(), bytes * 1.10);
+      ASSERT_LE(arena->MemoryUsage(), bytes * 1.10);
     }
   }
   for (size_t i = 0; i < allocated.size(); i++) {
@@ -58,4 +57,16 @@ TEST(ArenaTest, Simple) {
   }
 }
 
+TEST(ArenaTest, Simple) {
+  Arena arena;
+  FillAndCheck(&arena);
+}
+
+TEST(ArenaTest, HugePages) {
+  // Smaller than what FillAndCheck() allocates, so that the arena also
+  // falls back to new[] blocks
+  Arena arena(1 << 20, 2 << 20, 0);
+  FillAndCheck(&arena);
+}
+
 }  // namespace leveldb
@@ -276,9 +276,12 @@ class PosixMmapReadableFile final : public RandomAccessFile {
 
 class PosixWritableFile final : public WritableFile {
  public:
-  PosixWritableFile(std::string filename, int fd)
+  PosixWritableFile(std::string filename, int fd, uint64_t file_size = 0)
       : pos_(0),
         fd_(fd),
+        file_size_(file_size),
+        preallocation_block_size_(0),
+        last_preallocated_block_(0),
         is_manifest_(IsManifest(filename)),
         filename_(std::move(filename)),
         dirname_(Dirname(filename_)) {}
@@ -331,6 +334,12 @@ class PosixWritableFile final : public WritableFile {
 
   Status Flush() override { return FlushBuffer(); }
 
+  // Preallocated space past the end of the file is kept on Close(): it is
+  // released when the file is deleted, and a recycled log reuses it.
+  void SetPreallocationBlockSize(size_t size) override {
+    preallocation_block_size_ = size;
+  }
+
   Status Sync() override {
     // Ensure new files referred to by the manifest are in the filesystem.
     //
@@ -358,6 +367,7 @@ class PosixWritableFile final : public WritableFile {
   }
 
   Status WriteUnbuffered(const char* data, size_t size) {
+    PrepareWrite(size);
     while (size > 0) {
       ssize_t write_result = ::write(fd_, data, size);
       if (write_result < 0) {
@@ -368,10 +378,36 @@ class PosixWritableFile final : public WritableFile {
       }
       data += write_result;
       size -= write_result;
+      file_size_ += write_result;
     }
     return Status::OK();
   }
 
+  // Reserves whole preallocation blocks covering the next "size" bytes, so
+  // the write neither allocates blocks nor (together with fdatasync) forces
+  // extra metadata updates block by block.  Failures are ignored: the
+  // reservation is only an optimization.
+  void PrepareWrite(size_t size) {
+#if HAVE_FALLOCATE
+    if (preallocation_block_size_ == 0 || size == 0) {
+      return;
+    }
+    const uint64_t block_size = preallocation_block_size_;
+    const uint64_t new_last_block =
+        (file_size_ + size + block_size - 1) / block_size;
+    if (new_last_block > last_preallocated_block_) {
+      //FALLOC_FL_KEEP_SIZE：只分配空间，不改变文件大小
+      ::fallocate(fd_, FALLOC_FL_KEEP_SIZE,
+                  static_cast<off_t>(last_preallocated_block_ * block_size),
+                  static_cast<off_t>((new_last_block - last_preallocated_block_) *
+                                     block_size));
+      last_preallocated_block_ = new_last_block;
+    }
+#else
+    (void)size;
+#endif  // HAVE_FALLOCATE
+  }
+
   Status SyncDirIfManifest() {
     Status status;
     if (!is_manifest_) {
@@ -458,6 +494,9 @@ class PosixWritableFile final : public WritableFile {
   char buf_[kWritableFileBufferSize];
   size_t pos_;
   int fd_;
+  uint64_t file_size_;  // Bytes written to fd_ (plus the initial size)
+  size_t preallocation_block_size_;  // 0: no preallocation
+  uint64_t last_preallocated_block_;  // Blocks [0, last) are preallocated
 
   const bool is_manifest_;  // True if the file's name starts with MANIFEST.
   const std::string filename_;
@@ -592,6 +631,33 @@ class PosixEnv : public Env {
       return PosixError(filename, errno);
     }
 
+    struct ::stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+      Status status = PosixError(filename, errno);
+      ::close(fd);
+      *result = nullptr;
+      return status;
+    }
+    *result = new PosixWritableFile(filename, fd, file_stat.st_size);
+    return Status::OK();
+  }
+
+  Status ReuseWritableFile(const std::string& filename,
+                           const std::string& old_filename,
+                           WritableFile** result) override {
+    if (std::rename(old_filename.c_str(), filename.c_str()) != 0) {
+      *result = nullptr;
+      return PosixError(old_filename, errno);
+    }
+    // No O_TRUNC: the old contents are overwritten in place, so writes that
+    // stay within the old file size do not change the file's metadata.
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | kOpenBaseFlags,
+                    0644);
+    if (fd < 0) {
+      *result = nullptr;
+      return PosixError(filename, errno);
+    }
+
     *result = new PosixWritableFile(filename, fd);
     return Status::OK();
   }
@@ -0,0 +1,128 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include <algorithm>
+
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+RateLimiter::~RateLimiter() = default;
+
+namespace {
+
+// Token bucket kept as a virtual clock: next_free_micros_ is the time at
+// which every byte granted so far has been paid for at rate_.  A kLow
+// request sleeps until its own bytes are paid for; a kHigh request is
+// granted at once and only pushes the clock forward.
+class GenericRateLimiter : public RateLimiter {
+ public:
+  GenericRateLimiter(int64_t bytes_per_second, bool auto_tuned, Env* env)
+      : env_(env),
+        auto_tuned_(auto_tuned),
+        max_rate_(std::max<int64_t>(bytes_per_second, 1)),
+        rate_(max_rate_),
+        next_free_micros_(0),
+        latency_(0),
+        baseline_(0),
+        next_tune_micros_(0) {
+    total_bytes_[kLow] = 0;
+    total_bytes_[kHigh] = 0;
+  }
+
+  ~GenericRateLimiter() override = default;
+
+  void Request(int64_t bytes, IOPriority pri) override {
+    uint64_t wait = 0;
+    {
+      MutexLock l(&mu_);
+      total_bytes_[pri] += bytes;
+      const uint64_t now = env_->NowMicros();
+      // Unused budget is saved up for at most one refill period.
+      if (next_free_micros_ + kRefillPeriodMicros < now) {
+        next_free_micros_ = now - kRefillPeriodMicros;
+      }
+      next_free_micros_ += static_cast<uint64_t>(bytes) * 1000000 / rate_;
+      if (pri == kLow && next_free_micros_ > now) {
+        wait = next_free_micros_ - now;
+      }
+    }
+    if (wait > 0) {
+      env_->SleepForMicroseconds(static_cast<int>(wait));
+    }
+  }
+
+  void RecordForegroundLatency(uint64_t micros) override {
+    if (!auto_tuned_) {
+      return;
+    }
+    MutexLock l(&mu_);
+    latency_ = (latency_ == 0) ? micros : (latency_ * 15 + micros) / 16;
+    if (baseline_ == 0 || latency_ < baseline_) {
+      baseline_ = latency_;
+    }
+    const uint64_t now = env_->NowMicros();
+    if (now < next_tune_micros_) {
+      return;
+    }
+    next_tune_micros_ = now + kTunePeriodMicros;
+    if (latency_ > 2 * baseline_) {
+      rate_ = std::max(rate_ * 4 / 5, std::max<int64_t>(max_rate_ / 20, 1));
+    } else if (latency_ < baseline_ + baseline_ / 2) {
+      rate_ = std::min(rate_ * 5 / 4 + 1, max_rate_);
+    }
+    // Let the baseline drift up so that it follows a lasting change of
+    // the foreground workload.
+    baseline_ += baseline_ / 16 + 1;
+  }
+
+  int64_t GetBytesPerSecond() const override {
+    MutexLock l(&mu_);
+    return rate_;
+  }
+
+  void SetBytesPerSecond(int64_t bytes_per_second) override {
+    MutexLock l(&mu_);
+    max_rate_ = std::max<int64_t>(bytes_per_second, 1);
+    rate_ = max_rate_;
+  }
+
+  int64_t GetTotalBytesThrough(IOPriority pri) const override {
+    MutexLock l(&mu_);
+    return total_bytes_[pri];
+  }
+
+ private:
+  static const uint64_t kRefillPeriodMicros = 100 * 1000;
+  static const uint64_t kTunePeriodMicros = 1000 * 1000;
+
+  Env* const env_;
+  const bool auto_tuned_;
+
+  mutable port::Mutex mu_;
+  int64_t max_rate_ GUARDED_BY(mu_);
+  int64_t rate_ GUARDED_BY(mu_);
+  uint64_t next_free_micros_ GUARDED_BY(mu_);
+  int64_t total_bytes_[kNumPriorities] GUARDED_BY(mu_);
+
+  // Auto-tuning state: moving average and baseline of foreground latency
+  uint64_t latency_ GUARDED_BY(mu_);
+  uint64_t baseline_ GUARDED_BY(mu_);
+  uint64_t next_tune_micros_ GUARDED_BY(mu_);
+};
+
+}  // namespace
+
+RateLimiter* NewGenericRateLimiter(int64_t bytes_per_second, bool auto_tuned,
+                                   Env* env) {
+  return new GenericRateLimiter(bytes_per_second, auto_tuned,
+                                env != nullptr ? env : Env::Default());
+}
+
+}  // namespace leveldb
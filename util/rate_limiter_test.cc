@@ -0,0 +1,85 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include "gtest/gtest.h"
+#include "leveldb/env.h"
+
+namespace leveldb {
+
+// Env whose clock only moves when somebody sleeps.
+class FakeClockEnv : public EnvWrapper {
+ public:
+  FakeClockEnv() : EnvWrapper(Env::Default()), now_(1000000000), slept_(0) {}
+
+  uint64_t NowMicros() override { return now_; }
+  void SleepForMicroseconds(int micros) override {
+    now_ += micros;
+    slept_ += micros;
+  }
+
+  void Advance(uint64_t micros) { now_ += micros; }
+  uint64_t slept() const { return slept_; }
+
+ private:
+  uint64_t now_;
+  uint64_t slept_;
+};
+
+TEST(RateLimiterTest, Throttle) {
+  FakeClockEnv env;
+  RateLimiter* limiter = NewGenericRateLimiter(1 << 20, false, &env);
+  // 10MB at 1MB/s, less the 100ms burst allowance
+  for (int i = 0; i < 10 * 256; i++) {
+    limiter->Request(4096, RateLimiter::kLow);
+  }
+  ASSERT_GE(env.slept(), 9800000);
+  ASSERT_LE(env.slept(), 10000000);
+  ASSERT_EQ(10 << 20, limiter->GetTotalBytesThrough(RateLimiter::kLow));
+  ASSERT_EQ(0, limiter->GetTotalBytesThrough(RateLimiter::kHigh));
+  delete limiter;
+}
+
+TEST(RateLimiterTest, FlushesGoFirst) {
+  FakeClockEnv env;
+  RateLimiter* limiter = NewGenericRateLimiter(1 << 20, false, &env);
+  env.Advance(1000000);
+  // Flushes are never delayed...
+  limiter->Request(2 << 20, RateLimiter::kHigh);
+  ASSERT_EQ(0, env.slept());
+  // ...the compaction after them pays for their bytes.
+  limiter->Request(1024, RateLimiter::kLow);
+  ASSERT_GE(env.slept(), 1900000);
+  ASSERT_EQ(2 << 20, limiter->GetTotalBytesThrough(RateLimiter::kHigh));
+  delete limiter;
+}
+
+TEST(RateLimiterTest, AutoTune) {
+  FakeClockEnv env;
+  RateLimiter* limiter = NewGenericRateLimiter(1 << 20, true, &env);
+  for (int i = 0; i < 100; i++) {
+    limiter->RecordForegroundLatency(100);
+    env.Advance(10000);
+  }
+  ASSERT_EQ(1 << 20, limiter->GetBytesPerSecond());
+
+  // Foreground latency goes up: back off, but not below 1/20
+  for (int i = 0; i < 3000; i++) {
+    limiter->RecordForegroundLatency(1000);
+    env.Advance(10000);
+  }
+  ASSERT_LT(limiter->GetBytesPerSecond(), 1 << 20);
+  ASSERT_GE(limiter->GetBytesPerSecond(), (1 << 20) / 20);
+
+  // Latency is back to normal: speed up again
+  for (int i = 0; i < 3000; i++) {
+    limiter->RecordForegroundLatency(100);
+    env.Advance(10000);
+  }
+  ASSERT_EQ(1 << 20, limiter->GetBytesPerSecond());
+  delete limiter;
+}
+
+}  // namespace leveldb